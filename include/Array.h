@@ -0,0 +1,19 @@
+#ifndef ARRAY_H
+#define ARRAY_H
+
+#include "GC.h"
+
+// Typed arrays store numbers packed in a contiguous buffer instead of as boxed NUMBER objects.
+// Slices and host buffers are never copied, they point straight into the memory of someone else.
+// A host hands over its own buffer (a vertex buffer for example) with gc_make_array_from_buffer.
+
+int array_element_size(ArrayType type);
+const char *array_type_to_str(ArrayType type);
+
+double array_get(Obj *array, int index);
+void array_set(Obj *array, int index, double x);
+
+// Returns a view of [start, end) that shares memory with 'array', or NULL if the range is invalid.
+Obj *array_slice(GC *gc, Obj *array, int start, int end);
+
+#endif
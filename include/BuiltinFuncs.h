@@ -8,6 +8,11 @@
 #include <string.h>
 
 #include "Obj.h"
+#include "Vector.h"
+#include "Map.h"
+#include "Array.h"
+#include "Simd.h"
+#include "Lazy.h"
 
 #define ASSERT_ARG_COUNT(name, x) if(arg_count != x) { printf("Must call '%s' with %d arg(s).\n", name, x); return r->nil; }
 #define ASSERT_ARG_TYPE(name, pos, req_type) if(args[pos]->type != req_type) { printf("Argument %d of '%s' must be a %s.\n", pos, name, type_to_str(req_type)); return r->nil; }
@@ -96,14 +101,22 @@ Obj *greater_than(Runtime *r, Obj *args[], int arg_count) {
   return r->true_val;
 }
 
+Obj *unary_kernel(Runtime *r, const char *name, void (*kernel)(double *out, const double *a, int n), Obj *args[], int arg_count);
+
 Obj *internal_cos(Runtime *r, Obj *args[], int arg_count) {
+  if(arg_count >= 1 && args[0]->type == ARRAY) {
+    return unary_kernel(r, "cos", simd_kernels()->cos, args, arg_count);
+  }
   ASSERT_ARG_COUNT("cos", 1);
   return gc_make_number(r->gc, cos(args[0]->number));
 }
 
 Obj *internal_sin(Runtime *r, Obj *args[], int arg_count) {
+  if(arg_count >= 1 && args[0]->type == ARRAY) {
+    return unary_kernel(r, "sin", simd_kernels()->sin, args, arg_count);
+  }
   ASSERT_ARG_COUNT("sin", 1);
-  return gc_make_number(r->gc, cos(args[0]->number));
+  return gc_make_number(r->gc, sin(args[0]->number));
 }
 
 Obj *internal_mod(Runtime *r, Obj *args[], int arg_count) {
@@ -118,17 +131,18 @@ Obj *internal_floor(Runtime *r, Obj *args[], int arg_count) {
 }
 
 Obj *internal_rand(Runtime *r, Obj *args[], int arg_count) {
+  int x = (int)(runtime_random(r) >> 33); // 31 bits, like rand()
   if(arg_count == 0) {
-    return gc_make_number(r->gc, rand());
+    return gc_make_number(r->gc, x);
   }
   if(arg_count == 1) {
-    return gc_make_number(r->gc, rand() % (int)args[0]->number);
+    return gc_make_number(r->gc, x % (int)args[0]->number);
   }
   if(arg_count == 2) {
     int low = (int)args[0]->number;
     int high = (int)args[1]->number;
     int diff = high - low;
-    return gc_make_number(r->gc, low + rand() % diff);
+    return gc_make_number(r->gc, low + x % diff);
   }
   else {
     printf("Can't call 'rand' with %d arguments.\n", arg_count);
@@ -152,29 +166,26 @@ Obj *or(Runtime *r, Obj *args[], int arg_count) {
 
 Obj *print(Runtime *r, Obj *args[], int arg_count) {
   for(int i = 0; i < arg_count; i++) {
-    printf("%s", obj_to_str(args[i]));
+    port_write_obj(&r->out, lazy_realize_all(r, args[i]), false);
   }
   return r->nil;
 }
 
 Obj *println(Runtime *r, Obj *args[], int arg_count) {
   print(r, args, arg_count);
-  printf("\n");
+  port_write_char(&r->out, '\n');
   return r->nil;
 }
 
 Obj *str(Runtime *r, Obj *args[], int arg_count) {
-  int total_length = 0;
-  for(int i = 0; i < arg_count; i++) {
-    total_length += strlen(obj_to_str(args[i]));
-  }
-  char *s = malloc(total_length + 1);
-  char *s_pos = s;
+  StrBuilder sb;
+  str_builder_init(&sb, 64);
   for(int i = 0; i < arg_count; i++) {
-    s_pos = strcat(s_pos, obj_to_str(args[i]));
+    obj_print_to(&sb, lazy_realize_all(r, args[i]), false);
   }
-  s[total_length] = '\0';
-  return gc_make_string(r->gc, s);
+  int length;
+  char *s = str_builder_take(&sb, &length);
+  return gc_make_string_with_length(r->gc, s, length);
 }
 
 Obj *not_internal(Runtime *r, Obj *o) {
@@ -194,8 +205,12 @@ Obj *cons(Runtime *r, Obj *args[], int arg_count) {
   ASSERT_ARG_COUNT("cons", 2);
   Obj *o = args[0];
   Obj *rest = args[1];
-  if(rest->type != CONS) {
-    printf("Can't cons %s onto object %s.\n", obj_to_str(o), obj_to_str(rest));
+  if(rest->type != CONS && rest->type != LAZY_SEQ) {
+    printf("Can't cons ");
+    print_obj(o);
+    printf(" onto object ");
+    print_obj(rest);
+    printf(".\n");
     return r->nil;
   }
   Obj *cons = gc_make_cons(r->gc, o, rest);
@@ -204,22 +219,24 @@ Obj *cons(Runtime *r, Obj *args[], int arg_count) {
 
 Obj *first(Runtime *r, Obj *args[], int arg_count) {
   ASSERT_ARG_COUNT("first", 1);
-  if(args[0]->type != CONS) {
+  Obj *list = lazy_force(r, args[0]);
+  if(list->type != CONS) {
     printf("Can't call 'first' on non-list: ");
-    print_obj(args[0]);
+    print_obj(list);
     printf("\n");
   }
-  return args[0]->car;
+  return list->car;
 }
 
 Obj *rest(Runtime *r, Obj *args[], int arg_count) {
   ASSERT_ARG_COUNT("rest", 1);
-  if(args[0]->type != CONS) {
+  Obj *list = lazy_force(r, args[0]);
+  if(list->type != CONS) {
     printf("Can't call 'rest' on non-list: ");
-    print_obj(args[0]);
+    print_obj(list);
     printf("\n");
   }
-  return args[0]->cdr;
+  return list->cdr;
 }
 
 Obj *list(Runtime *r, Obj *args[], int arg_count) {
@@ -228,8 +245,8 @@ Obj *list(Runtime *r, Obj *args[], int arg_count) {
 
 Obj *nil_p(Runtime *r, Obj *args[], int arg_count) {
   ASSERT_ARG_COUNT("nil?", 1);
-  Obj *o = args[0];
-  if(o->car == NULL && o->cdr == NULL) {
+  Obj *o = lazy_force(r, args[0]);
+  if(o->type == CONS && o->car == NULL && o->cdr == NULL) {
     return r->true_val;
   } else {
     return r->nil;
@@ -238,7 +255,7 @@ Obj *nil_p(Runtime *r, Obj *args[], int arg_count) {
 
 Obj *atom_p(Runtime *r, Obj *args[], int arg_count) {
   ASSERT_ARG_COUNT("atom?", 1);
-  return BOOL_TO_OBJ(r, args[0]->type != CONS);
+  return BOOL_TO_OBJ(r, args[0]->type != CONS && args[0]->type != LAZY_SEQ);
 }
 
 Obj *symbol_p(Runtime *r, Obj *args[], int arg_count) {
@@ -248,7 +265,7 @@ Obj *symbol_p(Runtime *r, Obj *args[], int arg_count) {
 
 Obj *list_p(Runtime *r, Obj *args[], int arg_count) {
   ASSERT_ARG_COUNT("list?", 1);
-  return BOOL_TO_OBJ(r, args[0]->type == CONS);
+  return BOOL_TO_OBJ(r, args[0]->type == CONS || args[0]->type == LAZY_SEQ);
 }
 
 Obj *string_p(Runtime *r, Obj *args[], int arg_count) {
@@ -271,6 +288,893 @@ Obj *bytecode_p(Runtime *r, Obj *args[], int arg_count) {
   return BOOL_TO_OBJ(r, args[0]->type == BYTECODE);
 }
 
+Obj *vector_p(Runtime *r, Obj *args[], int arg_count) {
+  ASSERT_ARG_COUNT("vector?", 1);
+  return BOOL_TO_OBJ(r, args[0]->type == VECTOR);
+}
+
+Obj *vector(Runtime *r, Obj *args[], int arg_count) {
+  return vector_from_array(r->gc, args, arg_count);
+}
+
+Obj *internal_conj(Runtime *r, Obj *args[], int arg_count) {
+  ASSERT_ARG_COUNT("conj", 2);
+  ASSERT_ARG_TYPE("conj", 0, VECTOR);
+  return vector_conj(r->gc, args[0], args[1]);
+}
+
+Obj *nth(Runtime *r, Obj *args[], int arg_count) {
+  ASSERT_ARG_COUNT("nth", 2);
+  ASSERT_ARG_TYPE("nth", 1, NUMBER);
+  int index = (int)args[1]->number;
+  Obj *item = NULL;
+  if(args[0]->type == VECTOR) {
+    item = vector_nth(args[0], index);
+  }
+  else if(args[0]->type == CONS || args[0]->type == LAZY_SEQ) {
+    gc_stack_push(r->gc, args[0]);
+    Obj *list = lazy_force(r, args[0]);
+    for(int i = 0; i < index && list->cdr; i++) {
+      list = lazy_force(r, list->cdr);
+    }
+    item = index >= 0 ? list->car : NULL;
+    gc_stack_pop_safely(r->gc);
+  }
+  else {
+    printf("Can't call 'nth' on ");
+    print_obj(args[0]);
+    printf("\n");
+    return r->nil;
+  }
+  if(!item) {
+    printf("Index %d is out of bounds in call to 'nth'.\n", index);
+    return r->nil;
+  }
+  return item;
+}
+
+Obj *assoc(Runtime *r, Obj *args[], int arg_count) {
+  ASSERT_ARG_COUNT("assoc", 3);
+  if(args[0]->type == MAP) {
+    return map_assoc(r->gc, args[0], args[1], args[2]);
+  }
+  ASSERT_ARG_TYPE("assoc", 0, VECTOR);
+  ASSERT_ARG_TYPE("assoc", 1, NUMBER);
+  Obj *result = vector_assoc(r->gc, args[0], (int)args[1]->number, args[2]);
+  if(!result) {
+    printf("Index %d is out of bounds in call to 'assoc'.\n", (int)args[1]->number);
+    return r->nil;
+  }
+  return result;
+}
+
+Obj *map_p(Runtime *r, Obj *args[], int arg_count) {
+  ASSERT_ARG_COUNT("map?", 1);
+  return BOOL_TO_OBJ(r, args[0]->type == MAP);
+}
+
+Obj *hash_map(Runtime *r, Obj *args[], int arg_count) {
+  if(arg_count % 2 != 0) {
+    printf("Must call 'hash-map' with an even number of args.\n");
+    return r->nil;
+  }
+  return map_from_array(r->gc, args, arg_count);
+}
+
+// (get coll key) or (get coll key not-found), works on maps and vectors
+Obj *get(Runtime *r, Obj *args[], int arg_count) {
+  if(arg_count != 2 && arg_count != 3) {
+    printf("Must call 'get' with 2 or 3 args.\n");
+    return r->nil;
+  }
+  Obj *value = NULL;
+  if(args[0]->type == MAP) {
+    value = map_get(args[0], args[1]);
+  }
+  else if(args[0]->type == VECTOR && args[1]->type == NUMBER) {
+    value = vector_nth(args[0], (int)args[1]->number);
+  }
+  if(value) {
+    return value;
+  }
+  return arg_count == 3 ? args[2] : r->nil;
+}
+
+Obj *dissoc(Runtime *r, Obj *args[], int arg_count) {
+  ASSERT_ARG_COUNT("dissoc", 2);
+  ASSERT_ARG_TYPE("dissoc", 0, MAP);
+  return map_dissoc(r->gc, args[0], args[1]);
+}
+
+typedef struct {
+  GC *gc;
+  Obj *list;
+} ListCollector;
+
+void collect_key(Obj *key, Obj *value, void *data) {
+  ListCollector *collector = data;
+  collector->list = gc_make_cons(collector->gc, key, collector->list);
+}
+
+void collect_value(Obj *key, Obj *value, void *data) {
+  ListCollector *collector = data;
+  collector->list = gc_make_cons(collector->gc, value, collector->list);
+}
+
+Obj *keys(Runtime *r, Obj *args[], int arg_count) {
+  ASSERT_ARG_COUNT("keys", 1);
+  ASSERT_ARG_TYPE("keys", 0, MAP);
+  ListCollector collector = { .gc = r->gc, .list = r->nil };
+  map_visit_entries(args[0], collect_key, &collector);
+  return collector.list;
+}
+
+Obj *vals(Runtime *r, Obj *args[], int arg_count) {
+  ASSERT_ARG_COUNT("vals", 1);
+  ASSERT_ARG_TYPE("vals", 0, MAP);
+  ListCollector collector = { .gc = r->gc, .list = r->nil };
+  map_visit_entries(args[0], collect_value, &collector);
+  return collector.list;
+}
+
+// Iterates over the items of a list, a lazy seq, a vector or an array.
+// Lazy seqs are realized a chunk at a time when the iteration reaches them, which can call back into the VM.
+typedef struct {
+  Runtime *r;
+  Obj *list;
+  Obj *vector; // or an array, its numbers are boxed one at a time
+  int index;
+  Obj *holder; // set by 'seq_iter_root', its car is the current position
+} SeqIter;
+
+bool seq_iter_init(SeqIter *it, Runtime *r, Obj *seq) {
+  it->r = r;
+  it->list = NULL;
+  it->vector = NULL;
+  it->index = 0;
+  it->holder = NULL;
+  if(seq->type == CONS || seq->type == LAZY_SEQ) {
+    it->list = seq;
+  }
+  else if(seq->type == VECTOR || seq->type == ARRAY) {
+    it->vector = seq;
+  }
+  else {
+    return false;
+  }
+  return true;
+}
+
+// Roots the current position instead of the whole seq, so that the chunks of a lazy seq
+// that have been passed can be collected while the rest is being realized.
+void seq_iter_root(SeqIter *it) {
+  it->holder = gc_make_cons(it->r->gc, it->list ? it->list : it->vector, it->r->nil);
+  gc_stack_push(it->r->gc, it->holder);
+}
+
+void seq_iter_unroot(SeqIter *it) {
+  gc_stack_pop_safely(it->r->gc);
+  it->holder = NULL;
+}
+
+// Returns NULL when there are no more items.
+Obj *seq_iter_next(SeqIter *it) {
+  if(it->list) {
+    it->list = lazy_force(it->r, it->list);
+    if(it->list->type != CONS || !it->list->car) {
+      return NULL;
+    }
+    Obj *item = it->list->car;
+    it->list = it->list->cdr;
+    if(it->holder) {
+      it->holder->car = it->list;
+    }
+    return item;
+  }
+  else if(it->index < it->vector->count) {
+    if(it->vector->type == ARRAY) {
+      return gc_make_number(it->r->gc, array_get(it->vector, it->index++));
+    }
+    return vector_nth(it->vector, it->index++);
+  }
+  return NULL;
+}
+
+int count_lazy(Runtime *r, Obj *seq) {
+  SeqIter it;
+  seq_iter_init(&it, r, seq);
+  seq_iter_root(&it);
+  int n = 0;
+  while(seq_iter_next(&it)) {
+    n++;
+  }
+  seq_iter_unroot(&it);
+  return n;
+}
+
+Obj *count_items(Runtime *r, Obj *args[], int arg_count) {
+  ASSERT_ARG_COUNT("count", 1);
+  if(args[0]->type == VECTOR || args[0]->type == MAP || args[0]->type == ARRAY) {
+    return gc_make_number(r->gc, args[0]->count);
+  }
+  else if(args[0]->type == CONS) {
+    return gc_make_number(r->gc, count(args[0]));
+  }
+  else if(args[0]->type == LAZY_SEQ) {
+    return gc_make_number(r->gc, count_lazy(r, args[0]));
+  }
+  else {
+    printf("Can't call 'count' on ");
+    print_obj(args[0]);
+    printf("\n");
+    return r->nil;
+  }
+}
+
+bool check_seq_arg(Runtime *r, const char *name, SeqIter *it, Obj *args[], int pos) {
+  if(!seq_iter_init(it, r, args[pos])) {
+    printf("Argument %d of '%s' must be a list, a vector or an array.\n", pos, name);
+    return false;
+  }
+  return true;
+}
+
+bool check_callable_arg(Runtime *r, const char *name, Obj *args[], int pos) {
+  if(args[pos]->type != FUNC && args[pos]->type != LAMBDA) {
+    printf("Argument %d of '%s' must be a function.\n", pos, name);
+    return false;
+  }
+  return true;
+}
+
+// Builds a list from the front with a pointer to the last cons. The list hangs off a head cons
+// that is rooted on the GC stack, since calling back into lambdas can run the GC.
+typedef struct {
+  Runtime *r;
+  Obj *head; // not part of the result, its cdr is the list
+  Obj *last;
+} ListBuilder;
+
+void list_builder_init(ListBuilder *builder, Runtime *r) {
+  builder->r = r;
+  builder->head = gc_make_cons(r->gc, r->nil, r->nil);
+  builder->last = builder->head;
+  gc_stack_push(r->gc, builder->head);
+}
+
+void list_builder_add(ListBuilder *builder, Obj *item) {
+  Obj *new = gc_make_cons(builder->r->gc, item, builder->r->nil);
+  builder->last->cdr = new;
+  builder->last = new;
+}
+
+// Unroots the list, anything pushed on the GC stack after 'list_builder_init' must be popped before this.
+Obj *list_builder_finish(ListBuilder *builder) {
+  gc_stack_pop_safely(builder->r->gc);
+  return builder->head->cdr;
+}
+
+// The args are rooted while calling back into the VM, they have been popped off the stack by now.
+void push_args(Runtime *r, Obj *args[], int arg_count) {
+  for(int i = 0; i < arg_count; i++) {
+    gc_stack_push(r->gc, args[i]);
+  }
+}
+
+void pop_args(Runtime *r, int arg_count) {
+  for(int i = 0; i < arg_count; i++) {
+    gc_stack_pop_safely(r->gc);
+  }
+}
+
+// Lists and lazy seqs are mapped, filtered and taken lazily, vectors eagerly.
+Obj *make_lazy_seq_over(Runtime *r, LazyKind kind, Obj *arg, Obj *list) {
+  return eq(list, r->nil) ? r->nil : gc_make_lazy_seq(r->gc, kind, arg, list);
+}
+
+Obj *map(Runtime *r, Obj *args[], int arg_count) {
+  ASSERT_ARG_COUNT("map", 2);
+  SeqIter it;
+  if(!check_callable_arg(r, "map", args, 0) || !check_seq_arg(r, "map", &it, args, 1)) {
+    return r->nil;
+  }
+  if(it.list) {
+    return make_lazy_seq_over(r, LAZY_MAP, args[0], it.list);
+  }
+  push_args(r, args, arg_count);
+  ListBuilder result;
+  list_builder_init(&result, r);
+  Obj *item;
+  bool failed = false;
+  while(!failed && (item = seq_iter_next(&it))) {
+    Obj *value = runtime_call(r, args[0], &item, 1);
+    if(value) {
+      list_builder_add(&result, value);
+    }
+    failed = !value;
+  }
+  Obj *list = list_builder_finish(&result);
+  pop_args(r, arg_count);
+  return failed ? r->nil : list;
+}
+
+// keep, filter and remove, the items where the predicate is true (or false for remove) are kept.
+Obj *filter_items(Runtime *r, const char *name, bool keep_if, Obj *args[], int arg_count) {
+  ASSERT_ARG_COUNT(name, 2);
+  SeqIter it;
+  if(!check_callable_arg(r, name, args, 0) || !check_seq_arg(r, name, &it, args, 1)) {
+    return r->nil;
+  }
+  if(it.list) {
+    return make_lazy_seq_over(r, keep_if ? LAZY_FILTER : LAZY_REMOVE, args[0], it.list);
+  }
+  push_args(r, args, arg_count);
+  ListBuilder result;
+  list_builder_init(&result, r);
+  Obj *item;
+  bool failed = false;
+  while(!failed && (item = seq_iter_next(&it))) {
+    Obj *value = runtime_call(r, args[0], &item, 1);
+    if(value && !eq(value, r->nil) == keep_if) {
+      list_builder_add(&result, item);
+    }
+    failed = !value;
+  }
+  Obj *list = list_builder_finish(&result);
+  pop_args(r, arg_count);
+  return failed ? r->nil : list;
+}
+
+Obj *keep(Runtime *r, Obj *args[], int arg_count) {
+  return filter_items(r, "keep", true, args, arg_count);
+}
+
+Obj *filter(Runtime *r, Obj *args[], int arg_count) {
+  return filter_items(r, "filter", true, args, arg_count);
+}
+
+Obj *internal_remove(Runtime *r, Obj *args[], int arg_count) {
+  return filter_items(r, "remove", false, args, arg_count);
+}
+
+// (reduce f init xs)
+Obj *reduce(Runtime *r, Obj *args[], int arg_count) {
+  ASSERT_ARG_COUNT("reduce", 3);
+  SeqIter it;
+  if(!check_callable_arg(r, "reduce", args, 0) || !check_seq_arg(r, "reduce", &it, args, 2)) {
+    return r->nil;
+  }
+  gc_stack_push(r->gc, args[0]);
+  seq_iter_root(&it);
+  Obj *acc = args[1];
+  Obj *item;
+  while(acc && (item = seq_iter_next(&it))) {
+    gc_stack_push(r->gc, acc);
+    Obj *call_args[2] = { acc, item };
+    acc = runtime_call(r, args[0], call_args, 2);
+    gc_stack_pop_safely(r->gc);
+  }
+  seq_iter_unroot(&it);
+  gc_stack_pop_safely(r->gc);
+  return acc ? acc : r->nil;
+}
+
+// (range start end) counts from start to end, both included.
+Obj *range(Runtime *r, Obj *args[], int arg_count) {
+  ASSERT_ARG_COUNT("range", 2);
+  ASSERT_ARG_TYPE("range", 0, NUMBER);
+  ASSERT_ARG_TYPE("range", 1, NUMBER);
+  if(args[0]->number > args[1]->number) {
+    return r->nil;
+  }
+  return gc_make_lazy_seq(r->gc, LAZY_RANGE, args[0], args[1]);
+}
+
+// (take n xs) the first n items of xs, or all of them if there are fewer.
+Obj *take(Runtime *r, Obj *args[], int arg_count) {
+  ASSERT_ARG_COUNT("take", 2);
+  ASSERT_ARG_TYPE("take", 0, NUMBER);
+  SeqIter it;
+  if(!check_seq_arg(r, "take", &it, args, 1)) {
+    return r->nil;
+  }
+  int n = (int)args[0]->number;
+  if(n <= 0) {
+    return r->nil;
+  }
+  if(it.list) {
+    return make_lazy_seq_over(r, LAZY_TAKE, args[0], it.list);
+  }
+  ListBuilder result;
+  list_builder_init(&result, r);
+  Obj *item;
+  for(int i = 0; i < n && (item = seq_iter_next(&it)); i++) {
+    list_builder_add(&result, item);
+  }
+  return list_builder_finish(&result);
+}
+
+Obj *make_xform(Runtime *r, const char *name, XformKind kind, Obj *args[], int arg_count) {
+  ASSERT_ARG_COUNT(name, 1);
+  if(kind == XFORM_TAKE) {
+    ASSERT_ARG_TYPE(name, 0, NUMBER);
+  }
+  else if(!check_callable_arg(r, name, args, 0)) {
+    return r->nil;
+  }
+  return gc_make_xform(r->gc, kind, args[0]);
+}
+
+// (mapping f), (filtering pred) and (taking n) make the transformations that 'transduce' runs.
+Obj *mapping(Runtime *r, Obj *args[], int arg_count) {
+  return make_xform(r, "mapping", XFORM_MAP, args, arg_count);
+}
+
+Obj *filtering(Runtime *r, Obj *args[], int arg_count) {
+  return make_xform(r, "filtering", XFORM_FILTER, args, arg_count);
+}
+
+Obj *taking(Runtime *r, Obj *args[], int arg_count) {
+  return make_xform(r, "taking", XFORM_TAKE, args, arg_count);
+}
+
+// Runs 'item' through the transformations, returns NULL if it was dropped (or if a call failed, then 'failed' is set).
+// A 'taking' that has let its last item through sets 'done' so that no more items are pulled from the source.
+Obj *xform_step(Runtime *r, Obj *stages[], int remaining[], int stage_count, Obj *item, bool *done, bool *failed) {
+  for(int i = 0; i < stage_count; i++) {
+    Obj *stage = stages[i];
+    if(stage->xform_kind == XFORM_TAKE) {
+      if(remaining[i] <= 0) {
+	*done = true;
+	return NULL;
+      }
+      if(--remaining[i] == 0) {
+	*done = true;
+      }
+      continue;
+    }
+    Obj *value = runtime_call(r, stage->xform_arg, &item, 1);
+    if(!value) {
+      *failed = true;
+      return NULL;
+    }
+    if(stage->xform_kind == XFORM_MAP) {
+      item = value;
+    }
+    else if(eq(value, r->nil)) {
+      return NULL;
+    }
+  }
+  return item;
+}
+
+// (transduce xform f init xs) reduces xs with f like 'reduce', but every item goes through xform first.
+// The xform is one transformation or a list/vector of them that are applied in order, all in a single
+// pass over xs without building any intermediate lists.
+Obj *transduce(Runtime *r, Obj *args[], int arg_count) {
+  ASSERT_ARG_COUNT("transduce", 4);
+  SeqIter stage_it;
+  int stage_count = 1;
+  if(args[0]->type == CONS || args[0]->type == VECTOR) {
+    seq_iter_init(&stage_it, r, args[0]);
+    stage_count = args[0]->type == CONS ? count(args[0]) : args[0]->count;
+  }
+  else if(args[0]->type != XFORM) {
+    printf("Argument 0 of 'transduce' must be a transformation or a list of them.\n");
+    return r->nil;
+  }
+  // An empty list of transformations passes the items through unchanged (the arrays must not be empty though)
+  Obj *stages[stage_count > 0 ? stage_count : 1];
+  int remaining[stage_count > 0 ? stage_count : 1];
+  for(int i = 0; i < stage_count; i++) {
+    stages[i] = args[0]->type == XFORM ? args[0] : seq_iter_next(&stage_it);
+    if(stages[i]->type != XFORM) {
+      printf("Can't use ");
+      print_obj(stages[i]);
+      printf(" as a transformation in 'transduce'.\n");
+      return r->nil;
+    }
+    remaining[i] = stages[i]->xform_kind == XFORM_TAKE ? (int)stages[i]->xform_arg->number : 0;
+  }
+
+  SeqIter it;
+  if(!check_callable_arg(r, "transduce", args, 1) || !check_seq_arg(r, "transduce", &it, args, 3)) {
+    return r->nil;
+  }
+  push_args(r, args, 2);
+  seq_iter_root(&it);
+  Obj *acc = args[2];
+  bool done = false;
+  bool failed = false;
+  for(int i = 0; i < stage_count; i++) {
+    done = done || (stages[i]->xform_kind == XFORM_TAKE && remaining[i] <= 0);
+  }
+  Obj *item;
+  while(!done && (item = seq_iter_next(&it))) {
+    gc_stack_push(r->gc, acc);
+    Obj *value = xform_step(r, stages, remaining, stage_count, item, &done, &failed);
+    if(value) {
+      Obj *call_args[2] = { acc, value };
+      value = runtime_call(r, args[1], call_args, 2);
+      failed = !value;
+      acc = value ? value : acc;
+    }
+    gc_stack_pop_safely(r->gc);
+    done = done || failed;
+  }
+  seq_iter_unroot(&it);
+  pop_args(r, 2);
+  return failed ? r->nil : acc;
+}
+
+// (replicate n item)
+Obj *replicate(Runtime *r, Obj *args[], int arg_count) {
+  ASSERT_ARG_COUNT("replicate", 2);
+  ASSERT_ARG_TYPE("replicate", 0, NUMBER);
+  Obj *list = r->nil;
+  for(int i = 0; i < (int)args[0]->number; i++) {
+    list = gc_make_cons(r->gc, args[1], list);
+  }
+  return list;
+}
+
+// (zip a b) makes a list of pairs, it's as long as the shortest of the two.
+Obj *zip(Runtime *r, Obj *args[], int arg_count) {
+  ASSERT_ARG_COUNT("zip", 2);
+  SeqIter a, b;
+  if(!check_seq_arg(r, "zip", &a, args, 0) || !check_seq_arg(r, "zip", &b, args, 1)) {
+    return r->nil;
+  }
+  push_args(r, args, arg_count);
+  ListBuilder result;
+  list_builder_init(&result, r);
+  Obj *x, *y;
+  while((x = seq_iter_next(&a)) && (y = seq_iter_next(&b))) {
+    list_builder_add(&result, gc_make_cons(r->gc, x, gc_make_cons(r->gc, y, r->nil)));
+  }
+  Obj *list = list_builder_finish(&result);
+  pop_args(r, arg_count);
+  return list;
+}
+
+Obj *reverse(Runtime *r, Obj *args[], int arg_count) {
+  ASSERT_ARG_COUNT("reverse", 1);
+  SeqIter it;
+  if(!check_seq_arg(r, "reverse", &it, args, 0)) {
+    return r->nil;
+  }
+  push_args(r, args, arg_count);
+  // The items are consed onto the cdr of a rooted head, since realizing a lazy seq can run the GC
+  Obj *head = gc_make_cons(r->gc, r->nil, r->nil);
+  gc_stack_push(r->gc, head);
+  Obj *item;
+  while((item = seq_iter_next(&it))) {
+    head->cdr = gc_make_cons(r->gc, item, head->cdr);
+  }
+  gc_stack_pop_safely(r->gc);
+  pop_args(r, arg_count);
+  return head->cdr;
+}
+
+// (concat xs ys ...) makes a new list with the items of all the lists and vectors.
+Obj *concat(Runtime *r, Obj *args[], int arg_count) {
+  if(arg_count == 0) {
+    return r->nil;
+  }
+  SeqIter its[arg_count];
+  for(int i = 0; i < arg_count; i++) {
+    if(!check_seq_arg(r, "concat", &its[i], args, i)) {
+      return r->nil;
+    }
+  }
+  push_args(r, args, arg_count);
+  ListBuilder result;
+  list_builder_init(&result, r);
+  for(int i = 0; i < arg_count; i++) {
+    Obj *item;
+    while((item = seq_iter_next(&its[i]))) {
+      list_builder_add(&result, item);
+    }
+  }
+  Obj *list = list_builder_finish(&result);
+  pop_args(r, arg_count);
+  return list;
+}
+
+// (make-f64array count) or (make-f64array count fill)
+Obj *make_typed_array(Runtime *r, const char *name, ArrayType type, Obj *args[], int arg_count) {
+  if(arg_count != 1 && arg_count != 2) {
+    printf("Must call '%s' with 1 or 2 args.\n", name);
+    return r->nil;
+  }
+  ASSERT_ARG_TYPE(name, 0, NUMBER);
+  int count = (int)args[0]->number;
+  if(count < 0) {
+    printf("Can't make an array with %d items.\n", count);
+    return r->nil;
+  }
+  Obj *array = gc_make_array(r->gc, type, count);
+  if(arg_count == 2) {
+    ASSERT_ARG_TYPE(name, 1, NUMBER);
+    for(int i = 0; i < count; i++) {
+      array_set(array, i, args[1]->number);
+    }
+  }
+  return array;
+}
+
+Obj *make_f64array(Runtime *r, Obj *args[], int arg_count) {
+  return make_typed_array(r, "make-f64array", ARRAY_F64, args, arg_count);
+}
+
+Obj *make_f32array(Runtime *r, Obj *args[], int arg_count) {
+  return make_typed_array(r, "make-f32array", ARRAY_F32, args, arg_count);
+}
+
+Obj *make_i32array(Runtime *r, Obj *args[], int arg_count) {
+  return make_typed_array(r, "make-i32array", ARRAY_I32, args, arg_count);
+}
+
+Obj *array_p(Runtime *r, Obj *args[], int arg_count) {
+  ASSERT_ARG_COUNT("array?", 1);
+  return BOOL_TO_OBJ(r, args[0]->type == ARRAY);
+}
+
+bool array_index_ok(Obj *array, Obj *index, const char *name) {
+  int i = (int)index->number;
+  if(i < 0 || i >= array->count) {
+    printf("Index %d is out of bounds in call to '%s'.\n", i, name);
+    return false;
+  }
+  return true;
+}
+
+Obj *aget(Runtime *r, Obj *args[], int arg_count) {
+  ASSERT_ARG_COUNT("aget", 2);
+  ASSERT_ARG_TYPE("aget", 0, ARRAY);
+  ASSERT_ARG_TYPE("aget", 1, NUMBER);
+  if(!array_index_ok(args[0], args[1], "aget")) {
+    return r->nil;
+  }
+  return gc_make_number(r->gc, array_get(args[0], (int)args[1]->number));
+}
+
+Obj *aset(Runtime *r, Obj *args[], int arg_count) {
+  ASSERT_ARG_COUNT("aset!", 3);
+  ASSERT_ARG_TYPE("aset!", 0, ARRAY);
+  ASSERT_ARG_TYPE("aset!", 1, NUMBER);
+  ASSERT_ARG_TYPE("aset!", 2, NUMBER);
+  if(!array_index_ok(args[0], args[1], "aset!")) {
+    return r->nil;
+  }
+  array_set(args[0], (int)args[1]->number, args[2]->number);
+  return args[2];
+}
+
+// (aslice array start end), the slice shares memory with the array
+Obj *aslice(Runtime *r, Obj *args[], int arg_count) {
+  ASSERT_ARG_COUNT("aslice", 3);
+  ASSERT_ARG_TYPE("aslice", 0, ARRAY);
+  ASSERT_ARG_TYPE("aslice", 1, NUMBER);
+  ASSERT_ARG_TYPE("aslice", 2, NUMBER);
+  Obj *slice = array_slice(r->gc, args[0], (int)args[1]->number, (int)args[2]->number);
+  if(!slice) {
+    printf("Invalid range %d to %d in call to 'aslice'.\n", (int)args[1]->number, (int)args[2]->number);
+    return r->nil;
+  }
+  return slice;
+}
+
+// Array kernels work on doubles, f64 arrays are used directly and other arrays are converted to a temporary buffer.
+double *array_as_doubles(Obj *array) {
+  if(array->element_type == ARRAY_F64) {
+    return array->data;
+  }
+  double *doubles = malloc(sizeof(double) * (array->count ? array->count : 1));
+  for(int i = 0; i < array->count; i++) {
+    doubles[i] = array_get(array, i);
+  }
+  return doubles;
+}
+
+void array_release_doubles(Obj *array, double *doubles, bool write_back) {
+  if(doubles == array->data) {
+    return;
+  }
+  if(write_back) {
+    for(int i = 0; i < array->count; i++) {
+      array_set(array, i, doubles[i]);
+    }
+  }
+  free(doubles);
+}
+
+// Checks that all args up to 'array_count' are arrays of the same length as the first one.
+bool check_kernel_arrays(const char *name, Obj *args[], int array_count) {
+  for(int i = 0; i < array_count; i++) {
+    if(args[i]->type != ARRAY) {
+      printf("Argument %d of '%s' must be a %s.\n", i, name, type_to_str(ARRAY));
+      return false;
+    }
+    if(args[i]->count != args[0]->count) {
+      printf("The arrays given to '%s' must have the same length.\n", name);
+      return false;
+    }
+  }
+  return true;
+}
+
+// The result goes into the optional last argument, otherwise into a new f64 array.
+Obj *kernel_output(Runtime *r, const char *name, Obj *args[], int arg_count, int input_count) {
+  if(arg_count == input_count + 1) {
+    Obj *out = args[input_count];
+    if(out->type != ARRAY || out->count != args[0]->count) {
+      printf("The output of '%s' must be an array of the same length as the input.\n", name);
+      return NULL;
+    }
+    return out;
+  }
+  return gc_make_array(r->gc, ARRAY_F64, args[0]->count);
+}
+
+typedef void (*BinaryKernel)(double *out, const double *a, const double *b, int n);
+
+// (a+ xs ys) or (a+ xs ys out)
+Obj *binary_kernel(Runtime *r, const char *name, BinaryKernel kernel, Obj *args[], int arg_count) {
+  if(arg_count != 2 && arg_count != 3) {
+    printf("Must call '%s' with 2 or 3 args.\n", name);
+    return r->nil;
+  }
+  if(!check_kernel_arrays(name, args, 2)) {
+    return r->nil;
+  }
+  Obj *out = kernel_output(r, name, args, arg_count, 2);
+  if(!out) {
+    return r->nil;
+  }
+  double *a = array_as_doubles(args[0]);
+  double *b = array_as_doubles(args[1]);
+  double *o = array_as_doubles(out);
+  kernel(o, a, b, out->count);
+  array_release_doubles(out, o, true);
+  array_release_doubles(args[0], a, false);
+  array_release_doubles(args[1], b, false);
+  return out;
+}
+
+Obj *array_add(Runtime *r, Obj *args[], int arg_count) {
+  return binary_kernel(r, "a+", simd_kernels()->add, args, arg_count);
+}
+
+Obj *array_sub(Runtime *r, Obj *args[], int arg_count) {
+  return binary_kernel(r, "a-", simd_kernels()->sub, args, arg_count);
+}
+
+Obj *array_mul(Runtime *r, Obj *args[], int arg_count) {
+  return binary_kernel(r, "a*", simd_kernels()->mul, args, arg_count);
+}
+
+Obj *array_div(Runtime *r, Obj *args[], int arg_count) {
+  return binary_kernel(r, "a/", simd_kernels()->div, args, arg_count);
+}
+
+// (afma xs ys zs) is xs * ys + zs, ys can also be a number. The result can go into a fourth arg.
+Obj *array_fma(Runtime *r, Obj *args[], int arg_count) {
+  if(arg_count != 3 && arg_count != 4) {
+    printf("Must call 'afma' with 3 or 4 args.\n");
+    return r->nil;
+  }
+  bool scalar = args[1]->type == NUMBER;
+  Obj *arrays[] = { args[0], scalar ? args[0] : args[1], args[2] };
+  if(!check_kernel_arrays("afma", arrays, 3)) {
+    return r->nil;
+  }
+  Obj *out = kernel_output(r, "afma", args, arg_count, 3);
+  if(!out) {
+    return r->nil;
+  }
+  double *a = array_as_doubles(args[0]);
+  double *c = array_as_doubles(args[2]);
+  double *o = array_as_doubles(out);
+  if(scalar) {
+    simd_kernels()->fma_scalar(o, a, args[1]->number, c, out->count);
+  } else {
+    double *b = array_as_doubles(args[1]);
+    simd_kernels()->fma(o, a, b, c, out->count);
+    array_release_doubles(args[1], b, false);
+  }
+  array_release_doubles(out, o, true);
+  array_release_doubles(args[0], a, false);
+  array_release_doubles(args[2], c, false);
+  return out;
+}
+
+// (aclamp xs lo hi) or (aclamp xs lo hi out)
+Obj *array_clamp(Runtime *r, Obj *args[], int arg_count) {
+  if(arg_count != 3 && arg_count != 4) {
+    printf("Must call 'aclamp' with 3 or 4 args.\n");
+    return r->nil;
+  }
+  if(!check_kernel_arrays("aclamp", args, 1)) {
+    return r->nil;
+  }
+  ASSERT_ARG_TYPE("aclamp", 1, NUMBER);
+  ASSERT_ARG_TYPE("aclamp", 2, NUMBER);
+  Obj *out = kernel_output(r, "aclamp", args, arg_count, 3);
+  if(!out) {
+    return r->nil;
+  }
+  double *a = array_as_doubles(args[0]);
+  double *o = array_as_doubles(out);
+  simd_kernels()->clamp(o, a, args[1]->number, args[2]->number, out->count);
+  array_release_doubles(out, o, true);
+  array_release_doubles(args[0], a, false);
+  return out;
+}
+
+// sin and cos work on numbers and on arrays, (sin xs out) puts the result in an existing array
+Obj *unary_kernel(Runtime *r, const char *name, void (*kernel)(double *out, const double *a, int n), Obj *args[], int arg_count) {
+  if(arg_count != 1 && arg_count != 2) {
+    printf("Must call '%s' with 1 or 2 args.\n", name);
+    return r->nil;
+  }
+  if(!check_kernel_arrays(name, args, 1)) {
+    return r->nil;
+  }
+  Obj *out = kernel_output(r, name, args, arg_count, 1);
+  if(!out) {
+    return r->nil;
+  }
+  double *a = array_as_doubles(args[0]);
+  double *o = array_as_doubles(out);
+  kernel(o, a, out->count);
+  array_release_doubles(out, o, true);
+  array_release_doubles(args[0], a, false);
+  return out;
+}
+
+typedef double (*ReduceKernel)(const double *a, int n);
+
+Obj *reduce_kernel(Runtime *r, const char *name, ReduceKernel kernel, Obj *args[], int arg_count, bool allow_empty) {
+  ASSERT_ARG_COUNT(name, 1);
+  if(!check_kernel_arrays(name, args, 1)) {
+    return r->nil;
+  }
+  if(!allow_empty && args[0]->count == 0) {
+    printf("Can't call '%s' on an empty array.\n", name);
+    return r->nil;
+  }
+  double *a = array_as_doubles(args[0]);
+  double result = kernel(a, args[0]->count);
+  array_release_doubles(args[0], a, false);
+  return gc_make_number(r->gc, result);
+}
+
+Obj *array_sum(Runtime *r, Obj *args[], int arg_count) {
+  return reduce_kernel(r, "asum", simd_kernels()->sum, args, arg_count, true);
+}
+
+Obj *array_min(Runtime *r, Obj *args[], int arg_count) {
+  return reduce_kernel(r, "amin", simd_kernels()->min, args, arg_count, false);
+}
+
+Obj *array_max(Runtime *r, Obj *args[], int arg_count) {
+  return reduce_kernel(r, "amax", simd_kernels()->max, args, arg_count, false);
+}
+
+Obj *array_dot(Runtime *r, Obj *args[], int arg_count) {
+  ASSERT_ARG_COUNT("adot", 2);
+  if(!check_kernel_arrays("adot", args, 2)) {
+    return r->nil;
+  }
+  double *a = array_as_doubles(args[0]);
+  double *b = array_as_doubles(args[1]);
+  double result = simd_kernels()->dot(a, b, args[0]->count);
+  array_release_doubles(args[0], a, false);
+  array_release_doubles(args[1], b, false);
+  return gc_make_number(r->gc, result);
+}
+
 Obj *get_bytecode(Runtime *r, Obj *args[], int arg_count) {
   ASSERT_ARG_COUNT("bytecode", 1);
   if(args[0]->type != LAMBDA) {
@@ -299,4 +1203,12 @@ Obj *get_time(Runtime *r, Obj *args[], int arg_count) {
   return gc_make_number(r->gc, (double)current_timestamp());
 }
 
+// Makes a fresh symbol for macros that need to introduce bindings without clashing with the user's names.
+Obj *gensym(Runtime *r, Obj *args[], int arg_count) {
+  ASSERT_ARG_COUNT("gensym", 0);
+  char name[32];
+  snprintf(name, sizeof(name), "G__%d", r->gensym_counter++);
+  return gc_make_symbol(r->gc, name);
+}
+
 #endif
@@ -7,7 +7,7 @@
 typedef enum {
   UNINITIALIZED = 0,
   PUSH_CONSTANT,     // Places an Obj on the stack.
-  PUSH_LAMBDA,       // Creates an Obj of type LAMBDA and places it on the stack.
+  PUSH_LAMBDA,       // Creates an Obj of type LAMBDA and places it on the stack. Operands are args, body, the enclosing scope and the name it is defined as (or nil).
   DIRECT_LOOKUP_VAR, // Pointer lookup to a binding in an env.
   LOOKUP_ARG,        // Lookup an arg in the current stack frame.
   DEFINE,            // Set (or create if necessary) the value of a binding in the global scope.
@@ -22,6 +22,9 @@ typedef enum {
   MUL,               // See above.
   DIV,               // See above.
   EQ,                // See above.
+  STORE_LOCAL,       // Pop the top value into a local slot (after the args) of the current stack frame.
+  LOAD_LOCAL,        // Push the value of a local slot of the current stack frame.
+  DEFINE_MACRO,      // Pop a flag telling if the last arg collects the rest, then the macro lambda, and bind it to a name.
   END_OF_CODES,      // Marks the end of the code block. Any instructions after this will be ignored.
 } Code;
 
@@ -30,6 +33,17 @@ typedef struct {
   int size;
   int pos;
   char *error;
+  int arg_count; // slots below this are args of the function being compiled, the rest are locals
+  Obj *self_name; // the global name of the function being compiled, calls to it in tail position become jumps
+  bool tail_calls_allowed; // false while compiling a loop body that isn't in tail position of the function
+  int recur_pos; // where 'recur' jumps back to, -1 when there is no enclosing loop or function
+  int recur_slot; // the first slot that 'recur' overwrites
+  int recur_count; // how many values that 'recur' takes
+  bool inline_enabled; // only lambdas inline globals, their code is recompiled when an inlined global changes
+  int inline_depth; // how many inlined bodies that are being compiled, limits mutually recursive inlining
+  Obj *inlined; // list of the binding pairs of the inlined globals, NULL if there are none
+  bool captured; // true if a local of an enclosing frame was compiled in as a constant
+  bool ignore_frames; // don't look for captured locals in the frames, used when recompiling lambdas
 } CodeWriter;
 
 const char *code_to_str(Code code);
@@ -38,21 +52,31 @@ void code_print(Code *code_block);
 
 bool pushes_obj(Code code);
 bool pushes_int(Code code);
+int code_obj_operand_count(Code code); // each Obj* operand takes up two codes
 
 CodeWriter *code_writer_init(CodeWriter *writer, int size);
 
 void code_write_push_constant(CodeWriter *writer, Obj *o);
 void code_write_define(CodeWriter *writer, Obj *sym);
+void code_write_define_macro(CodeWriter *writer, Obj *sym);
 void code_write_call(CodeWriter *writer, int arg_count);
 void code_write_tail_call(CodeWriter *writer, int arg_count);
 void code_write_end(CodeWriter *writer);
 void code_write_return(CodeWriter *writer);
-void code_write_push_lambda(CodeWriter *writer, Obj *args, Obj *body);
+void code_write_push_lambda(CodeWriter *writer, Obj *args, Obj *body, Obj *scope, Obj *self_name);
 void code_write_jump(CodeWriter *writer, int jump_length);
+int code_write_jump_placeholder(CodeWriter *writer); // returns the position to give code_patch_jump
+void code_patch_jump(CodeWriter *writer, int jump_pos);
+void code_write_jump_back(CodeWriter *writer, int target_pos); // jumps to the earlier position 'target_pos'
 void code_write_if(CodeWriter *writer);
 void code_write_pop(CodeWriter *writer);
 void code_write_code(CodeWriter *writer, Code code);
+void code_write_obj(CodeWriter *writer, Obj *o);
+void code_write_int(CodeWriter *writer, int i);
+void code_write_block(CodeWriter *writer, Code *codes, int length);
 void code_write_direct_lookup_var(CodeWriter *writer, Obj *binding_pair);
 void code_write_lookup_arg(CodeWriter *writer, int arg_index);
+void code_write_store_local(CodeWriter *writer, int slot);
+void code_write_load_local(CodeWriter *writer, int slot);
 
 #endif
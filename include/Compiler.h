@@ -7,6 +7,9 @@
 #include "Runtime.h"
 
 Code *compile(Runtime *r, bool tail_position, Obj *form, int *OUT_code_length, Obj *args);
+Obj *compile_lambda(Runtime *r, Obj *args, Obj *body, Obj *self_name); // self_name can be NULL, returns NULL on failure
+void compiler_invalidate_inlined(Runtime *r, Obj *binding_pair);
+void compiler_remove_inlining(Runtime *r); // recompiles the lambdas that have inlined globals so that they look them up
 void compile_and_print(const char *source);
 
 #endif
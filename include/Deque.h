@@ -0,0 +1,27 @@
+#ifndef DEQUE_H
+#define DEQUE_H
+
+#include "Obj.h"
+
+// Chase-Lev work-stealing deque, used by the parallel marker of the GC.
+// Only the owning thread pushes and takes (at the bottom), any other thread can steal (from the top).
+typedef struct sDequeArray {
+  Obj **items;
+  long capacity; // a power of two
+  struct sDequeArray *retired; // the array that this one replaced, freed with the deque since thieves might still read it
+} DequeArray;
+
+typedef struct {
+  long top;
+  long bottom;
+  DequeArray *array;
+} Deque;
+
+void deque_init(Deque *d, long capacity);
+void deque_free(Deque *d);
+void deque_push(Deque *d, Obj *o);
+Obj *deque_take(Deque *d); // NULL when empty
+Obj *deque_steal(Deque *d); // NULL when empty, or when losing a race with another thread
+bool deque_is_empty(Deque *d);
+
+#endif
@@ -0,0 +1,47 @@
+#ifndef EMBED_H
+#define EMBED_H
+
+#include "Runtime.h"
+
+// The API for a host program that runs Lisp code, without going through source code that has to be parsed and compiled.
+// Look up a function once, then call it with args made by the constructors below, as often as needed (every frame of a game).
+//
+// The GC only runs when it's asked to, by the host or by Lisp code calling (gc), so the objects made by the host are safe
+// until then. Keep the ones that have to survive a collection (or a call, since it might collect) alive with a handle.
+
+typedef int Handle;
+
+// Globals, looked up by name without making any objects. NULL if there's no such global.
+Obj *embed_lookup(Runtime *r, const char *name);
+void embed_define(Runtime *r, const char *name, Obj *value);
+
+// Calls a lambda or a primitive function. Returns NULL (and the error has been printed) if it fails,
+// the stacks are then unwound to where they were so the runtime can be called again.
+Obj *embed_call(Runtime *r, Obj *f, Obj *args[], int arg_count);
+Obj *embed_call_global(Runtime *r, const char *name, Obj *args[], int arg_count);
+
+// Constructors
+Obj *embed_nil(Runtime *r);
+Obj *embed_bool(Runtime *r, bool b);
+Obj *embed_number(Runtime *r, double x);
+Obj *embed_string(Runtime *r, const char *text); // the text is copied
+Obj *embed_symbol(Runtime *r, const char *name);
+Obj *embed_list(Runtime *r, Obj *items[], int item_count);
+Obj *embed_vector(Runtime *r, Obj *items[], int item_count);
+Obj *embed_map(Runtime *r, Obj *items[], int item_count); // keys and values interleaved
+
+// Accessors, the ones for collections realize lazy seqs as far as needed (which can run Lisp code)
+bool embed_is_true(Runtime *r, Obj *o); // everything but nil (and false, which is nil)
+bool embed_to_number(Obj *o, double *x); // false if 'o' isn't a number
+const char *embed_to_string(Obj *o); // the text of a string or the name of a symbol, otherwise NULL
+int embed_count(Runtime *r, Obj *o); // items in a list, vector or array, entries in a map, -1 for anything else
+Obj *embed_nth(Runtime *r, Obj *o, int index); // an item of a list or vector, NULL if out of range
+Obj *embed_get(Obj *map, Obj *key); // NULL if the key is missing
+
+// Handles keep objects alive until they're released, also across collections.
+Handle embed_retain(Runtime *r, Obj *o);
+Obj *embed_handle_get(Runtime *r, Handle h);
+void embed_handle_set(Runtime *r, Handle h, Obj *o);
+void embed_release(Runtime *r, Handle h);
+
+#endif
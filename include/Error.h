@@ -1,6 +1,16 @@
 #ifndef ERROR_H
 #define ERROR_H
 
-void error(const char *message);
+#include <setjmp.h>
+
+// Every runtime (through its GC) has its own error state. A fatal error jumps back to the innermost
+// handler, which is set up around each top-level form that gets evaluated, so one failing runtime
+// never takes down the others in the same process. Without a handler the process exits.
+typedef struct {
+  jmp_buf *handler;
+  const char *message; // the last fatal error, NULL if there hasn't been one
+} ErrorState;
+
+void error(ErrorState *state, const char *message);
 
 #endif
@@ -6,31 +6,58 @@
 #include "Pool.h"
 
 #define STACK_MAX 512
-#define GLOBAL_OBJ_COUNT 1
+#define COUNT_OBJS 1
 #define USE_MEMORY_POOL 0
+#define GC_PAGE_SIZE 4096 // max number of objects in a page
+#define GC_MAX_THREADS 64
 
-#if GLOBAL_OBJ_COUNT
-int g_obj_count;
-#endif
+// The objects are kept in pages, linked lists that can be swept independently of each other.
+// New objects go into the last page.
+typedef struct {
+  Obj *first;
+  Obj *last;
+  int count;
+} GCPage;
+
+typedef struct {
+  int alive;
+  int freed;
+} GCResult;
 
 typedef struct {
   Obj *stack[STACK_MAX];
   int stackSize;
-  Obj *firstObj; // linked list of all objects
+  GCPage *pages;
+  int page_count;
+  int page_capacity;
+  // After a lazy collection the pages from sweep_cursor up to sweep_end still have to be swept,
+  // the allocator sweeps them one at a time when it runs out of reclaimed objects.
+  int sweep_cursor;
+  int sweep_end;
+  GCResult sweep_result; // counts for the latest collection, complete once all of its pages are swept
+  Obj *free_objs; // dead objects that the sweep has reclaimed, reused by the allocator
+  int free_obj_count;
   Obj *nil;
+  void (*mark_extra_roots)(void *data); // called during collection to mark roots that are not on the stack
+  void (*mark_weak_refs)(void *data); // called once everything else is marked, for tables that only hold on to marked objects
+  void *extra_roots_data;
+  int thread_count; // threads that mark and sweep in parallel, 1 does all of the work on the collecting thread
+  ErrorState error; // fatal errors, like overflowing the stack
+  #if COUNT_OBJS
+  int obj_count; // objects that haven't been freed yet
+  #endif
   #if USE_MEMORY_POOL
   Pool *pool;
   #endif
 } GC;
 
-typedef struct {
-  int alive;
-  int freed;
-} GCResult;
-
 GC *gc_new();
 void gc_delete(GC *gc);
-GCResult gc_collect(GC *gc);
+GCResult gc_collect(GC *gc); // marks and sweeps everything
+void gc_collect_lazily(GC *gc); // only marks, the sweeping happens as new objects are allocated
+GCResult gc_finish_sweep(GC *gc); // sweeps what is left from a lazy collection
+void gc_mark(Obj *o);
+void gc_set_thread_count(GC *gc, int thread_count);
 
 // Stack
 void gc_stack_push(GC *gc, Obj *o);
@@ -44,8 +71,20 @@ Obj *gc_make_symbol_from_malloced_string(GC *gc, char *name);
 Obj *gc_make_func(GC *gc, const char *name, void *f);
 Obj *gc_make_number(GC *gc, double x);
 Obj *gc_make_string(GC *gc, char *text);
+Obj *gc_make_string_with_length(GC *gc, char *text, int length); // takes ownership of text
 Obj *gc_make_bytecode(GC *gc, Code *code);
 Obj *gc_make_lambda(GC *gc, Obj *args, Obj *body, Code *code);
+Obj *gc_make_vector(GC *gc, Obj *root, Obj *tail, int count, int shift);
+Obj *gc_make_vector_node(GC *gc, int count); // the slots are set to NULL
+Obj *gc_make_map(GC *gc, Obj *root, int count);
+Obj *gc_make_map_node(GC *gc, int count, unsigned bitmap); // the slots are set to NULL
+Obj *gc_make_array(GC *gc, ArrayType type, int count); // zeroed, the data is freed with the array
+// Wraps memory that is owned by someone else (like the host program), nothing is copied.
+// The buffer must stay alive for as long as the array is reachable.
+Obj *gc_make_array_from_buffer(GC *gc, ArrayType type, void *data, int count);
+Obj *gc_make_lazy_seq(GC *gc, LazyKind kind, Obj *arg, Obj *seq);
+Obj *gc_make_xform(GC *gc, XformKind kind, Obj *arg);
+void gc_adopt_obj(GC *gc, Obj *o);
 
 // Util
 Obj *make_list(GC *gc, Obj *objs[], int obj_count);
@@ -0,0 +1,31 @@
+#ifndef IMAGE_H
+#define IMAGE_H
+
+#include "Runtime.h"
+
+// An image is a snapshot of everything reachable from the global environment of a runtime.
+// It's stored as an array of Obj:s with file offsets instead of pointers, so restoring
+// it is just a matter of mapping the file and adding the address of the mapping to every pointer.
+
+bool image_save(Runtime *r, const char *path);
+Runtime *image_load(const char *path); // returns NULL if the image can't be used
+
+// A code heap is an image that stays in memory and is shared by any number of runtimes, also on different threads.
+// Its objects are frozen: they're never collected, marked or changed (the memory is read-only), so a runtime
+// made from it only allocates its own bindings and whatever it creates while running. The globals and macros
+// of such a runtime overlay the frozen ones: redefining a global gives the runtime a binding of its own, which the
+// frozen code looks up through the overlay of the runtime (a slot for each frozen global), so every caller sees it.
+typedef struct sCodeHeap CodeHeap;
+
+// Freezes the globals and macros of 'r', returns NULL if they refer to mutable objects.
+// The lambdas of 'r' that have inlined globals are recompiled without inlining first.
+CodeHeap *code_heap_new(Runtime *r);
+Runtime *code_heap_runtime_new(CodeHeap *heap);
+void code_heap_retain(CodeHeap *heap);
+void code_heap_release(CodeHeap *heap); // the heap is freed once neither its creator nor any runtime uses it
+
+// The binding pair that a runtime made from a code heap has in place of a frozen one, or the frozen one itself
+Obj *code_heap_overlay(Runtime *r, Obj *frozen_pair);
+void code_heap_set_overlay(Runtime *r, Obj *frozen_pair, Obj *pair);
+
+#endif
@@ -0,0 +1,25 @@
+#ifndef INLINE_H
+#define INLINE_H
+
+#include "Obj.h"
+
+// Lambdas that have inlined the body of a global function at some call site depend on its binding pair.
+// When the binding is redefined the dependent lambdas are recompiled, see 'compiler_invalidate_inlined'.
+// The lambdas are weak references, an entry is dropped when its lambda is garbage.
+typedef struct {
+  Obj **pairs;
+  Obj **lambdas;
+  Obj **self_names; // needed to recompile the lambda the way it was first compiled, can be NULL
+  int capacity;
+  int count;
+} InlineDeps;
+
+void inline_deps_init(InlineDeps *deps);
+void inline_deps_free(InlineDeps *deps);
+void inline_deps_add(InlineDeps *deps, Obj *binding_pair, Obj *lambda, Obj *self_name);
+void inline_deps_remove_lambda(InlineDeps *deps, Obj *lambda);
+
+// Must be called after everything else has been marked by the GC (the lambdas are weak).
+void inline_deps_mark(InlineDeps *deps);
+
+#endif
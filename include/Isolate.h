@@ -0,0 +1,50 @@
+#ifndef ISOLATE_H
+#define ISOLATE_H
+
+#include "Runtime.h"
+#include <pthread.h>
+
+// An isolate is a runtime (with its own GC and frames) that runs on one of the threads of a shared pool.
+// Isolates never share objects: a message is serialized by the sender and deserialized into the heap
+// of the receiver, so only the bytes cross between threads.
+
+typedef struct sMessage {
+  char *data;
+  size_t size;
+  struct sMessage *next;
+} Message;
+
+typedef struct sIsolate {
+  int id;
+  pthread_mutex_t lock; // guards the mailbox
+  pthread_cond_t arrived;
+  Message *first;
+  Message *last;
+  struct sIsolate *next_job; // queued up for a thread of the pool
+  struct sCodeHeap *code_heap; // that the runtime of a spawned isolate is made from, if the spawning one had one
+} Isolate;
+
+// The id that other isolates send to, the runtime is registered as an isolate the first time it's asked for.
+int isolate_self(Runtime *r);
+
+// Starts a new isolate that calls 'f' with the args, returns its id or -1 if 'f' or the args can't be sent.
+// The isolate gets copies of the global definitions and macros that 'f' refers to (also through the definitions
+// that it uses), the ones that can't be copied (closures) are reported. If 'r' was made from a code heap
+// then so is the new runtime, and only the bindings that overlay it are copied.
+int isolate_spawn(Runtime *r, Obj *f, Obj *args[], int arg_count);
+
+// At most this many isolates run at the same time. The ones that wait in 'receive' don't count, the pool
+// starts more threads for the queued isolates while they wait.
+#define ISOLATE_MAX_THREADS 64
+int isolate_thread_count(); // the threads that the pool has now
+
+// Returns false if the message can't be serialized or there's no isolate with that id (anymore).
+bool isolate_send(Runtime *r, int id, Obj *message);
+
+// Waits for the next message, returns NULL if none arrived within 'timeout' seconds (a negative timeout waits forever).
+Obj *isolate_receive(Runtime *r, double timeout);
+
+// Unregisters the runtime, the messages that it hasn't received are dropped.
+void isolate_release(Runtime *r);
+
+#endif
@@ -0,0 +1,22 @@
+#ifndef LAZY_H
+#define LAZY_H
+
+#include "Runtime.h"
+
+// A LAZY_SEQ produces its items LAZY_CHUNK_SIZE at a time, the first time that they are needed.
+// When realized it's replaced by a list of the items that ends in a new LAZY_SEQ for the rest (or in nil),
+// so a streaming pipeline only keeps the current chunks alive, not the whole input.
+#define LAZY_CHUNK_SIZE 32
+
+// Realizes 'seq' if it's lazy, returns nil or the first cons (the cdr of which might be lazy).
+// Can call back into the VM, 'seq' doesn't have to be rooted by the caller.
+Obj *lazy_force(Runtime *r, Obj *seq);
+
+// Realizes all the lazy seqs in 'o', including the ones nested inside of it, and splices them out
+// so that the result is made of plain lists (for printing, or for the compiler). Returns the realized 'o'.
+Obj *lazy_realize_all(Runtime *r, Obj *o);
+
+// Like 'eq' but realizes lazy seqs as far as they have to be compared.
+bool lazy_eq(Runtime *r, Obj *a, Obj *b);
+
+#endif
@@ -0,0 +1,38 @@
+#ifndef MACRO_H
+#define MACRO_H
+
+#include "Obj.h"
+
+// Remembers the expansion of every macro call site (the form itself, compared by identity),
+// so that recompiling the same code (like the body of a lambda) doesn't run the macro again.
+// The call sites are weak references, the expansion of a form is kept alive for as long as the form is.
+typedef struct {
+  Obj **forms;
+  Obj **expansions; // (macro . expanded-form), the macro is checked on lookup in case it has been redefined
+  int capacity;
+  int count;
+} ExpansionCache;
+
+void expansion_cache_init(ExpansionCache *cache);
+void expansion_cache_free(ExpansionCache *cache);
+Obj *expansion_cache_get(ExpansionCache *cache, Obj *form); // returns NULL if the form hasn't been expanded
+void expansion_cache_put(ExpansionCache *cache, Obj *form, Obj *expansion);
+
+// Must be called last in the mark phase of the GC, forgets about the forms that weren't reached.
+void expansion_cache_mark(ExpansionCache *cache);
+
+// The macros that a top-level form expanded when it was compiled, by name and a hash of their definition.
+// The code cache stores them with the compiled form, which is compiled again if one of the macros has changed since.
+typedef struct {
+  char **names;
+  unsigned *hashes;
+  int count;
+  int capacity;
+} MacroDeps;
+
+void macro_deps_init(MacroDeps *deps);
+void macro_deps_free(MacroDeps *deps);
+void macro_deps_add(MacroDeps *deps, const char *name, unsigned hash); // a macro that has been added already is skipped
+unsigned macro_hash(Obj *macro); // of the args, body and rest flag of a (lambda . rest)
+
+#endif
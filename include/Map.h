@@ -0,0 +1,22 @@
+#ifndef MAP_H
+#define MAP_H
+
+#include "GC.h"
+
+// Persistent hash maps are hash array mapped tries (HAMT) of MAP_NODEs.
+// A node has a bitmap telling which of its 32 possible slots that are used, only the used slots are stored.
+// Each stored slot is a key and a value, or a NULL key and a child node.
+// Keys with identical hashes end up in a collision node at the bottom that is searched linearly.
+
+#define MAP_BITS 5
+#define MAP_MASK ((1 << MAP_BITS) - 1)
+
+Obj *map_get(Obj *map, Obj *key); // returns NULL if the key is missing
+Obj *map_assoc(GC *gc, Obj *map, Obj *key, Obj *value);
+Obj *map_dissoc(GC *gc, Obj *map, Obj *key);
+Obj *map_from_array(GC *gc, Obj *items[], int item_count); // keys and values interleaved
+
+// Calls 'visit' for every entry, in no particular order.
+void map_visit_entries(Obj *map, void (*visit)(Obj *key, Obj *value, void *data), void *data);
+
+#endif
@@ -0,0 +1,17 @@
+#ifndef NUMBER_H
+#define NUMBER_H
+
+#include <stdbool.h>
+
+// Enough room for any double printed by number_format, including the terminating null.
+#define NUMBER_FORMAT_MAX 32
+
+// Writes the shortest text that reads back as exactly x, integers are printed without decimals.
+// Returns the length, no allocations are made.
+int number_format(double x, char *buffer);
+
+// Reads a number literal like -12, 3.25 or 6.02e23 from [start, end).
+// Returns the position after the literal, or NULL if there is no number there.
+const char *number_parse(const char *start, const char *end, double *OUT_number);
+
+#endif
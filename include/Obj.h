@@ -2,6 +2,7 @@
 #define OBJ_H
 
 #include "Error.h"
+#include "StrBuilder.h"
 #include <stdbool.h>
 
 enum eCode;
@@ -14,8 +15,38 @@ typedef enum {
   STRING,
   LAMBDA,
   BYTECODE,
+  VECTOR,
+  VECTOR_NODE,
+  MAP,
+  MAP_NODE,
+  ARRAY,
+  LAZY_SEQ,
+  XFORM,
 } Type;
 
+typedef enum {
+  ARRAY_F64,
+  ARRAY_F32,
+  ARRAY_I32,
+} ArrayType;
+
+// What a LAZY_SEQ produces its next chunk of items from, see Lazy.h
+typedef enum {
+  LAZY_REALIZED,
+  LAZY_RANGE,
+  LAZY_MAP,
+  LAZY_FILTER,
+  LAZY_REMOVE,
+  LAZY_TAKE,
+} LazyKind;
+
+// The step that a transformation (made by 'mapping', 'filtering' or 'taking') applies to each item in 'transduce'
+typedef enum {
+  XFORM_MAP,
+  XFORM_FILTER,
+  XFORM_TAKE,
+} XformKind;
+
 typedef struct sObj {
   struct sObj *next;
   
@@ -30,17 +61,60 @@ typedef struct sObj {
       void *func;
       //char *func_name; // TODO: use this again and move *name into union?
     };
+    // SYMBOL & STRING
+    struct {
+      int length; // of the name, so that it never has to be counted
+      unsigned hash; // cached by obj_hash, 0 until it has been computed
+    };
     // NUMBER
     double number;
     // BYTECODE
     enum eCode *code;
+    // VECTOR & MAP
+    struct {
+      struct sObj *root; // trie of VECTOR_NODEs or MAP_NODEs, NULL when there are no nodes (yet)
+      struct sObj *tail; // VECTOR only, node with the last 1-32 items, NULL when the vector is empty
+    };
+    // VECTOR_NODE & MAP_NODE
+    struct sObj **items; // children in the trie, or the items on the lowest level
+    // ARRAY
+    struct {
+      void *data; // packed numbers, never contains any references
+      struct sObj *owner; // the array that owns the data of a slice, otherwise NULL
+    };
+    // LAZY_SEQ
+    struct {
+      struct sObj *lazy_arg; // the function (map, filter & remove), the count (take) or the start (range), NULL once realized
+      struct sObj *lazy_seq; // the source (or the end of a range), replaced by the realized items: nil or a list that might end in a LAZY_SEQ
+    };
+    // XFORM
+    struct sObj *xform_arg; // the function (mapping & filtering) or the count (taking)
   };
 
-  char *name; // used by symbols and strings for their content
+  union {
+    char *name; // used by symbols and strings for their content
+    // VECTOR, VECTOR_NODE, MAP, MAP_NODE, ARRAY, LAZY_SEQ & XFORM
+    struct {
+      int count; // items in the vector or array, entries in the map, or slots in the node
+      union {
+        int shift;       // VECTOR, how far an index is shifted to find its slot in the root
+        unsigned bitmap; // MAP_NODE, which of the 32 possible slots that are present
+        unsigned map_hash; // MAP, cached by obj_hash, 0 until it has been computed
+        // ARRAY
+        struct {
+          unsigned char element_type; // an ArrayType
+          bool owns_data; // false for slices and for buffers handed over by the host
+        };
+        unsigned char lazy_kind; // LAZY_SEQ, a LazyKind
+        unsigned char xform_kind; // XFORM, an XformKind
+      };
+    };
+  };
 
   // Put smaller types last to decrease size of the struct
   Type type;
   bool reachable;
+  bool external; // memory is owned by a mapped image, not by the GC
   
 } Obj;
 
@@ -49,22 +123,31 @@ typedef struct sObj {
 /* typedef Obj *(*Func)(Runtime *r, Obj *args[], int arg_count); */
 
 const char *type_to_str(Type type);
-const char *obj_to_str(Obj *o);
-
+// Appends a printed version of 'o' to the builder, 'readably' means that strings get their quotes.
+// Strings inside of lists are always printed readably.
+void obj_print_to(StrBuilder *sb, Obj *o, bool readably);
 void print_obj(Obj *o);
 void obj_describe(const char *description, Obj *o);
   
 bool eq(Obj *a, Obj *b);
+// Structural hash, objects that are eq have the same hash.
+unsigned obj_hash(Obj *o);
+
+// Calls 'visit' with the address of every Obj* stored in 'o' (including the ones inside of bytecode).
+void obj_visit_refs(Obj *o, void (*visit)(Obj **ref, void *data), void *data);
 int count(Obj *list);
+// Skips past lazy seqs that have been realized, an unrealized one is returned as it is.
+Obj *lazy_unwrap(Obj *o);
 
 // Cons cell helpers
 #define FIRST(o)  ((o)->car)
 #define SECOND(o) ((o)->cdr->car)
 #define THIRD(o)  ((o)->cdr->cdr->car)
+#define FOURTH(o) ((o)->cdr->cdr->cdr->car)
 #define REST(o)   ((o)->cdr)
 
 // Lambda helpers
-#define GET_ENV(o)  ((o)->car->car)
+#define GET_ENV(o)  ((o)->car->car) // non-NULL if the lambda captured locals when it was compiled
 #define GET_ARGS(o) ((o)->car->cdr)
 #define GET_BODY(o) ((o)->cdr->car)
 #define GET_CODE(o) ((o)->cdr->cdr->code)
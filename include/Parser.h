@@ -1,8 +1,20 @@
 #ifndef PARSER_H
 #define PARSER_H
 
+#include <stddef.h>
 #include "GC.h"
 
+typedef struct {
+  const char *pos;
+  const char *end; // the source doesn't have to be null terminated
+  bool failed;
+} Parser;
+
+// Reads one top-level form at a time, so that it can be evaluated before the next one is parsed.
+void parser_init(Parser *p, const char *source, size_t length);
+Obj *parser_next_form(GC *gc, Parser *p);
+
+// Parses all forms in 'source' into a list.
 Obj *parse(GC *gc, const char *source);
 
 #endif
@@ -0,0 +1,29 @@
+#ifndef PORT_H
+#define PORT_H
+
+#include <stdio.h>
+#include "Obj.h"
+#include "StrBuilder.h"
+
+typedef enum {
+  PORT_BUFFER_LINE, // flush whenever a newline has been written
+  PORT_BUFFER_FULL, // flush when the buffer is full or on explicit (flush)
+} PortBuffering;
+
+// An output port collects printed text in a buffer and hands it to the file in big chunks.
+typedef struct {
+  StrBuilder buffer;
+  FILE *file;
+  PortBuffering buffering;
+  int flush_size;
+} Port;
+
+void port_init(Port *port, FILE *file, PortBuffering buffering);
+void port_free(Port *port);
+void port_flush(Port *port);
+
+void port_write(Port *port, const char *s, int length);
+void port_write_obj(Port *port, Obj *o, bool readably);
+void port_write_char(Port *port, char c);
+
+#endif
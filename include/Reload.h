@@ -0,0 +1,41 @@
+#ifndef RELOAD_H
+#define RELOAD_H
+
+#include "Obj.h"
+
+// Remembers the top-level forms of every source file that has been loaded: a structural hash of each form
+// and the name that it defines, if any. Reloading a file only evaluates the forms whose hash isn't among the
+// ones from last time, so the state held by the other definitions survives.
+typedef struct {
+  unsigned *hashes;
+  char **names; // NULL for forms that don't define anything
+  int count;
+  int capacity;
+} FormHashes;
+
+typedef struct {
+  char **paths;
+  FormHashes *forms;
+  int count;
+  int capacity;
+} LoadedFiles;
+
+void form_hashes_init(FormHashes *forms);
+void form_hashes_free(FormHashes *forms);
+void form_hashes_add(FormHashes *forms, unsigned hash, const char *name);
+// Returns the index of a form with the hash that isn't 'used' yet, or -1. The search starts at 'start' since
+// the forms of a file that has been edited mostly come in the same order as before.
+int form_hashes_find(FormHashes *forms, unsigned hash, bool used[], int start);
+bool form_hashes_defines(FormHashes *forms, const char *name);
+
+// The name of (def name ...) and (defmacro name ...), otherwise NULL
+const char *form_defined_name(Obj *form);
+
+void loaded_files_init(LoadedFiles *files);
+void loaded_files_free(LoadedFiles *files);
+FormHashes *loaded_files_get(LoadedFiles *files, const char *path); // NULL if the file hasn't been loaded
+// Moves the forms of the file to 'OUT_forms' (empty if it hasn't been loaded), the file keeps an empty entry
+void loaded_files_take(LoadedFiles *files, const char *path, FormHashes *OUT_forms);
+void loaded_files_put(LoadedFiles *files, const char *path, FormHashes *forms); // takes over the forms
+
+#endif
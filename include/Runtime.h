@@ -4,13 +4,20 @@
 #include "GC.h"
 #include "Obj.h"
 #include "Bytecode.h"
+#include "Port.h"
+#include "Macro.h"
+#include "Inline.h"
+#include "Reload.h"
+#include <stdint.h>
 
 #define MAX_FRAMES 1024
+#define MAX_SLOTS 64 // args and let-bound locals of a frame
 
 typedef struct {
   char name[128];
   Code *p; // current instruction to execute
-  Obj *args[64]; // change name to arg_values
+  Obj *args[MAX_SLOTS]; // the args come first, followed by the let-bound locals
+  int slot_count; // how many of the slots that are in use, the GC only marks these
   Obj *arg_symbols; // used when looking up args in enclosing scopes
 } Frame;
 
@@ -28,21 +35,49 @@ typedef struct {
   Frame frames[MAX_FRAMES];
   int top_frame;
   RuntimeMode mode;
+  Obj *macros; // env where the values are (lambda . rest), 'rest' is true if the last arg collects the rest of the args
+  ExpansionCache expansions;
+  MacroDeps *macro_deps; // where the compiler records the macros it expands, NULL when nothing is recording
+  int gensym_counter;
+  uint64_t random_state; // used by 'rand', each runtime has its own so that they can run on different threads
+  InlineDeps inline_deps;
+  Obj *retired_code; // bytecode replaced by recompilation is kept alive until no frames are running
+  Port out; // used by print, println and the REPL
+  void *image; // mapped image that the runtime was restored from, if any
+  size_t image_size;
+  struct sIsolate *isolate; // set once the runtime can receive messages
+  struct sCodeHeap *code_heap; // shared frozen objects that the globals overlay, if any
+  Obj **overlay; // the runtime's own binding pair of each frozen global, NULL until it has one (see Image.h)
+  Obj **handles; // objects that the host holds on to, NULL in the free slots (see Embed.h)
+  int *free_handles; // stack of the free slots below handle_count
+  int free_handle_count;
+  int handle_count;
+  int handle_capacity;
+  LoadedFiles loaded_files; // the form hashes of the source files, for reloading them
 } Runtime;
 
 Runtime *runtime_new(bool builtins);
 void runtime_delete(Runtime *r);
 
 void runtime_eval(Runtime *r, const char *source);
+void runtime_eval_form(Runtime *r, Obj *form); // like runtime_eval but for a form that is already parsed, the result isn't printed
 void runtime_step_eval(Runtime *r);
 bool runtime_load_file(Runtime *r, const char *filename, bool silent);
+// Only evaluates the top-level forms that changed since the file was loaded, returns the names that were (re)defined
+// or NULL if the file can't be read.
+Obj *runtime_reload_file(Runtime *r, const char *filename);
 void runtime_inspect_env(Runtime *r);
 
 Frame *runtime_frame_push(Runtime *r, int arg_count, Obj *arg_symbols, Code *code, const char *name);
 void runtime_frame_pop(Runtime *r);
 void runtime_print_frames(Runtime *r);
+Obj *runtime_call(Runtime *r, Obj *f, Obj *args[], int arg_count);
+uint64_t runtime_random(Runtime *r);
 
 void runtime_env_assoc(Runtime *r, Obj *env, Obj *key, Obj *value);
 Obj *runtime_env_find_pair(Obj *env, Obj *key);
+Obj *runtime_env_make_local(Runtime *r, Obj *parent_env);
+Obj *runtime_env_find_or_inherit_pair(Runtime *r, Obj *env, Obj *key);
+Obj *runtime_env_find_or_define_pair(Runtime *r, Obj *env, Obj *key);
 
 #endif
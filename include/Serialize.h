@@ -0,0 +1,51 @@
+#ifndef SERIALIZE_H
+#define SERIALIZE_H
+
+#include <stddef.h>
+#include <sys/stat.h>
+#include "Obj.h"
+#include "Bytecode.h"
+#include "Runtime.h"
+
+// A compact binary format for objects and compiled code.
+// Global bindings referenced by code are stored as symbols and relocated through the
+// global environment when read back in, so the output doesn't depend on any pointers.
+
+typedef struct {
+  char *data;
+  size_t size;
+  size_t capacity;
+  bool failed; // set when something couldn't be serialized (like a primitive function)
+} Serializer;
+
+typedef struct {
+  const char *pos;
+  const char *end;
+  bool failed;
+} Deserializer;
+
+void serializer_init(Serializer *s);
+void serializer_free(Serializer *s);
+void serialize_bytes(Serializer *s, const void *bytes, size_t length);
+void serialize_int(Serializer *s, int i);
+bool serialize_obj(Serializer *s, Obj *o);
+bool serialize_code(Serializer *s, Code *code);
+
+void deserializer_init(Deserializer *d, const char *data, size_t length);
+bool deserialize_bytes(Deserializer *d, void *OUT_bytes, size_t length);
+int deserialize_int(Deserializer *d);
+Obj *deserialize_obj(Deserializer *d, Runtime *r);
+Code *deserialize_code(Deserializer *d, Runtime *r);
+
+// Code caches (.plc files) store the compiled top-level forms of a source file, each preceded by the hash
+// of the form, the name that it defines (see Reload.h) and the macros that it expanded
+bool code_cache_path(const char *source_path, char *OUT_path, size_t max_length);
+// The header records the size and modification time of the source, a cache of another version of the file is rejected
+bool code_cache_read_header(Deserializer *d, const struct stat *source_stat);
+bool code_cache_write(Serializer *s, const char *cache_path, const struct stat *source_stat);
+void code_cache_write_form_info(Serializer *s, unsigned hash, const char *name); // 'name' can be NULL
+bool code_cache_read_form_info(Deserializer *d, unsigned *OUT_hash, char **OUT_name); // the name is malloced, or NULL
+void code_cache_write_macro_deps(Serializer *s, MacroDeps *deps);
+bool code_cache_read_macro_deps(Deserializer *d, MacroDeps *deps); // adds to an initialized 'deps'
+
+#endif
@@ -0,0 +1,31 @@
+#ifndef SIMD_H
+#define SIMD_H
+
+// Numeric kernels over packed doubles. The fastest set the CPU supports is picked at runtime,
+// AVX2 (with FMA) or SSE2, and there is a plain scalar set for other machines.
+// sin and cos are polynomial approximations, accurate to a few ulp for |x| < 1e5 (larger values use libm).
+
+typedef struct {
+  const char *name;
+  void (*add)(double *out, const double *a, const double *b, int n);
+  void (*sub)(double *out, const double *a, const double *b, int n);
+  void (*mul)(double *out, const double *a, const double *b, int n);
+  void (*div)(double *out, const double *a, const double *b, int n);
+  void (*fma)(double *out, const double *a, const double *b, const double *c, int n); // a * b + c
+  void (*fma_scalar)(double *out, const double *a, double b, const double *c, int n); // a * b + c
+  void (*clamp)(double *out, const double *a, double lo, double hi, int n);
+  void (*sin)(double *out, const double *a, int n);
+  void (*cos)(double *out, const double *a, int n);
+  double (*sum)(const double *a, int n);
+  double (*dot)(const double *a, const double *b, int n);
+  double (*min)(const double *a, int n); // n must be > 0
+  double (*max)(const double *a, int n); // n must be > 0
+} SimdKernels;
+
+// The best kernels for this CPU, chosen on the first call.
+const SimdKernels *simd_kernels();
+
+// Kernels by name ("avx2", "sse2" or "scalar"), NULL if the CPU can't run them.
+const SimdKernels *simd_kernels_named(const char *name);
+
+#endif
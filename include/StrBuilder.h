@@ -0,0 +1,26 @@
+#ifndef STR_BUILDER_H
+#define STR_BUILDER_H
+
+#include <stdbool.h>
+
+// A growable char buffer, appending is amortized O(1) and the content is always null terminated.
+typedef struct {
+  char *data;
+  int length;
+  int capacity;
+} StrBuilder;
+
+void str_builder_init(StrBuilder *sb, int capacity);
+void str_builder_free(StrBuilder *sb);
+void str_builder_clear(StrBuilder *sb);
+void str_builder_reserve(StrBuilder *sb, int extra);
+
+void str_builder_append(StrBuilder *sb, const char *s, int length);
+void str_builder_append_str(StrBuilder *sb, const char *s);
+void str_builder_append_char(StrBuilder *sb, char c);
+void str_builder_append_number(StrBuilder *sb, double x);
+
+// Hands over the buffer to the caller, the builder is left empty.
+char *str_builder_take(StrBuilder *sb, int *OUT_length);
+
+#endif
@@ -0,0 +1,18 @@
+#ifndef VECTOR_H
+#define VECTOR_H
+
+#include "GC.h"
+
+// Persistent vectors are 32-way tries of VECTOR_NODEs plus a tail node holding the last items.
+// Operations never change an existing vector, the new one shares all untouched nodes with the old.
+
+#define VECTOR_BITS 5
+#define VECTOR_WIDTH (1 << VECTOR_BITS)
+#define VECTOR_MASK (VECTOR_WIDTH - 1)
+
+Obj *vector_nth(Obj *vector, int index);
+Obj *vector_conj(GC *gc, Obj *vector, Obj *item);
+Obj *vector_assoc(GC *gc, Obj *vector, int index, Obj *item);
+Obj *vector_from_array(GC *gc, Obj *items[], int item_count);
+
+#endif
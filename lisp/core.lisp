@@ -11,35 +11,7 @@
 (def π 3.141592653589793)
 (def pi π)
 
-(def zip
-  (fn (a b) (if (nil? a)
-              ()
-              (cons (list (first a) (first b))
-                    (zip (rest a) (rest b))))))
-
-(def range
-  (fn (start end)
-    (if (> start end)
-      ()
-      (cons start (range (inc start) end)))))
-
-(def map
-  (fn (f xs)
-    (if (nil? xs)
-      ()
-      (cons (f (first xs)) (map f (rest xs))))))
-
-(def reduce
-  (fn (f x xs)
-    (if (nil? xs)
-      x
-      (reduce f (f x (first xs)) (rest xs)))))
-
-(def replicate
-     (fn (n item)
-	 (if (= 0 n)
-	     ()
-	   (cons item (replicate (dec n) item)))))
+;; map, keep, filter, remove, reduce, range, replicate, zip, reverse and concat are builtins
 
 (def iter-n
     (fn (n f)
@@ -48,29 +20,41 @@
 		(iter-n (dec n) f)
 		'done))))
 
-(def loop
+(def forever
     (fn (f)
 	(do (f)
-	    (loop f))))
-
-(def keep
-    (fn (pred xs)
-	(if (nil? xs)
-	    nil
-	    (if (pred (first xs))
-		(cons (first xs) (keep pred (rest xs)))
-		(keep pred (rest xs))))))
-
-(def remove
-    (fn (pred xs)
-	(keep (fn (x) (not (pred x))) xs)))
+	    (forever f))))
+
+(defmacro when (condition & body)
+  (list 'if condition (cons 'do body) nil))
+
+(defmacro unless (condition & body)
+  (list 'if condition nil (cons 'do body)))
+
+;; (-> x (f a) g) becomes (g (f x a))
+(defmacro -> (x & forms)
+  (reduce (fn (acc form)
+	    (if (list? form)
+		(cons (first form) (cons acc (rest form)))
+		(list form acc)))
+	  x
+	  forms))
+
+;; (dotimes (i n) body...) runs the body with i going from 0 to n - 1
+(defmacro dotimes (binding & body)
+  (let (i (first binding)
+	n (gensym))
+    (list 'let (list n (first (rest binding)))
+	  (list 'loop (list i 0)
+		(list 'if (list '= i n)
+		      nil
+		      (list 'do (cons 'do body) (list 'recur (list '+ i 1))))))))
 
 (def timing
-  (fn (f) (do (def start-time (time)) ; TODO: Use local let bindings instead
-              (f)
-              (def end-time (time))
-              (print "dt:")
-              (println (- end-time start-time)))))
+  (fn (f) (let (start-time (time))
+            (f)
+            (print "dt:")
+            (println (- (time) start-time)))))
 
 (def assert
     (fn (n pred)
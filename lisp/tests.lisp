@@ -11,7 +11,109 @@
 	   '420
 	   (eval (read "(* 42 10)")))
 
+(assert-eq "Str"
+	   "ab(c d)"
+	   (str "a" 'b (list 'c 'd)))
+
 (assert-eq "Remove Odd"
 	   '(2 4 6 8 10)
 	   (remove odd? (range 1 10)))
 
+
+(assert-eq "Number Printing"
+	   "1 0.5 -2.25 1e21 -3"
+	   (str 1 " " 0.5 " " -2.25 " " 1e21 " " (- 0 3)))
+
+(assert-eq "Vectors"
+	   [1 2 30 "four"]
+	   (assoc (conj [1 2 3] "four") 2 (* 3 10)))
+
+(assert-eq "Maps"
+	   {"a" 1 "c" [3]}
+	   (dissoc (assoc {"a" 1 "b" 2} "c" [(get {'x 3} 'x)]) "b"))
+
+(assert-eq "Typed Arrays"
+	   '(2.5 7)
+	   (do (def xs (make-f64array 10 2.5))
+	       (aset! (aslice xs 5 10) 1 7)
+	       (list (aget xs 0) (aget xs 6))))
+
+(assert-eq "Array Kernels"
+	   '(28 3 0)
+	   (do (def xs (make-f64array 4 2))
+	       (def ys (afma xs 3 (make-f64array 4 -1)))
+	       (list (asum (a+ xs ys)) (amax (aclamp ys 0 3)) (amin (sin (make-f32array 2))))))
+
+(assert-eq "Let"
+	   '(3 10 2 5)
+	   (do (def add-to (fn (n) (let [x 1 y (+ x n)] (fn (z) (+ y z)))))
+	       (list (let (a 1 b 2) (+ a b))
+		     ((add-to 4) 5)
+		     (let (a 1) (let (a 2) a))
+		     ((fn (a) (let (b a) (if (= a b) (+ a b) nil))) 2.5))))
+
+(assert-eq "Loop and Recur"
+	   '(4950 done 120 (1 2 3) 6)
+	   (do (def count-down (fn (n acc) (if (= n 0) acc (count-down (- n 1) (cons n acc)))))
+	       (def count-loops (fn (n acc) (loop [i n a acc] (if (= i 0) (if (= n 0) a (count-loops (- n 1) a)) (recur (- i 1) (+ a 1))))))
+	       (list (loop [i 0 sum 0] (if (= i 100) sum (recur (+ i 1) (+ sum i))))
+		     (iter-n 100000 (fn (n) n))
+		     ((fn (n) (loop (i n acc 1) (if (= i 0) acc (recur (- i 1) (* acc i))))) 5)
+		     (count-down 3 '())
+		     (count-loops 3 0))))
+
+(assert-eq "Macros"
+	   '(yes () 7 (2 1 0))
+	   (do (def xs '())
+	       (dotimes (i 3) (def xs (cons i xs)))
+	       (list (when (= 1 1) 'maybe 'yes)
+		     (unless (= 1 1) 'no)
+		     (-> 1 (+ 2) (* 2) inc)
+		     xs)))
+
+(assert-eq "Inlining and Redefinition"
+	   '(3 12)
+	   (do (def add-one (fn (x) (+ x 1)))
+	       (def add-two (fn (x) (add-one (add-one x))))
+	       (def before (add-two 1))
+	       (def add-one (fn (x) (+ x 5)))
+	       (list before (add-two 2))))
+
+(assert-eq "Sequences"
+	   '(5000 (2 4) (1 3) 10 ((1 x) (2 y)) (3 2 1 4) true (0 0))
+	   (list (count (map inc (range 1 5000)))
+		 (filter even? [1 2 3 4])
+		 (remove even? '(1 2 3 4))
+		 (reduce + 0 (range 1 4))
+		 (zip '(1 2 3) '[x y])
+		 (concat (reverse '(1 2 3)) [4])
+		 (nil? (concat))
+		 (replicate 2 0)))
+
+(assert-eq "Lazy Sequences"
+	   '(1 (2 3 4) (1 3 5) 5000050000 true (0 1 2))
+	   (list (first (range 1 1000000000))
+		 (take 3 (map inc (range 1 1000000000)))
+		 (take 3 (filter odd? (range 1 1000000000)))
+		 (reduce + 0 (range 1 100000))
+		 (nil? (filter (fn (x) (= x 0)) (range 1 100)))
+		 (cons 0 (take 2 (range 1 5)))))
+
+(assert-eq "Transducers"
+	   '(9 165 [2 3 4] [2 4] 7.5 6 6)
+	   (list (transduce (mapping inc) + 0 '(1 2 3))
+		 (transduce [(filtering odd?) (mapping (fn (x) (* x x)))] + 0 (range 1 10))
+		 (transduce (list (mapping inc) (taking 3)) conj [] (range 1 1000000000))
+		 (transduce [(filtering even?) (taking 2)] conj [] [1 2 3 4 5 6])
+		 (transduce (mapping inc) + 0 (make-f64array 3 1.5))
+		 (transduce [] + 0 '(1 2 3))
+		 (transduce '() + 0 [1 2 3])))
+
+(assert-eq "Isolates"
+	   '((5 25) [1 "two" {3 4}] true)
+	   (do (def me (self))
+	       (def echo (fn () (send me (receive))))
+	       (spawn (fn (n) (send me (list n (* n n)))) 5)
+	       (list (receive 10)
+		     (do (send (spawn echo) [1 "two" {3 4}]) (receive 10))
+		     (nil? (receive 0.01)))))
@@ -0,0 +1,38 @@
+#include "Array.h"
+#include <stdint.h>
+
+int array_element_size(ArrayType type) {
+  if(type == ARRAY_F64) return sizeof(double);
+  else if(type == ARRAY_F32) return sizeof(float);
+  else return sizeof(int32_t);
+}
+
+const char *array_type_to_str(ArrayType type) {
+  if(type == ARRAY_F64) return "f64";
+  else if(type == ARRAY_F32) return "f32";
+  else if(type == ARRAY_I32) return "i32";
+  else return "unknown";
+}
+
+double array_get(Obj *array, int index) {
+  if(array->element_type == ARRAY_F64) return ((double*)array->data)[index];
+  else if(array->element_type == ARRAY_F32) return ((float*)array->data)[index];
+  else return ((int32_t*)array->data)[index];
+}
+
+void array_set(Obj *array, int index, double x) {
+  if(array->element_type == ARRAY_F64) ((double*)array->data)[index] = x;
+  else if(array->element_type == ARRAY_F32) ((float*)array->data)[index] = (float)x;
+  else ((int32_t*)array->data)[index] = (int32_t)x;
+}
+
+Obj *array_slice(GC *gc, Obj *array, int start, int end) {
+  if(start < 0 || end > array->count || start > end) {
+    return NULL;
+  }
+  char *data = (char*)array->data + (size_t)start * array_element_size(array->element_type);
+  Obj *slice = gc_make_array_from_buffer(gc, array->element_type, data, end - start);
+  // Slices of slices point to the original owner, so that there is never a long chain to keep alive
+  slice->owner = array->owner ? array->owner : array;
+  return slice;
+}
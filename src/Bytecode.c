@@ -1,6 +1,7 @@
 #include "Bytecode.h"
 #include <stdlib.h>
 #include <stdio.h>
+#include <string.h>
 
 const char *code_to_str(Code code) {
   if(code == END_OF_CODES)             return "END       ";
@@ -20,6 +21,9 @@ const char *code_to_str(Code code) {
   else if(code == DIRECT_LOOKUP_VAR)   return "DIRECT    ";
   else if(code == TAIL_CALL)           return "TAILCALL  ";
   else if(code == LOOKUP_ARG)          return "LOOK ARG  ";
+  else if(code == STORE_LOCAL)         return "STORE LOC ";
+  else if(code == LOAD_LOCAL)          return "LOAD LOC  ";
+  else if(code == DEFINE_MACRO)        return "DEF MACRO ";
   else if(code == UNINITIALIZED)       return "UN-INITED ";
   else                                 return "UNKNOWN   ";
 }
@@ -27,6 +31,7 @@ const char *code_to_str(Code code) {
 bool pushes_obj(Code code) {
   return (code == PUSH_CONSTANT ||
 	  code == DEFINE ||
+	  code == DEFINE_MACRO ||
 	  code == DIRECT_LOOKUP_VAR);
 }
 
@@ -34,7 +39,21 @@ bool pushes_int(Code code) {
   return (code == CALL ||
 	  code == TAIL_CALL ||
 	  code == JUMP ||
-	  code == LOOKUP_ARG);
+	  code == LOOKUP_ARG ||
+	  code == STORE_LOCAL ||
+	  code == LOAD_LOCAL);
+}
+
+int code_obj_operand_count(Code code) {
+  if(code == PUSH_LAMBDA) {
+    return 4;
+  }
+  else if(pushes_obj(code)) {
+    return 1;
+  }
+  else {
+    return 0;
+  }
 }
 
 void print_code_as_obj(Code *code) {
@@ -61,8 +80,8 @@ Code *code_print_single(Code *code) {
     code += 1;
   }
   else if(*code == PUSH_LAMBDA) {
-    printf(" <args> <body>");
-    code += 5;
+    printf(" <args> <body> <scope> <self>");
+    code += 1 + 2 * code_obj_operand_count(PUSH_LAMBDA);
   }
   else {
     code++;
@@ -83,88 +102,150 @@ void code_print(Code *code_block) {
 }
 
 CodeWriter *code_writer_init(CodeWriter *writer, int size) {
-  writer->codes = malloc(size); // This should get freed by the caller, exactly how depends on its usage.
+  writer->codes = malloc(sizeof(Code) * size); // This should get freed by the caller, exactly how depends on its usage.
   writer->codes[0] = UNINITIALIZED;
   writer->size = size;
   writer->pos = 0;
   writer->error = NULL;
+  writer->arg_count = 0;
+  writer->self_name = NULL;
+  writer->tail_calls_allowed = true;
+  writer->recur_pos = -1;
+  writer->recur_slot = 0;
+  writer->recur_count = 0;
+  writer->inline_enabled = false;
+  writer->inline_depth = 0;
+  writer->inlined = NULL;
+  writer->captured = false;
+  writer->ignore_frames = false;
   return writer;
 }
 
-void code_write(CodeWriter *writer, Code code) {
-  if(writer->pos >= writer->size) {
-    error("Can't write Code, block is full.");
+// Make sure there is room for 'count' more codes in the block.
+void code_writer_reserve(CodeWriter *writer, int count) {
+  if(writer->pos + count > writer->size) {
+    while(writer->pos + count > writer->size) {
+      writer->size *= 2;
+    }
+    writer->codes = realloc(writer->codes, sizeof(Code) * writer->size);
   }
+}
+
+void code_write(CodeWriter *writer, Code code) {
+  code_writer_reserve(writer, 1);
   writer->codes[writer->pos] = code;
   writer->pos++;
 }
 
-void obj_write(CodeWriter *writer, Obj *o) {
-  if(writer->pos >= writer->size) {
-    error("Can't write Obj*, code block is full.");
-  }
+void code_write_obj(CodeWriter *writer, Obj *o) {
+  code_writer_reserve(writer, 2);
   Obj **p = (Obj**)&(writer->codes[writer->pos]);
   *p = o;
   writer->pos += 2;
 }
 
-void int_write(CodeWriter *writer, int i) {
-  if(writer->pos >= writer->size) {
-    error("Can't write int, code block is full.");
-  }
+void code_write_int(CodeWriter *writer, int i) {
+  code_writer_reserve(writer, 1);
   int *ip = (int*)&(writer->codes[writer->pos]);
   *ip = i;
   writer->pos++;
 }
 
+void code_write_block(CodeWriter *writer, Code *codes, int length) {
+  code_writer_reserve(writer, length);
+  memcpy(&writer->codes[writer->pos], codes, sizeof(Code) * length);
+  writer->pos += length;
+}
+
 void code_write_push_constant(CodeWriter *writer, Obj *o) {
   code_write(writer, PUSH_CONSTANT);
-  obj_write(writer, o);
+  code_write_obj(writer, o);
 }
 
 void code_write_define(CodeWriter *writer, Obj *sym) {
   if(sym->type != SYMBOL) {
-    error("Can't write DEFINE with non-symbol.");
+    writer->error = "Can't write DEFINE with non-symbol.";
+    return;
   }
   code_write(writer, DEFINE);
-  obj_write(writer, sym);
+  code_write_obj(writer, sym);
+}
+
+void code_write_define_macro(CodeWriter *writer, Obj *sym) {
+  if(sym->type != SYMBOL) {
+    writer->error = "Can't write DEFINE_MACRO with non-symbol.";
+    return;
+  }
+  code_write(writer, DEFINE_MACRO);
+  code_write_obj(writer, sym);
 }
 
 void code_write_direct_lookup_var(CodeWriter *writer, Obj *binding_pair) {
   if(binding_pair->type != CONS) {
-    error("Can't write DIRECT_LOOKUP_VAR with non-cons.");
+    writer->error = "Can't write DIRECT_LOOKUP_VAR with non-cons.";
+    return;
   }
   else if(binding_pair->car->type != SYMBOL) {
-    error("Can't write DIRECT_LOOKUP_VAR with binding pair that hasn't got symbol in car.");
+    writer->error = "Can't write DIRECT_LOOKUP_VAR with binding pair that hasn't got symbol in car.";
+    return;
   }
   code_write(writer, DIRECT_LOOKUP_VAR);
-  obj_write(writer, binding_pair);
+  code_write_obj(writer, binding_pair);
 }
 
-void code_write_push_lambda(CodeWriter *writer, Obj *args, Obj *body) {
+void code_write_push_lambda(CodeWriter *writer, Obj *args, Obj *body, Obj *scope, Obj *self_name) {
   code_write(writer, PUSH_LAMBDA);
-  obj_write(writer, args);
-  obj_write(writer, body);
+  code_write_obj(writer, args);
+  code_write_obj(writer, body);
+  code_write_obj(writer, scope);
+  code_write_obj(writer, self_name);
 }
 
 void code_write_call(CodeWriter *writer, int arg_count) {
   code_write(writer, CALL);
-  int_write(writer, arg_count);
+  code_write_int(writer, arg_count);
 }
 
 void code_write_tail_call(CodeWriter *writer, int arg_count) {
   code_write(writer, TAIL_CALL);
-  int_write(writer, arg_count);
+  code_write_int(writer, arg_count);
 }
 
 void code_write_jump(CodeWriter *writer, int jump_length) {
   code_write(writer, JUMP);
-  int_write(writer, jump_length);
+  code_write_int(writer, jump_length);
+}
+
+int code_write_jump_placeholder(CodeWriter *writer) {
+  code_write_jump(writer, 0);
+  return writer->pos - 1;
+}
+
+void code_patch_jump(CodeWriter *writer, int jump_pos) {
+  // The jump length is counted from the code after the jump
+  int *ip = (int*)&(writer->codes[jump_pos]);
+  *ip = writer->pos - (jump_pos + 1);
+}
+
+// Jumps to an earlier position, used for loops.
+void code_write_jump_back(CodeWriter *writer, int target_pos) {
+  code_write(writer, JUMP);
+  code_write_int(writer, target_pos - (writer->pos + 1));
 }
 
 void code_write_lookup_arg(CodeWriter *writer, int arg_index) {
   code_write(writer, LOOKUP_ARG);
-  int_write(writer, arg_index);
+  code_write_int(writer, arg_index);
+}
+
+void code_write_store_local(CodeWriter *writer, int slot) {
+  code_write(writer, STORE_LOCAL);
+  code_write_int(writer, slot);
+}
+
+void code_write_load_local(CodeWriter *writer, int slot) {
+  code_write(writer, LOAD_LOCAL);
+  code_write_int(writer, slot);
 }
 
 void code_write_if(CodeWriter *writer) {
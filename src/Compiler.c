@@ -1,5 +1,8 @@
 #include "Compiler.h"
 #include "Parser.h"
+#include "Vector.h"
+#include "Map.h"
+#include "Lazy.h"
 #include <stdio.h>
 #include <string.h>
 #include <assert.h>
@@ -12,6 +15,7 @@ bool is_binary_call(Obj *form, const char *name) {
   return is_symbol(form, name) && count(form->cdr) == 2;
 }
 
+// Returns the slot of the symbol, the last match wins so that inner let-bindings shadow outer ones.
 int find_arg_index_in_arglist(Obj *args, Obj *symbol) {
   assert(symbol->type == SYMBOL);
   int arg_index = -1;
@@ -20,8 +24,6 @@ int find_arg_index_in_arglist(Obj *args, Obj *symbol) {
   while(arg && arg->car) {
     if(eq(arg->car, symbol)) {
       arg_index = i;
-      /* printf("Arg '%s' found in position %d.\n", arg->car->name, arg_index); */
-      break;
     }
     arg = arg->cdr;
     i++;
@@ -29,6 +31,425 @@ int find_arg_index_in_arglist(Obj *args, Obj *symbol) {
   return arg_index;
 }
 
+void visit(CodeWriter *writer, Runtime *r, Obj *form, bool tail_position, Obj *args);
+
+// A scope is the list of args followed by the let-bound locals, the position of a symbol is its slot in the frame.
+// Returns a new scope with 'symbol' added last, the old one is left as it is since lambdas might refer to it.
+Obj *scope_with(Runtime *r, Obj *scope, Obj *symbol) {
+  Obj *new_scope = r->nil;
+  Obj *last_cons = NULL;
+  for(Obj *item = scope; item && item->car; item = item->cdr) {
+    Obj *new = gc_make_cons(r->gc, item->car, r->nil);
+    if(last_cons) {
+      last_cons->cdr = new;
+    } else {
+      new_scope = new;
+    }
+    last_cons = new;
+  }
+  Obj *new = gc_make_cons(r->gc, symbol, r->nil);
+  if(last_cons) {
+    last_cons->cdr = new;
+  } else {
+    new_scope = new;
+  }
+  return new_scope;
+}
+
+int scope_size(Obj *scope) {
+  return scope ? count(scope) : 0;
+}
+
+Obj *binding_at(Obj *bindings, int i) {
+  if(bindings->type == VECTOR) {
+    return vector_nth(bindings, i);
+  }
+  while(i-- > 0) {
+    bindings = bindings->cdr;
+  }
+  return bindings->car;
+}
+
+// Stores the values of the bindings (a 1 b (+ a 1)) or [a 1 b (+ a 1)] in their own frame slots,
+// later bindings can see the earlier ones. Returns the new scope, or NULL if the bindings are invalid.
+Obj *visit_bindings(CodeWriter *writer, Runtime *r, Obj *bindings, Obj *scope, const char *form_name) {
+  if(!bindings || !(bindings->type == VECTOR || bindings->type == CONS)) {
+    printf("No bindings in %s-form.\n", form_name);
+    writer->error = "Invalid bindings.";
+    return NULL;
+  }
+  int binding_count = bindings->type == VECTOR ? bindings->count : count(bindings);
+  if(binding_count % 2 != 0) {
+    printf("The bindings of a %s-form must come in pairs.\n", form_name);
+    writer->error = "Invalid bindings.";
+    return NULL;
+  }
+
+  for(int i = 0; i < binding_count; i += 2) {
+    Obj *symbol = binding_at(bindings, i);
+    if(symbol->type != SYMBOL) {
+      printf("Can't bind non-symbol in %s-form: ", form_name);
+      print_obj(symbol);
+      printf("\n");
+      writer->error = "Invalid bindings.";
+      return NULL;
+    }
+    int slot = scope_size(scope);
+    if(slot >= MAX_SLOTS) {
+      printf("Too many args and locals, a function can't have more than %d.\n", MAX_SLOTS);
+      writer->error = "Too many locals.";
+      return NULL;
+    }
+    visit(writer, r, binding_at(bindings, i + 1), false, scope);
+    scope = scope_with(r, scope, symbol);
+    code_write_store_local(writer, slot);
+  }
+  return scope;
+}
+
+// Visits the forms of a body like 'do' does, an empty body gives nil.
+void visit_body(CodeWriter *writer, Runtime *r, Obj *body, bool tail_position, Obj *scope) {
+  if(!body || !body->car) {
+    code_write_push_constant(writer, r->nil);
+    return;
+  }
+  while(body && body->car) {
+    bool last_form = body->cdr == NULL || body->cdr->car == NULL;
+    visit(writer, r, body->car, last_form && tail_position, scope);
+    if(!last_form) {
+      code_write_pop(writer);
+    }
+    body = body->cdr;
+  }
+}
+
+// (let (a 1 b (+ a 1)) body...), nothing is allocated at runtime.
+void visit_let(CodeWriter *writer, Runtime *r, Obj *form, bool tail_position, Obj *scope) {
+  scope = visit_bindings(writer, r, form->cdr ? form->cdr->car : NULL, scope, "let");
+  if(scope) {
+    visit_body(writer, r, form->cdr->cdr, tail_position, scope);
+  }
+}
+
+// (loop [i 0 acc 0] body...) binds like let, a 'recur' in tail position of the body stores
+// new values in the slots of the bindings and jumps back to the start of the body.
+void visit_loop(CodeWriter *writer, Runtime *r, Obj *form, bool tail_position, Obj *scope) {
+  int first_slot = scope_size(scope);
+  Obj *loop_scope = visit_bindings(writer, r, form->cdr ? form->cdr->car : NULL, scope, "loop");
+  if(!loop_scope) {
+    return;
+  }
+
+  int recur_pos = writer->recur_pos;
+  int recur_slot = writer->recur_slot;
+  int recur_count = writer->recur_count;
+  bool tail_calls_allowed = writer->tail_calls_allowed;
+
+  writer->recur_pos = writer->pos;
+  writer->recur_slot = first_slot;
+  writer->recur_count = scope_size(loop_scope) - first_slot;
+  // The body is always visited in tail position (for recur) but real tail calls
+  // are only allowed if the loop itself is in tail position
+  writer->tail_calls_allowed = tail_calls_allowed && tail_position;
+  visit_body(writer, r, form->cdr->cdr, true, loop_scope);
+
+  writer->recur_pos = recur_pos;
+  writer->recur_slot = recur_slot;
+  writer->recur_count = recur_count;
+  writer->tail_calls_allowed = tail_calls_allowed;
+}
+
+// Evaluates all the values first and then overwrites the slots, so that the values can depend on the old ones.
+// 'recur' jumps to the body of the innermost loop (or function), a self tail call to the start of the function.
+void visit_jump_back(CodeWriter *writer, Runtime *r, Obj *values, Obj *scope, int first_slot, int slot_count, int target_pos) {
+  Obj *value = values;
+  while(value && value->car) {
+    visit(writer, r, value->car, false, scope);
+    value = value->cdr;
+  }
+  for(int i = slot_count - 1; i >= 0; i--) {
+    code_write_store_local(writer, first_slot + i);
+  }
+  code_write_jump_back(writer, target_pos);
+}
+
+void visit_recur(CodeWriter *writer, Runtime *r, Obj *form, bool tail_position, Obj *scope) {
+  if(writer->recur_pos < 0) {
+    printf("Can't use recur outside of a loop or function.\n");
+    writer->error = "Invalid recur.";
+    return;
+  }
+  if(!tail_position) {
+    printf("Can only use recur in tail position.\n");
+    writer->error = "Invalid recur.";
+    return;
+  }
+  int value_count = count(form->cdr);
+  if(value_count != writer->recur_count) {
+    printf("Can't recur with %d values (should be %d).\n", value_count, writer->recur_count);
+    writer->error = "Invalid recur.";
+    return;
+  }
+  visit_jump_back(writer, r, form->cdr, scope, writer->recur_slot, writer->recur_count, writer->recur_pos);
+}
+
+// A call to the function itself in tail position can reuse the frame, unless the name is shadowed by a local.
+// Note that this assumes that the global binding isn't changed to another function while it runs.
+bool is_self_tail_call(CodeWriter *writer, Obj *form, bool tail_position, Obj *scope) {
+  return (tail_position &&
+	  writer->tail_calls_allowed &&
+	  writer->self_name &&
+	  form->car->type == SYMBOL &&
+	  eq(form->car, writer->self_name) &&
+	  find_arg_index_in_arglist(scope, form->car) == -1 &&
+	  count(form->cdr) == writer->arg_count);
+}
+
+
+typedef struct {
+  CodeWriter *writer;
+  Runtime *r;
+  Obj *args;
+  bool constant;
+} MapLiteral;
+
+void visit_fn(CodeWriter *writer, Runtime *r, Obj *form, Obj *scope, Obj *self_name) {
+  Obj *arg_symbols = SECOND(form);
+  Obj *body = THIRD(form);
+  code_write_push_lambda(writer, arg_symbols, body, scope ? scope : r->nil, self_name ? self_name : r->nil);
+}
+
+// Returns the (lambda . rest) of the macro that the form calls, locals shadow macros.
+Obj *find_macro(Runtime *r, Obj *form, Obj *scope) {
+  if(form->car->type != SYMBOL || find_arg_index_in_arglist(scope, form->car) > -1) {
+    return NULL;
+  }
+  Obj *pair = runtime_env_find_or_inherit_pair(r, r->macros, form->car);
+  return pair ? pair->cdr : NULL;
+}
+
+// Runs the macro with the unevaluated args of the form. Returns NULL (and sets the error) if it fails.
+Obj *expand_macro(CodeWriter *writer, Runtime *r, Obj *form, Obj *macro) {
+  if(r->macro_deps) {
+    macro_deps_add(r->macro_deps, form->car->name, macro_hash(macro));
+  }
+
+  Obj *cached = expansion_cache_get(&r->expansions, form);
+  if(cached && cached->car == macro) {
+    return cached->cdr;
+  }
+
+  Obj *lambda = macro->car;
+  bool rest = macro->cdr != r->nil;
+  int param_count = count(GET_ARGS(lambda));
+  int fixed_count = rest ? param_count - 1 : param_count;
+  if(param_count > MAX_SLOTS) {
+    printf("Can't expand macro '%s', it has more than %d args.\n", form->car->name, MAX_SLOTS);
+    writer->error = "Invalid macro.";
+    return NULL;
+  }
+  int form_count = count(form->cdr);
+  if(form_count < fixed_count || (!rest && form_count > fixed_count)) {
+    printf("Can't expand macro '%s' with %d args (should be %s%d).\n", form->car->name, form_count, rest ? "at least " : "", fixed_count);
+    writer->error = "Invalid macro call.";
+    return NULL;
+  }
+
+  Obj *call_args[MAX_SLOTS];
+  Obj *arg = form->cdr;
+  for(int i = 0; i < fixed_count; i++) {
+    call_args[i] = arg->car;
+    arg = arg->cdr;
+  }
+  if(rest) {
+    call_args[fixed_count] = arg; // the remaining args as a list
+  }
+
+  Obj *expansion = runtime_call(r, lambda, call_args, param_count);
+  if(!expansion) {
+    printf("Failed to expand macro '%s'.\n", form->car->name);
+    writer->error = "Failed to expand macro.";
+    return NULL;
+  }
+  expansion = lazy_realize_all(r, expansion); // the compiler only walks plain lists
+  expansion_cache_put(&r->expansions, form, gc_make_cons(r->gc, macro, expansion));
+  return expansion;
+}
+
+// (defmacro name (a b & rest) body), the macro is defined when the code runs so that it works with the code cache too.
+void visit_defmacro(CodeWriter *writer, Runtime *r, Obj *form) {
+  if(count(form->cdr) != 3 || SECOND(form)->type != SYMBOL) {
+    printf("A macro needs a name, a list of args and a body.\n");
+    writer->error = "Invalid defmacro.";
+    return;
+  }
+  Obj *name = SECOND(form);
+  Obj *params = THIRD(form);
+  Obj *body = FOURTH(form);
+
+  // The '&' is removed from the args, a flag telling if there was one is passed along instead
+  Obj *arg_symbols = r->nil;
+  Obj *last_cons = NULL;
+  bool rest = false;
+  int param_count = 0;
+  for(Obj *param = params; param && param->car; param = param->cdr) {
+    if(param->car->type == SYMBOL && strcmp(param->car->name, "&") == 0) {
+      if(rest || !param->cdr || !param->cdr->car || (param->cdr->cdr && param->cdr->cdr->car)) {
+	printf("There must be exactly one arg after '&' in macro '%s'.\n", name->name);
+	writer->error = "Invalid defmacro.";
+	return;
+      }
+      rest = true;
+      continue;
+    }
+    Obj *new = gc_make_cons(r->gc, param->car, r->nil);
+    if(last_cons) {
+      last_cons->cdr = new;
+    } else {
+      arg_symbols = new;
+    }
+    last_cons = new;
+    param_count++;
+  }
+  if(param_count > MAX_SLOTS) {
+    printf("Macro '%s' has %d args, it can't have more than %d.\n", name->name, param_count, MAX_SLOTS);
+    writer->error = "Invalid defmacro.";
+    return;
+  }
+
+  code_write_push_lambda(writer, arg_symbols, body, r->nil, r->nil);
+  code_write_push_constant(writer, rest ? r->true_val : r->nil);
+  code_write_define_macro(writer, name);
+}
+
+#define INLINE_MAX_SIZE 16 // number of atoms and lists in the body
+#define INLINE_MAX_DEPTH 4 // inlined bodies within inlined bodies
+
+// True if the symbol refers to a local in one of the frames, which would be captured as a constant.
+bool is_captured_local(CodeWriter *writer, Runtime *r, Obj *symbol) {
+  for(int i = writer->ignore_frames ? -1 : r->top_frame; i >= 0; i--) {
+    if(find_arg_index_in_arglist(r->frames[i].arg_symbols, symbol) > -1) {
+      return true;
+    }
+  }
+  return false;
+}
+
+bool refers_to_global(CodeWriter *writer, Runtime *r, Obj *symbol, Obj *scope) {
+  return (find_arg_index_in_arglist(scope, symbol) == -1 &&
+	  !is_captured_local(writer, r, symbol) &&
+	  runtime_env_find_or_inherit_pair(r, r->global_env, symbol) != NULL);
+}
+
+// Only bodies made of constants, params, globals, calls, 'if' and 'do' are inlined. The globals must mean
+// the same thing at the call site (not be shadowed by its locals) and the function can't call itself.
+// Returns the size of the body, or -1 if it can't be inlined.
+int inline_body_size(CodeWriter *writer, Runtime *r, Obj *form, Obj *name, Obj *params, Obj *scope) {
+  if(form->type == NUMBER || form->type == STRING) {
+    return 1;
+  }
+  else if(form->type == SYMBOL) {
+    if(find_arg_index_in_arglist(params, form) > -1) {
+      return 1;
+    }
+    return (!eq(form, name) && refers_to_global(writer, r, form, scope)) ? 1 : -1;
+  }
+  else if(form->type != CONS || !form->car) {
+    return -1;
+  }
+
+  Obj *items = form;
+  Obj *head = form->car;
+  if(head->type == SYMBOL && find_arg_index_in_arglist(params, head) == -1) {
+    if(strcmp(head->name, "quote") == 0) {
+      return 1;
+    }
+    else if(strcmp(head->name, "if") == 0 || strcmp(head->name, "do") == 0) {
+      items = form->cdr;
+    }
+    else if(runtime_env_find_or_inherit_pair(r, r->macros, head)) {
+      return -1;
+    }
+  }
+
+  int size = 1;
+  for(Obj *item = items; item && item->car; item = item->cdr) {
+    int item_size = inline_body_size(writer, r, item->car, name, params, scope);
+    if(item_size < 0) {
+      return -1;
+    }
+    size += item_size;
+  }
+  return size;
+}
+
+// Special forms other than 'if' and 'do' are rejected by inline_body_size since they have no global binding.
+bool is_inlinable_call(CodeWriter *writer, Runtime *r, Obj *form, Obj *scope) {
+  if(!writer->inline_enabled ||
+     writer->inline_depth >= INLINE_MAX_DEPTH ||
+     form->car->type != SYMBOL ||
+     !refers_to_global(writer, r, form->car, scope)) {
+    return false;
+  }
+  Obj *lambda = runtime_env_find_or_inherit_pair(r, r->global_env, form->car)->cdr;
+  if(lambda->type != LAMBDA || GET_ENV(lambda)) {
+    return false; // not a lambda, or one that has captured locals that the body refers to
+  }
+  int param_count = count(GET_ARGS(lambda));
+  if(count(form->cdr) != param_count || scope_size(scope) + param_count > MAX_SLOTS) {
+    return false;
+  }
+  int size = inline_body_size(writer, r, GET_BODY(lambda), form->car, GET_ARGS(lambda), scope);
+  return size > -1 && size <= INLINE_MAX_SIZE;
+}
+
+// The args are stored in new local slots and the body of the function is compiled right here, with the
+// params bound to the slots. The binding is remembered so that the lambda can be recompiled if it changes.
+void visit_inlined_call(CodeWriter *writer, Runtime *r, Obj *form, bool tail_position, Obj *scope) {
+  Obj *binding_pair = runtime_env_find_or_inherit_pair(r, r->global_env, form->car);
+  Obj *lambda = binding_pair->cdr;
+
+  // All args are evaluated before any slot is written, since the args can use the same slots (for let etc.)
+  int first_slot = scope_size(scope);
+  int param_count = 0;
+  Obj *inline_scope = scope;
+  for(Obj *arg = form->cdr; arg && arg->car; arg = arg->cdr) {
+    visit(writer, r, arg->car, false, scope);
+    param_count++;
+  }
+  for(int i = param_count - 1; i >= 0; i--) {
+    code_write_store_local(writer, first_slot + i);
+  }
+  for(Obj *param = GET_ARGS(lambda); param && param->car; param = param->cdr) {
+    inline_scope = scope_with(r, inline_scope, param->car);
+  }
+
+  // Calls in the inlined body are never calls to the function being compiled
+  Obj *self_name = writer->self_name;
+  writer->self_name = NULL;
+  writer->inline_depth++;
+  visit(writer, r, GET_BODY(lambda), tail_position, inline_scope);
+  writer->inline_depth--;
+  writer->self_name = self_name;
+
+  writer->inlined = gc_make_cons(r->gc, binding_pair, writer->inlined ? writer->inlined : r->nil);
+}
+
+bool is_constant_literal(Obj *form) {
+  return form->type == NUMBER || form->type == STRING;
+}
+
+void check_constant_map_entry(Obj *key, Obj *value, void *data) {
+  MapLiteral *literal = data;
+  literal->constant = literal->constant && is_constant_literal(key) && is_constant_literal(value);
+}
+
+void visit_map_entry(Obj *key, Obj *value, void *data) {
+  MapLiteral *literal = data;
+  visit(literal->writer, literal->r, key, false, literal->args);
+  visit(literal->writer, literal->r, value, false, literal->args);
+}
+
 void visit(CodeWriter *writer, Runtime *r, Obj *form, bool tail_position, Obj *args) {
   /* printf("Visiting %s ", tail_position ? "tail position" : ""); */
   /* print_obj(form); */
@@ -40,22 +461,27 @@ void visit(CodeWriter *writer, Runtime *r, Obj *form, bool tail_position, Obj *a
     int arg_index = find_arg_index_in_arglist(args, form);
     if(arg_index > -1) {
       // Value is local to innermost function!
-      code_write_lookup_arg(writer, arg_index);
+      if(arg_index < writer->arg_count) {
+	code_write_lookup_arg(writer, arg_index);
+      } else {
+	code_write_load_local(writer, arg_index);
+      }
     }
     else {
-      // Search for an argument in the call stack (not in the global frame though)
-      for(int i = r->top_frame; i > 0; i--) {
+      // Search for an argument or local in the call stack (the top-level frames can have locals too)
+      for(int i = writer->ignore_frames ? -1 : r->top_frame; i >= 0; i--) {
       	Frame frame = r->frames[i];
       	int arg_index = find_arg_index_in_arglist(frame.arg_symbols, form);
       	if(arg_index > -1) {
       	  Obj *constant = frame.args[arg_index];
       	  code_write_push_constant(writer, constant);
+      	  writer->captured = true;
       	  return; // done searching, early return
       	}
       }
 
       // The symbol wasn't found in the arg list or in the enclosing scopes
-      Obj *binding_pair = runtime_env_find_pair(r->global_env, form);
+      Obj *binding_pair = runtime_env_find_or_inherit_pair(r, r->global_env, form);
     
       if(binding_pair) {
 	code_write_direct_lookup_var(writer, binding_pair); // Fast lookup of globals
@@ -69,16 +495,60 @@ void visit(CodeWriter *writer, Runtime *r, Obj *form, bool tail_position, Obj *a
   else if(form->type == NUMBER || form->type == STRING) {
     code_write_push_constant(writer, form);
   }
+  else if(form->type == VECTOR) {
+    bool constant = true;
+    for(int i = 0; i < form->count && constant; i++) {
+      constant = is_constant_literal(vector_nth(form, i));
+    }
+    if(constant) {
+      code_write_push_constant(writer, form); // literal data is shared, it's immutable anyway
+    }
+    else {
+      // [a b c] is compiled like (vector a b c)
+      for(int i = 0; i < form->count; i++) {
+	visit(writer, r, vector_nth(form, i), false, args);
+      }
+      visit(writer, r, gc_make_symbol(r->gc, "vector"), false, args);
+      code_write_call(writer, form->count);
+    }
+  }
+  else if(form->type == MAP) {
+    MapLiteral literal = { .writer = writer, .r = r, .args = args, .constant = true };
+    map_visit_entries(form, check_constant_map_entry, &literal);
+    if(literal.constant) {
+      code_write_push_constant(writer, form);
+    }
+    else {
+      // {k v} is compiled like (hash-map k v)
+      map_visit_entries(form, visit_map_entry, &literal);
+      visit(writer, r, gc_make_symbol(r->gc, "hash-map"), false, args);
+      code_write_call(writer, 2 * form->count);
+    }
+  }
   else if(form->type == CONS) {
     if(form->car == NULL || form->cdr == NULL) {
       code_write_push_constant(writer, r->nil);
     }
+    else if(find_macro(r, form, args)) {
+      Obj *expansion = expand_macro(writer, r, form, find_macro(r, form, args));
+      if(expansion) {
+	visit(writer, r, expansion, tail_position, args);
+      }
+    }
+    else if(is_symbol(form, "defmacro")) {
+      visit_defmacro(writer, r, form);
+    }
     else if(is_symbol(form, "def")) {
       Obj *symbol = SECOND(form);
       Obj *value = THIRD(form);
       // Pre-define the binding so that it can be found by recursive function calls etc.
-      runtime_env_assoc(r, r->global_env, symbol, r->nil);
-      visit(writer, r, value, tail_position, args);
+      // An existing binding keeps its value, the new one might be computed from it (or the form is being reloaded).
+      runtime_env_find_or_define_pair(r, r->global_env, symbol);
+      if(value->type == CONS && (is_symbol(value, "fn") || is_symbol(value, "λ"))) {
+	visit_fn(writer, r, value, args, symbol);
+      } else {
+	visit(writer, r, value, tail_position, args);
+      }
       code_write_define(writer, symbol);
     }
     else if(is_symbol(form, "quote")) {
@@ -110,15 +580,7 @@ void visit(CodeWriter *writer, Runtime *r, Obj *form, bool tail_position, Obj *a
       code_write_code(writer, EQ);
     }
     else if(is_symbol(form, "do")) {
-      Obj *subform = form->cdr;
-      while(subform && subform->car) {
-	bool last_form = subform->cdr == NULL || subform->cdr->car == NULL;
-	visit(writer, r, subform->car, last_form, args);
-	if(!last_form) {
-	  code_write_pop(writer); // pop value if form is not the last one
-	}
-	subform = subform->cdr;
-      }
+      visit_body(writer, r, form->cdr, tail_position, args);
     }
     else if(is_symbol(form, "if")) {
       Obj *expression = form->cdr->car;
@@ -144,36 +606,32 @@ void visit(CodeWriter *writer, Runtime *r, Obj *form, bool tail_position, Obj *a
       
       visit(writer, r, expression, false, args); // the result from this will be the branching value
 
-      int true_code_length;
-      Code *true_bytecode = compile(r, tail_position, true_branch, &true_code_length, args);
-
-      int false_code_length;
-      Code *false_bytecode = compile(r, tail_position, false_branch, &false_code_length, args);
-
-      code_write_if(writer); // this code will jump forward one step if value on the stack is true, otherwise it will jump two steps
-      
-      // Subtract one from the length for the END_OF_CODE statement that shouldn't go into the code.
-      // Add two for the following jump instruction that leads to the merging point.
-      false_code_length--;
-      code_write_jump(writer, false_code_length + 2);
-      memcpy(&writer->codes[writer->pos], false_bytecode, sizeof(Code*) * false_code_length);
-      writer->pos += false_code_length;
-
-      // Only subtract one for the END_OF_CODE statement of the branch, no extra statement to count for.
-      true_code_length--;
-      code_write_jump(writer, true_code_length);
-      memcpy(&writer->codes[writer->pos], true_bytecode, sizeof(Code*) * true_code_length);
-      writer->pos += true_code_length;
-
-      // Free the memory from the temporary blocks made with compile
-      free(true_bytecode);
-      free(false_bytecode);
+      // IF skips the first jump when the value is false, so the false branch comes first
+      code_write_if(writer);
+      int jump_to_true_branch = code_write_jump_placeholder(writer);
+      visit(writer, r, false_branch, tail_position, args);
+      int jump_to_merge = code_write_jump_placeholder(writer);
+      code_patch_jump(writer, jump_to_true_branch);
+      visit(writer, r, true_branch, tail_position, args);
+      code_patch_jump(writer, jump_to_merge);
+    }
+    else if(is_symbol(form, "let")) {
+      visit_let(writer, r, form, tail_position, args);
+    }
+    else if(is_symbol(form, "loop")) {
+      visit_loop(writer, r, form, tail_position, args);
+    }
+    else if(is_symbol(form, "recur")) {
+      visit_recur(writer, r, form, tail_position, args);
     }
     else if(is_symbol(form, "fn") || is_symbol(form, "λ")) {
-      Obj *arg_symbols = SECOND(form);
-      Obj *body = THIRD(form);
-      int arg_count = count(arg_symbols);
-      code_write_push_lambda(writer, arg_symbols, body);
+      visit_fn(writer, r, form, args, NULL);
+    }
+    else if(is_self_tail_call(writer, form, tail_position, args)) {
+      visit_jump_back(writer, r, form->cdr, args, 0, writer->arg_count, 0); // the bindings of enclosing loops run again
+    }
+    else if(is_inlinable_call(writer, r, form, args)) {
+      visit_inlined_call(writer, r, form, tail_position, args);
     }
     else {
       Obj *f = form->car;
@@ -186,7 +644,7 @@ void visit(CodeWriter *writer, Runtime *r, Obj *form, bool tail_position, Obj *a
       }
       visit(writer, r, f, false, args);
 
-      if(tail_position) {
+      if(tail_position && writer->tail_calls_allowed) {
 	code_write_tail_call(writer, caller_arg_count);
       } else {
 	code_write_call(writer, caller_arg_count);
@@ -204,6 +662,7 @@ void visit(CodeWriter *writer, Runtime *r, Obj *form, bool tail_position, Obj *a
 Code *compile(Runtime *r, bool tail_position, Obj *form, int *OUT_code_length, Obj *args) {
   CodeWriter writer;
   code_writer_init(&writer, 1024);
+  writer.arg_count = scope_size(args);
   visit(&writer, r, form, tail_position, args);
   code_write_end(&writer);
   if(OUT_code_length) {
@@ -217,6 +676,99 @@ Code *compile(Runtime *r, bool tail_position, Obj *form, int *OUT_code_length, O
   }
 }
 
+// The body of a lambda can jump back to its start for self tail calls and 'recur', the args are the first slots.
+Code *compile_lambda_code(Runtime *r, CodeWriter *writer, Obj *args, Obj *body, Obj *self_name, bool inline_enabled, bool ignore_frames) {
+  code_writer_init(writer, 1024);
+  writer->arg_count = scope_size(args);
+  writer->self_name = self_name;
+  writer->recur_pos = 0;
+  writer->recur_slot = 0;
+  writer->recur_count = writer->arg_count;
+  writer->inline_enabled = inline_enabled;
+  writer->ignore_frames = ignore_frames;
+  visit(writer, r, body, true, args);
+  code_write_end(writer);
+  if(writer->error) {
+    free(writer->codes);
+    return NULL;
+  } else {
+    return writer->codes;
+  }
+}
+
+void register_inlined(Runtime *r, CodeWriter *writer, Obj *lambda, Obj *self_name) {
+  for(Obj *pair = writer->inlined; pair && pair->car; pair = pair->cdr) {
+    inline_deps_add(&r->inline_deps, pair->car, lambda, self_name);
+  }
+}
+
+Obj *compile_lambda(Runtime *r, Obj *args, Obj *body, Obj *self_name) {
+  CodeWriter writer;
+  Code *code = compile_lambda_code(r, &writer, args, body, self_name, true, false);
+  if(code && writer.captured && writer.inlined) {
+    // A lambda with captured locals can't be recompiled later (the frames are gone), so don't inline anything
+    free(code);
+    code = compile_lambda_code(r, &writer, args, body, self_name, false, false);
+  }
+  if(!code) {
+    return NULL;
+  }
+  Obj *lambda = gc_make_lambda(r->gc, args, body, code);
+  if(writer.captured) {
+    GET_ENV(lambda) = r->true_val;
+  }
+  register_inlined(r, &writer, lambda, self_name);
+  return lambda;
+}
+
+// Recompiles the lambdas that have inlined the global, called when it is redefined.
+void compiler_invalidate_inlined(Runtime *r, Obj *binding_pair) {
+  int lambda_count = 0;
+  Obj **lambdas = malloc(sizeof(Obj*) * r->inline_deps.count);
+  Obj **self_names = malloc(sizeof(Obj*) * r->inline_deps.count);
+  for(int i = 0; i < r->inline_deps.count; i++) {
+    if(r->inline_deps.pairs[i] == binding_pair) {
+      lambdas[lambda_count] = r->inline_deps.lambdas[i];
+      self_names[lambda_count] = r->inline_deps.self_names[i];
+      lambda_count++;
+    }
+  }
+
+  for(int i = 0; i < lambda_count; i++) {
+    Obj *lambda = lambdas[i];
+    inline_deps_remove_lambda(&r->inline_deps, lambda);
+    CodeWriter writer;
+    Code *code = compile_lambda_code(r, &writer, GET_ARGS(lambda), GET_BODY(lambda), self_names[i], true, true);
+    if(!code) {
+      // Keep the old code, it's still better than nothing
+      printf("Failed to recompile function after redefinition of '%s'.\n", binding_pair->car->name);
+      continue;
+    }
+    // The old code might be running right now
+    r->retired_code = gc_make_cons(r->gc, lambda->cdr->cdr, r->retired_code);
+    lambda->cdr->cdr = gc_make_bytecode(r->gc, code);
+    register_inlined(r, &writer, lambda, self_names[i]);
+  }
+
+  free(lambdas);
+  free(self_names);
+}
+
+void compiler_remove_inlining(Runtime *r) {
+  while(r->inline_deps.count > 0) {
+    Obj *lambda = r->inline_deps.lambdas[0];
+    Obj *self_name = r->inline_deps.self_names[0];
+    inline_deps_remove_lambda(&r->inline_deps, lambda);
+    CodeWriter writer;
+    Code *code = compile_lambda_code(r, &writer, GET_ARGS(lambda), GET_BODY(lambda), self_name, false, true);
+    if(!code) {
+      continue; // the inlined code is still correct as long as the globals aren't redefined
+    }
+    r->retired_code = gc_make_cons(r->gc, lambda->cdr->cdr, r->retired_code);
+    lambda->cdr->cdr = gc_make_bytecode(r->gc, code);
+  }
+}
+
 void compile_and_print(const char *source) {
   Runtime *r = runtime_new(true);
   Obj *forms = parse(r->gc, source);
@@ -0,0 +1,102 @@
+#include "Deque.h"
+#include <stdlib.h>
+
+// Follows "Correct and Efficient Work-Stealing for Weak Memory Models" (Lê et al. 2013),
+// with the GCC atomic builtins on the plain fields.
+
+static DequeArray *deque_array_new(long capacity) {
+  DequeArray *a = malloc(sizeof(DequeArray));
+  a->items = malloc(sizeof(Obj*) * capacity);
+  a->capacity = capacity;
+  a->retired = NULL;
+  return a;
+}
+
+void deque_init(Deque *d, long capacity) {
+  d->top = 0;
+  d->bottom = 0;
+  d->array = deque_array_new(capacity);
+}
+
+void deque_free(Deque *d) {
+  DequeArray *a = d->array;
+  while(a) {
+    DequeArray *retired = a->retired;
+    free(a->items);
+    free(a);
+    a = retired;
+  }
+  d->array = NULL;
+}
+
+static Obj *deque_array_get(DequeArray *a, long i) {
+  return __atomic_load_n(&a->items[i & (a->capacity - 1)], __ATOMIC_RELAXED);
+}
+
+static void deque_array_put(DequeArray *a, long i, Obj *o) {
+  __atomic_store_n(&a->items[i & (a->capacity - 1)], o, __ATOMIC_RELAXED);
+}
+
+static DequeArray *deque_grow(Deque *d, DequeArray *a, long top, long bottom) {
+  DequeArray *bigger = deque_array_new(a->capacity * 2);
+  for(long i = top; i < bottom; i++) {
+    deque_array_put(bigger, i, deque_array_get(a, i));
+  }
+  bigger->retired = a;
+  __atomic_store_n(&d->array, bigger, __ATOMIC_RELEASE);
+  return bigger;
+}
+
+void deque_push(Deque *d, Obj *o) {
+  long b = __atomic_load_n(&d->bottom, __ATOMIC_RELAXED);
+  long t = __atomic_load_n(&d->top, __ATOMIC_ACQUIRE);
+  DequeArray *a = __atomic_load_n(&d->array, __ATOMIC_RELAXED);
+  if(b - t > a->capacity - 1) {
+    a = deque_grow(d, a, t, b);
+  }
+  deque_array_put(a, b, o);
+  __atomic_thread_fence(__ATOMIC_RELEASE);
+  __atomic_store_n(&d->bottom, b + 1, __ATOMIC_RELAXED);
+}
+
+Obj *deque_take(Deque *d) {
+  long b = __atomic_load_n(&d->bottom, __ATOMIC_RELAXED) - 1;
+  DequeArray *a = __atomic_load_n(&d->array, __ATOMIC_RELAXED);
+  __atomic_store_n(&d->bottom, b, __ATOMIC_RELAXED);
+  __atomic_thread_fence(__ATOMIC_SEQ_CST);
+  long t = __atomic_load_n(&d->top, __ATOMIC_RELAXED);
+  if(t > b) {
+    __atomic_store_n(&d->bottom, b + 1, __ATOMIC_RELAXED);
+    return NULL;
+  }
+  Obj *o = deque_array_get(a, b);
+  if(t == b) {
+    // The last item, a thief might be trying to steal it at the same time
+    if(!__atomic_compare_exchange_n(&d->top, &t, t + 1, false, __ATOMIC_SEQ_CST, __ATOMIC_RELAXED)) {
+      o = NULL;
+    }
+    __atomic_store_n(&d->bottom, b + 1, __ATOMIC_RELAXED);
+  }
+  return o;
+}
+
+Obj *deque_steal(Deque *d) {
+  long t = __atomic_load_n(&d->top, __ATOMIC_ACQUIRE);
+  __atomic_thread_fence(__ATOMIC_SEQ_CST);
+  long b = __atomic_load_n(&d->bottom, __ATOMIC_ACQUIRE);
+  if(t >= b) {
+    return NULL;
+  }
+  DequeArray *a = __atomic_load_n(&d->array, __ATOMIC_ACQUIRE);
+  Obj *o = deque_array_get(a, t);
+  if(!__atomic_compare_exchange_n(&d->top, &t, t + 1, false, __ATOMIC_SEQ_CST, __ATOMIC_RELAXED)) {
+    return NULL;
+  }
+  return o;
+}
+
+bool deque_is_empty(Deque *d) {
+  long t = __atomic_load_n(&d->top, __ATOMIC_ACQUIRE);
+  long b = __atomic_load_n(&d->bottom, __ATOMIC_ACQUIRE);
+  return t >= b;
+}
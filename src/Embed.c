@@ -0,0 +1,189 @@
+#include "Embed.h"
+#include "Compiler.h"
+#include "Lazy.h"
+#include "Vector.h"
+#include "Map.h"
+#include <setjmp.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Compares the names directly instead of making a symbol to look for.
+// The env of a runtime made from a code heap has a parent, the frozen globals.
+static Obj *find_global_pair(Runtime *r, const char *name) {
+  for(Obj *env = r->global_env; env; env = env->cdr) {
+    for(Obj *current = env->car; current->car; current = current->cdr) {
+      Obj *key = current->car->car;
+      if(key->type == SYMBOL && strcmp(key->name, name) == 0) {
+	return current->car;
+      }
+    }
+  }
+  return NULL;
+}
+
+Obj *embed_lookup(Runtime *r, const char *name) {
+  Obj *pair = find_global_pair(r, name);
+  return pair ? pair->cdr : NULL;
+}
+
+// Like the DEFINE instruction, code that has inlined the old definition is recompiled
+void embed_define(Runtime *r, const char *name, Obj *value) {
+  gc_stack_push(r->gc, value);
+  Obj *sym = gc_make_symbol(r->gc, name);
+  Obj *binding_pair = runtime_env_find_or_define_pair(r, r->global_env, sym);
+  binding_pair->cdr = value;
+  if(r->inline_deps.count > 0) {
+    compiler_invalidate_inlined(r, binding_pair);
+  }
+  gc_stack_pop_safely(r->gc);
+}
+
+// Sets up an error handler around the call, the way 'eval_top_form_safely' does for top-level forms
+Obj *embed_call(Runtime *r, Obj *f, Obj *args[], int arg_count) {
+  int stack_size = r->gc->stackSize;
+  int top_frame = r->top_frame;
+  RuntimeMode mode = r->mode;
+  jmp_buf handler;
+  jmp_buf *outer_handler = r->gc->error.handler;
+  r->gc->error.handler = &handler;
+  Obj *result = NULL;
+  if(setjmp(handler) == 0) {
+    result = runtime_call(r, f, args, arg_count);
+  }
+  else {
+    r->gc->stackSize = stack_size;
+    r->top_frame = top_frame;
+    r->mode = mode;
+    result = NULL;
+  }
+  r->gc->error.handler = outer_handler;
+  port_flush(&r->out);
+  return result;
+}
+
+Obj *embed_call_global(Runtime *r, const char *name, Obj *args[], int arg_count) {
+  Obj *f = embed_lookup(r, name);
+  if(!f) {
+    printf("Can't call '%s', it's not defined.\n", name);
+    return NULL;
+  }
+  return embed_call(r, f, args, arg_count);
+}
+
+Obj *embed_nil(Runtime *r) {
+  return r->nil;
+}
+
+Obj *embed_bool(Runtime *r, bool b) {
+  return b ? r->true_val : r->nil;
+}
+
+Obj *embed_number(Runtime *r, double x) {
+  return gc_make_number(r->gc, x);
+}
+
+Obj *embed_string(Runtime *r, const char *text) {
+  return gc_make_string(r->gc, strdup(text));
+}
+
+Obj *embed_symbol(Runtime *r, const char *name) {
+  return gc_make_symbol(r->gc, name);
+}
+
+Obj *embed_list(Runtime *r, Obj *items[], int item_count) {
+  return make_list(r->gc, items, item_count);
+}
+
+Obj *embed_vector(Runtime *r, Obj *items[], int item_count) {
+  return vector_from_array(r->gc, items, item_count);
+}
+
+Obj *embed_map(Runtime *r, Obj *items[], int item_count) {
+  return map_from_array(r->gc, items, item_count);
+}
+
+bool embed_is_true(Runtime *r, Obj *o) {
+  return !eq(o, r->nil);
+}
+
+bool embed_to_number(Obj *o, double *x) {
+  if(o->type != NUMBER) {
+    return false;
+  }
+  *x = o->number;
+  return true;
+}
+
+const char *embed_to_string(Obj *o) {
+  return o->type == STRING || o->type == SYMBOL ? o->name : NULL;
+}
+
+int embed_count(Runtime *r, Obj *o) {
+  if(o->type == VECTOR || o->type == MAP || o->type == ARRAY) {
+    return o->count;
+  }
+  if(o->type != CONS && o->type != LAZY_SEQ) {
+    return -1;
+  }
+  gc_stack_push(r->gc, o);
+  int n = 0;
+  for(Obj *list = lazy_force(r, o); list->type == CONS && list->car; list = lazy_force(r, list->cdr)) {
+    n++;
+  }
+  gc_stack_pop_safely(r->gc);
+  return n;
+}
+
+Obj *embed_nth(Runtime *r, Obj *o, int index) {
+  if(index < 0) {
+    return NULL;
+  }
+  if(o->type == VECTOR) {
+    return index < o->count ? vector_nth(o, index) : NULL;
+  }
+  if(o->type != CONS && o->type != LAZY_SEQ) {
+    return NULL;
+  }
+  gc_stack_push(r->gc, o);
+  Obj *list = lazy_force(r, o);
+  for(int i = 0; i < index && list->type == CONS && list->car; i++) {
+    list = lazy_force(r, list->cdr);
+  }
+  gc_stack_pop_safely(r->gc);
+  return list->type == CONS && list->car ? list->car : NULL;
+}
+
+Obj *embed_get(Obj *map, Obj *key) {
+  return map->type == MAP ? map_get(map, key) : NULL;
+}
+
+Handle embed_retain(Runtime *r, Obj *o) {
+  Handle h;
+  if(r->free_handle_count > 0) {
+    h = r->free_handles[--r->free_handle_count];
+  }
+  else {
+    if(r->handle_count == r->handle_capacity) {
+      r->handle_capacity = r->handle_capacity ? r->handle_capacity * 2 : 16;
+      r->handles = realloc(r->handles, sizeof(Obj*) * r->handle_capacity);
+      r->free_handles = realloc(r->free_handles, sizeof(int) * r->handle_capacity);
+    }
+    h = r->handle_count++;
+  }
+  r->handles[h] = o;
+  return h;
+}
+
+Obj *embed_handle_get(Runtime *r, Handle h) {
+  return r->handles[h];
+}
+
+void embed_handle_set(Runtime *r, Handle h, Obj *o) {
+  r->handles[h] = o;
+}
+
+void embed_release(Runtime *r, Handle h) {
+  r->handles[h] = NULL;
+  r->free_handles[r->free_handle_count++] = h;
+}
@@ -3,7 +3,11 @@
 #include <stdio.h>
 #include <stdlib.h>
 
-void error(const char *message) {
+void error(ErrorState *state, const char *message) {
   printf("ERROR: %s\n", message);
+  state->message = message;
+  if(state->handler) {
+    longjmp(*state->handler, 1);
+  }
   exit(1);
 }
@@ -1,21 +1,21 @@
 #include "GC.h"
+#include "Array.h"
+#include "Deque.h"
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdbool.h>
 #include <string.h>
 #include <assert.h>
+#include <pthread.h>
+#include <sched.h>
 
 #define LOG 0
 #define LOG_DETAILED_OBJ_CREATION 0
 #define LOG_GC_COLLECT_RESULT 1
 #define LOG_PUSH_AND_POP 0
 
-#if GLOBAL_OBJ_COUNT
-int g_obj_count = 0;
-#endif
-
 void gc_stack_push(GC *gc, Obj *o) {
-  if(gc->stackSize >= STACK_MAX) error("Stack overflow.");
+  if(gc->stackSize >= STACK_MAX) error(&gc->error, "Stack overflow.");
   gc->stack[gc->stackSize++] = o;
   #if LOG_PUSH_AND_POP
   obj_describe("Popped:", o);
@@ -23,7 +23,7 @@ void gc_stack_push(GC *gc, Obj *o) {
 }
 
 Obj *gc_stack_pop(GC *gc) {
-  if(gc->stackSize < 0) error("Stack underflow.");
+  if(gc->stackSize < 0) error(&gc->error, "Stack underflow.");
   Obj *o = gc->stack[--gc->stackSize];
   #if LOG_PUSH_AND_POP
   obj_describe("Popped:", o);
@@ -57,13 +57,53 @@ void gc_stack_print(GC *gc, bool show_bottom_frame) {
   printf("-------------------\n");
 }
 
-Obj *gc_make_obj(GC *gc, Type type) {
+// Puts the object first in the linked list of the last page, a full page is followed by a new one.
+// The pages of an unfinished lazy sweep are never added to, their unmarked objects are garbage.
+void gc_add_to_page(GC *gc, Obj *o) {
+  if(gc->page_count == 0 || gc->pages[gc->page_count - 1].count >= GC_PAGE_SIZE || gc->page_count <= gc->sweep_end) {
+    if(gc->page_count == gc->page_capacity) {
+      gc->page_capacity = gc->page_capacity ? gc->page_capacity * 2 : 16;
+      gc->pages = realloc(gc->pages, sizeof(GCPage) * gc->page_capacity);
+    }
+    gc->pages[gc->page_count++] = (GCPage){ .first = NULL, .last = NULL, .count = 0 };
+  }
+  GCPage *page = &gc->pages[gc->page_count - 1];
+  o->next = page->first;
+  if(!page->first) {
+    page->last = o;
+  }
+  page->first = o;
+  page->count++;
+
+  #if COUNT_OBJS
+  gc->obj_count++;
+  #endif
+}
+
+static void gc_sweep_next_page(GC *gc);
+
+// Reuses a reclaimed object if there is one, sweeping the next page of a lazy collection to find some.
+static Obj *gc_alloc_obj(GC *gc) {
+  while(!gc->free_objs && gc->sweep_cursor < gc->sweep_end) {
+    gc_sweep_next_page(gc);
+  }
+  if(gc->free_objs) {
+    Obj *o = gc->free_objs;
+    gc->free_objs = o->next;
+    gc->free_obj_count--;
+    return o;
+  }
   #if USE_MEMORY_POOL
-  Obj *o = pool_obj_get(gc->pool);
+  return pool_obj_get(gc->pool);
   #else
-  Obj *o = malloc(sizeof(Obj));
+  return malloc(sizeof(Obj));
   #endif
+}
+
+Obj *gc_make_obj(GC *gc, Type type) {
+  Obj *o = gc_alloc_obj(gc);
   o->reachable = false;
+  o->external = false;
   o->type = type;
   o->name = NULL;
 
@@ -71,14 +111,7 @@ Obj *gc_make_obj(GC *gc, Type type) {
   printf("Created obj %p of type %s.\n", o, type_to_str(o->type));
   #endif
   
-  // Put new object first in the linked list containing all objects:
-  o->next = gc->firstObj; 
-  gc->firstObj = o;
-
-  #if GLOBAL_OBJ_COUNT
-  g_obj_count++;
-  #endif
-  
+  gc_add_to_page(gc, o);
   return o;
 }
 
@@ -97,14 +130,19 @@ Obj *gc_make_cons(GC *gc, Obj *car, Obj *cdr) {
 }
 
 void set_name(Obj *o, const char *name) {
-  char *name_copy = calloc(strlen(name) + 1, sizeof(char));
-  strcpy(name_copy, name);
+  int length = strlen(name);
+  char *name_copy = malloc(length + 1);
+  memcpy(name_copy, name, length + 1);
   o->name = name_copy;
+  o->length = length;
+  o->hash = 0;
 }
 
 Obj *gc_make_symbol_from_malloced_string(GC *gc, char *name) {
   Obj *o = gc_make_obj(gc, SYMBOL);
   o->name = name;
+  o->length = strlen(name);
+  o->hash = 0;
   #if LOG_DETAILED_OBJ_CREATION
   printf("Created symbol '%s' from malloced string.\n", name);
   #endif
@@ -140,8 +178,14 @@ Obj *gc_make_number(GC *gc, double x) {
 }
 
 Obj *gc_make_string(GC *gc, char *text) {
+  return gc_make_string_with_length(gc, text, strlen(text));
+}
+
+Obj *gc_make_string_with_length(GC *gc, char *text, int length) {
   Obj *o = gc_make_obj(gc, STRING);
   o->name = text;
+  o->length = length;
+  o->hash = 0;
   #if LOG_DETAILED_OBJ_CREATION
   printf("Created string '%s'.\n", text);
   #endif
@@ -169,46 +213,209 @@ Obj *gc_make_lambda(GC *gc, Obj *args, Obj *body, Code *code) {
   return o;
 }
 
-void gc_obj_free(GC *gc, Obj *o) {
-  if(o->type == SYMBOL || o->type == STRING) {
-    o->car = NULL;
-    o->cdr = NULL;
-    free(o->name);
-  }
-  
+Obj *gc_make_vector(GC *gc, Obj *root, Obj *tail, int count, int shift) {
+  Obj *o = gc_make_obj(gc, VECTOR);
+  o->root = root;
+  o->tail = tail;
+  o->count = count;
+  o->shift = shift;
+  #if LOG_DETAILED_OBJ_CREATION
+  printf("Created vector with %d items.\n", count);
+  #endif
+  return o;
+}
+
+Obj *gc_make_vector_node(GC *gc, int count) {
+  Obj *o = gc_make_obj(gc, VECTOR_NODE);
+  o->items = calloc(count, sizeof(Obj*));
+  o->count = count;
+  o->shift = 0;
+  return o;
+}
+
+Obj *gc_make_map(GC *gc, Obj *root, int count) {
+  Obj *o = gc_make_obj(gc, MAP);
+  o->root = root;
+  o->tail = NULL;
+  o->count = count;
+  o->map_hash = 0;
+  #if LOG_DETAILED_OBJ_CREATION
+  printf("Created map with %d entries.\n", count);
+  #endif
+  return o;
+}
+
+Obj *gc_make_map_node(GC *gc, int count, unsigned bitmap) {
+  Obj *o = gc_make_obj(gc, MAP_NODE);
+  o->items = calloc(count, sizeof(Obj*));
+  o->count = count;
+  o->bitmap = bitmap;
+  return o;
+}
+
+Obj *gc_make_array(GC *gc, ArrayType type, int count) {
+  Obj *o = gc_make_array_from_buffer(gc, type, calloc(count ? count : 1, array_element_size(type)), count);
+  o->owns_data = true;
+  return o;
+}
+
+Obj *gc_make_array_from_buffer(GC *gc, ArrayType type, void *data, int count) {
+  Obj *o = gc_make_obj(gc, ARRAY);
+  o->data = data;
+  o->owner = NULL;
+  o->count = count;
+  o->element_type = type;
+  o->owns_data = false;
+  #if LOG_DETAILED_OBJ_CREATION
+  printf("Created %s array with %d items.\n", array_type_to_str(type), count);
+  #endif
+  return o;
+}
+
+Obj *gc_make_lazy_seq(GC *gc, LazyKind kind, Obj *arg, Obj *seq) {
+  Obj *o = gc_make_obj(gc, LAZY_SEQ);
+  o->lazy_arg = arg;
+  o->lazy_seq = seq;
+  o->lazy_kind = kind;
+  #if LOG_DETAILED_OBJ_CREATION
+  printf("Created lazy seq.\n");
+  #endif
+  return o;
+}
+
+Obj *gc_make_xform(GC *gc, XformKind kind, Obj *arg) {
+  Obj *o = gc_make_obj(gc, XFORM);
+  o->xform_arg = arg;
+  o->xform_kind = kind;
+  #if LOG_DETAILED_OBJ_CREATION
+  printf("Created xform.\n");
+  #endif
+  return o;
+}
+
+static void gc_free_shell(GC *gc, Obj *o) {
   #if USE_MEMORY_POOL
   pool_obj_return(gc->pool, o);
   #else
   free(o);
   #endif
-  
-  #if GLOBAL_OBJ_COUNT
-  g_obj_count--;
-  #endif
 }
 
-void mark(Obj *o) {
+// Frees what the object owns, the object itself is kept for reuse if 'reuse' is set and there is room for it.
+void gc_obj_free(GC *gc, Obj *o, bool reuse) {
+  if(o->external) {
+    // Lives in a mapped image together with its name, the whole image is unmapped when the runtime is deleted
+    return;
+  }
+
+  if(o->type == SYMBOL || o->type == STRING) {
+    o->car = NULL;
+    o->cdr = NULL;
+    free(o->name);
+  }
+  else if(o->type == VECTOR_NODE || o->type == MAP_NODE) {
+    free(o->items);
+  }
+  else if(o->type == ARRAY && o->owns_data) {
+    free(o->data);
+  }
+
+  if(reuse && gc->free_obj_count < GC_PAGE_SIZE) {
+    o->next = gc->free_objs;
+    gc->free_objs = o;
+    gc->free_obj_count++;
+  }
+  else {
+    gc_free_shell(gc, o);
+  }
+}
+
+typedef struct {
+  Obj **items;
+  int count;
+  int capacity;
+} RootBuffer;
+
+// Set while the parallel marker gathers the roots, 'gc_mark' then only records them
+static __thread RootBuffer *gathered_roots = NULL;
+
+static void root_buffer_add(RootBuffer *roots, Obj *o) {
+  if(roots->count == roots->capacity) {
+    roots->capacity = roots->capacity ? roots->capacity * 2 : 256;
+    roots->items = realloc(roots->items, sizeof(Obj*) * roots->capacity);
+  }
+  roots->items[roots->count++] = o;
+}
+
+void gc_mark(Obj *o) {
+  if(gathered_roots) {
+    root_buffer_add(gathered_roots, o);
+    return;
+  }
+
   #if LOG
-  printf("Marking %p, %s as reachable: ", o, obj_to_str(o));
+  printf("Marking %p, %s as reachable: ", o, type_to_str(o->type));
   print_obj(o);
   printf("\n");
   #endif
   
   if(o->reachable) {
-    // This one has already been visited by mark(), return to avoid infinite loops
+    // This one has already been visited by gc_mark(), return to avoid infinite loops
     return;
   }
   
   o->reachable = true;
   
-  if (o->type == CONS || o->type == LAMBDA) {
-    if(o->car) {
-      mark(o->car);
+  if (o->type == CONS || o->type == LAMBDA || o->type == LAZY_SEQ) {
+    // Follow the cdr:s in a loop, recursing on them would overflow the C stack for long lists.
+    // The chunks of a lazy seq are linked through realized LAZY_SEQs, so those are followed too.
+    Obj *cons = o;
+    while(true) {
+      if(cons->type == LAZY_SEQ) {
+	if(cons->lazy_arg) {
+	  gc_mark(cons->lazy_arg);
+	}
+	cons = cons->lazy_seq;
+      }
+      else {
+	if(cons->car) {
+	  gc_mark(cons->car);
+	}
+	cons = cons->cdr;
+      }
+      if(!cons || cons->reachable || (cons->type != CONS && cons->type != LAZY_SEQ)) {
+	break;
+      }
+      cons->reachable = true;
+    }
+    if(cons) {
+      gc_mark(cons);
+    }
+  }
+  else if(o->type == VECTOR || o->type == MAP) {
+    if(o->root) {
+      gc_mark(o->root);
+    }
+    if(o->tail) {
+      gc_mark(o->tail);
+    }
+  }
+  else if(o->type == VECTOR_NODE || o->type == MAP_NODE) {
+    for(int i = 0; i < o->count; i++) {
+      if(o->items[i]) {
+	gc_mark(o->items[i]);
+      }
     }
-    if(o->cdr) {
-      mark(o->cdr);
+  }
+  else if(o->type == ARRAY) {
+    // The packed numbers contain no references, only the owner of a slice has to be kept alive
+    if(o->owner) {
+      gc_mark(o->owner);
     }
   }
+  else if(o->type == XFORM) {
+    gc_mark(o->xform_arg);
+  }
   else if(o->type == BYTECODE) {
     Code *code = (Code*)o->code;
     while(*code != END_OF_CODES) {
@@ -216,22 +423,20 @@ void mark(Obj *o) {
 	code += 1;
 	Obj **oo = (Obj**)code;
 	Obj *inner_o = *oo;
-	mark(inner_o);
+	gc_mark(inner_o);
 	code += 2;
       }
       else if(pushes_int(*code)) {
 	code += 2;
       }
-      else if(*code == PUSH_LAMBDA) {
+      else if(code_obj_operand_count(*code) > 0) {
+	int operand_count = code_obj_operand_count(*code);
 	code += 1;
-	Obj **oo1 = (Obj**)code;
-	Obj *arg_o = *oo1;
-	mark(arg_o);
-	code += 2;
-	Obj **oo2 = (Obj**)code;
-	Obj *body_o = *oo2;
-	mark(body_o);
-	code += 2;
+	for(int i = 0; i < operand_count; i++) {
+	  Obj **oo = (Obj**)code;
+	  gc_mark(*oo);
+	  code += 2;
+	}
       }
       else {
 	code++;
@@ -243,8 +448,24 @@ void mark(Obj *o) {
 GC *gc_new() {
   GC *gc = malloc(sizeof(GC));
   gc->stackSize = 0;
-  gc->firstObj = NULL;
+  gc->pages = NULL;
+  gc->page_count = 0;
+  gc->page_capacity = 0;
+  gc->sweep_cursor = 0;
+  gc->sweep_end = 0;
+  gc->sweep_result = (GCResult){ .alive = 0, .freed = 0 };
+  gc->free_objs = NULL;
+  gc->free_obj_count = 0;
+  gc->thread_count = 1;
+  #if COUNT_OBJS
+  gc->obj_count = 0;
+  #endif
   gc->nil = gc_make_cons(gc, NULL, NULL);
+  gc->mark_extra_roots = NULL;
+  gc->mark_weak_refs = NULL;
+  gc->extra_roots_data = NULL;
+  gc->error.handler = NULL;
+  gc->error.message = NULL;
 
 #if USE_MEMORY_POOL
   gc->pool = pool_new(0);
@@ -253,25 +474,152 @@ GC *gc_new() {
   return gc;
 }
 
-GCResult gc_collect(GC *gc) {
+void gc_set_thread_count(GC *gc, int thread_count) {
+  gc->thread_count = thread_count < 1 ? 1 : (thread_count > GC_MAX_THREADS ? GC_MAX_THREADS : thread_count);
+}
+
+// Parallel marking: every worker has a deque of objects that it has claimed (by being the one to set their
+// mark bit) but not scanned yet. A worker that runs out of objects steals from the others.
+
+typedef struct sMarkers Markers;
+
+typedef struct {
+  Deque deque;
+  Markers *markers;
+  int index;
+} MarkWorker;
+
+struct sMarkers {
+  MarkWorker workers[GC_MAX_THREADS];
+  int count;
+  int idle; // workers that are out of work, marking is done when all of them are
+  Obj **roots;
+  int root_count;
+};
+
+static bool try_claim(Obj *o) {
+  return !__atomic_load_n(&o->reachable, __ATOMIC_RELAXED) && !__atomic_exchange_n(&o->reachable, true, __ATOMIC_RELAXED);
+}
+
+static void claim_ref(Obj **ref, void *data) {
+  MarkWorker *worker = data;
+  if(*ref && try_claim(*ref)) {
+    deque_push(&worker->deque, *ref);
+  }
+}
+
+static Obj *find_work(MarkWorker *worker) {
+  Obj *o = deque_take(&worker->deque);
+  Markers *markers = worker->markers;
+  for(int i = 1; !o && i < markers->count; i++) {
+    o = deque_steal(&markers->workers[(worker->index + i) % markers->count].deque);
+  }
+  return o;
+}
+
+static bool any_work_left(Markers *markers) {
+  for(int i = 0; i < markers->count; i++) {
+    if(!deque_is_empty(&markers->workers[i].deque)) {
+      return true;
+    }
+  }
+  return false;
+}
+
+static void *mark_worker_run(void *data) {
+  MarkWorker *worker = data;
+  Markers *markers = worker->markers;
+  for(int i = worker->index; i < markers->root_count; i += markers->count) {
+    claim_ref(&markers->roots[i], worker);
+  }
+  while(true) {
+    Obj *o = find_work(worker);
+    if(o) {
+      obj_visit_refs(o, claim_ref, worker);
+      continue;
+    }
+    // Only a worker that has work can make more of it, so once every worker is idle the marking is done
+    __atomic_add_fetch(&markers->idle, 1, __ATOMIC_SEQ_CST);
+    while(true) {
+      if(__atomic_load_n(&markers->idle, __ATOMIC_SEQ_CST) == markers->count) {
+	return NULL;
+      }
+      if(any_work_left(markers)) {
+	__atomic_sub_fetch(&markers->idle, 1, __ATOMIC_SEQ_CST);
+	break;
+      }
+      sched_yield();
+    }
+  }
+}
+
+static void gc_mark_parallel(GC *gc) {
+  RootBuffer roots = { .items = NULL, .count = 0, .capacity = 0 };
+  for(int i = 0; i < gc->stackSize; i++) {
+    root_buffer_add(&roots, gc->stack[i]);
+  }
+  if(gc->nil) {
+    root_buffer_add(&roots, gc->nil);
+  }
+  if(gc->mark_extra_roots) {
+    gathered_roots = &roots;
+    gc->mark_extra_roots(gc->extra_roots_data);
+    gathered_roots = NULL;
+  }
+
+  Markers *markers = malloc(sizeof(Markers));
+  markers->count = gc->thread_count;
+  markers->idle = 0;
+  markers->roots = roots.items;
+  markers->root_count = roots.count;
+  for(int i = 0; i < markers->count; i++) {
+    MarkWorker *worker = &markers->workers[i];
+    deque_init(&worker->deque, 1024);
+    worker->markers = markers;
+    worker->index = i;
+  }
+
+  // The collecting thread is worker 0
+  pthread_t threads[GC_MAX_THREADS];
+  for(int i = 1; i < markers->count; i++) {
+    pthread_create(&threads[i], NULL, mark_worker_run, &markers->workers[i]);
+  }
+  mark_worker_run(&markers->workers[0]);
+  for(int i = 1; i < markers->count; i++) {
+    pthread_join(threads[i], NULL);
+  }
+
+  for(int i = 0; i < markers->count; i++) {
+    deque_free(&markers->workers[i].deque);
+  }
+  free(markers);
+  free(roots.items);
+}
+
+static void gc_mark_serial(GC *gc) {
   // Objects on the stack are all 'roots', i.e. they get automatically marked
   for (int i = 0; i < gc->stackSize; i++) {
-    mark(gc->stack[i]);
+    gc_mark(gc->stack[i]);
   }
 
   // Mark nil so that it doesn't get GC:d accidentally
-  mark(gc->nil);
+  if(gc->nil) {
+    gc_mark(gc->nil);
+  }
 
-  GCResult result = {
-    .alive = 0,
-    .freed = 0,
-  };
-  
-  // Sweep!
-  Obj** obj = &gc->firstObj;
+  // Roots that live outside of the GC, like the args and locals of the runtime's frames
+  if(gc->mark_extra_roots) {
+    gc->mark_extra_roots(gc->extra_roots_data);
+  }
+}
+
+static void gc_sweep_page(GC *gc, GCPage *page, GCResult *result, bool reuse) {
+  Obj** obj = &page->first;
+  page->last = NULL;
+  page->count = 0;
   while (*obj) {
     #if LOG
-    printf("Sweep visiting %p, %s. ", *obj, obj_to_str(*obj));
+    printf("Sweep visiting %p, %s. ", *obj, type_to_str((*obj)->type));
     #endif
     
     if ((*obj)->reachable) {
@@ -281,27 +629,138 @@ GCResult gc_collect(GC *gc) {
       Obj* reached = *obj;
       reached->reachable = false; // reached this time, unmark it for future sweeps
       obj = &(reached->next); // pointer to the next object
-      result.alive++;
+      page->last = reached;
+      page->count++;
+      result->alive++;
     } else {
       #if LOG
       printf("Will free object.\n");
       #endif      
       Obj* unreached = *obj;
       *obj = unreached->next; // change the pointer in place, *THE MAGIC*
-      gc_obj_free(gc, unreached);
-      result.freed++;
+      gc_obj_free(gc, unreached, reuse);
+      result->freed++;
     }
   }
+}
+
+typedef struct {
+  GC *gc;
+  int next_page; // the pages are handed out one at a time
+  GCResult result;
+  bool reuse; // only a single sweeper can hand objects to the allocator
+} Sweepers;
+
+static void *sweep_worker_run(void *data) {
+  Sweepers *sweepers = data;
+  GCResult result = { .alive = 0, .freed = 0 };
+  int i;
+  while((i = __atomic_fetch_add(&sweepers->next_page, 1, __ATOMIC_RELAXED)) < sweepers->gc->sweep_end) {
+    gc_sweep_page(sweepers->gc, &sweepers->gc->pages[i], &result, sweepers->reuse);
+  }
+  __atomic_add_fetch(&sweepers->result.alive, result.alive, __ATOMIC_RELAXED);
+  __atomic_add_fetch(&sweepers->result.freed, result.freed, __ATOMIC_RELAXED);
+  return NULL;
+}
+
+// Sweeps the pages that are left in one go.
+static GCResult gc_sweep(GC *gc) {
+  // The memory pool isn't thread safe
+  int thread_count = USE_MEMORY_POOL ? 1 : gc->thread_count;
+  Sweepers sweepers = { .gc = gc, .next_page = gc->sweep_cursor, .result = { .alive = 0, .freed = 0 }, .reuse = thread_count == 1 };
+  pthread_t threads[GC_MAX_THREADS];
+  for(int i = 1; i < thread_count; i++) {
+    pthread_create(&threads[i], NULL, sweep_worker_run, &sweepers);
+  }
+  sweep_worker_run(&sweepers);
+  for(int i = 1; i < thread_count; i++) {
+    pthread_join(threads[i], NULL);
+  }
+  return sweepers.result;
+}
+
+// Removes the empty pages and merges neighbours that fit in one page.
+static void gc_compact_pages(GC *gc) {
+  int kept = 0;
+  for(int i = 0; i < gc->page_count; i++) {
+    GCPage *page = &gc->pages[i];
+    if(page->count == 0) {
+      continue;
+    }
+    GCPage *previous = kept > 0 ? &gc->pages[kept - 1] : NULL;
+    if(previous && previous->count + page->count <= GC_PAGE_SIZE) {
+      previous->last->next = page->first;
+      previous->last = page->last;
+      previous->count += page->count;
+    }
+    else {
+      gc->pages[kept++] = *page;
+    }
+  }
+  gc->page_count = kept;
+}
+
+// Called once every page of the collection has been swept.
+static void gc_end_sweep(GC *gc) {
+  gc->sweep_cursor = 0;
+  gc->sweep_end = 0;
+  gc_compact_pages(gc);
+}
+
+static void gc_sweep_next_page(GC *gc) {
+  GCResult result = { .alive = 0, .freed = 0 };
+  gc_sweep_page(gc, &gc->pages[gc->sweep_cursor++], &result, true);
+  gc->sweep_result.alive += result.alive;
+  gc->sweep_result.freed += result.freed;
+  #if COUNT_OBJS
+  gc->obj_count -= result.freed;
+  #endif
+  if(gc->sweep_cursor == gc->sweep_end) {
+    gc_end_sweep(gc);
+  }
+}
+
+GCResult gc_finish_sweep(GC *gc) {
+  if(gc->sweep_cursor < gc->sweep_end) {
+    GCResult result = gc_sweep(gc);
+    gc->sweep_result.alive += result.alive;
+    gc->sweep_result.freed += result.freed;
+    #if COUNT_OBJS
+    gc->obj_count -= result.freed;
+    #endif
+    gc_end_sweep(gc);
+  }
+  return gc->sweep_result;
+}
+
+void gc_collect_lazily(GC *gc) {
+  // The marks of the previous collection are cleared by sweeping it
+  gc_finish_sweep(gc);
 
+  if(gc->thread_count > 1) {
+    gc_mark_parallel(gc);
+  }
+  else {
+    gc_mark_serial(gc);
+  }
+
+  if(gc->mark_weak_refs) {
+    gc->mark_weak_refs(gc->extra_roots_data);
+  }
+
+  // Everything allocated from now on goes into new pages
+  gc->sweep_cursor = 0;
+  gc->sweep_end = gc->page_count;
+  gc->sweep_result = (GCResult){ .alive = 0, .freed = 0 };
+}
+
+// Only an explicit collection logs its result, a lazy sweep finishes in the middle of allocating
+GCResult gc_collect(GC *gc) {
+  gc_collect_lazily(gc);
+  GCResult result = gc_finish_sweep(gc);
   #if LOG_GC_COLLECT_RESULT
   printf("Sweep done, %d objects freed and %d object still alive.\n", result.freed, result.alive);
-  /* Obj *first = gc->firstObj; */
-  /* while(first) { */
-  /*   print_obj(first); printf("\n"); */
-  /*   first = first->next; */
-  /* } */
   #endif
-
   return result;
 }
 
@@ -309,15 +768,29 @@ void gc_delete(GC *gc) {
   while(gc->stackSize >= 1) {
     gc_stack_pop(gc);
   }
+  gc->nil = NULL; // let nil be collected too
+  gc->mark_extra_roots = NULL;
+  gc->mark_weak_refs = NULL;
   gc_collect(gc);
 
-  #if GLOBAL_OBJ_COUNT
-  assert(g_obj_count == 0);
+  #if COUNT_OBJS
+  assert(gc->obj_count == 0);
   #endif
   
+  while(gc->free_objs) {
+    Obj *o = gc->free_objs;
+    gc->free_objs = o->next;
+    gc_free_shell(gc, o);
+  }
+  free(gc->pages);
   free(gc);
 }
 
+// Adds an object that was allocated somewhere else (like in a mapped image) to the list of objects.
+void gc_adopt_obj(GC *gc, Obj *o) {
+  gc_add_to_page(gc, o);
+}
+
 Obj *make_list(GC *gc, Obj *objs[], int obj_count) {
   Obj *l = gc->nil;
   for(int i = obj_count - 1; i >= 0; i--) {
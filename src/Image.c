@@ -0,0 +1,493 @@
+#include "Image.h"
+#include "Array.h"
+#include "Compiler.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#define IMAGE_MAGIC "PLI"
+#define IMAGE_VERSION 4
+
+typedef struct {
+  char magic[4];
+  int version;
+  int code_count; // END_OF_CODES, changes when codes are added
+  int obj_size;   // sizeof(Obj)
+  int obj_count;
+  int global_env; // indexes into the Obj array
+  int nil;
+  int true_val;
+  int macros;
+  size_t objs_offset;
+  size_t data_offset;
+  size_t data_size;
+} ImageHeader;
+
+// Maps Obj pointers to their index in the image.
+typedef struct {
+  Obj **keys;
+  int *indexes;
+  int capacity;
+  int count;
+} ObjIndex;
+
+void obj_index_init(ObjIndex *index) {
+  index->capacity = 1024;
+  index->count = 0;
+  index->keys = calloc(index->capacity, sizeof(Obj*));
+  index->indexes = malloc(sizeof(int) * index->capacity);
+}
+
+void obj_index_free(ObjIndex *index) {
+  free(index->keys);
+  free(index->indexes);
+}
+
+int obj_index_slot(ObjIndex *index, Obj *o) {
+  uintptr_t hash = ((uintptr_t)o >> 3) * 2654435761u;
+  int slot = hash & (index->capacity - 1);
+  while(index->keys[slot] && index->keys[slot] != o) {
+    slot = (slot + 1) & (index->capacity - 1);
+  }
+  return slot;
+}
+
+int obj_index_find(ObjIndex *index, Obj *o) {
+  int slot = obj_index_slot(index, o);
+  return index->keys[slot] ? index->indexes[slot] : -1;
+}
+
+void obj_index_add(ObjIndex *index, Obj *o, int i) {
+  if((index->count + 1) * 2 > index->capacity) {
+    Obj **old_keys = index->keys;
+    int *old_indexes = index->indexes;
+    int old_capacity = index->capacity;
+    index->capacity *= 2;
+    index->keys = calloc(index->capacity, sizeof(Obj*));
+    index->indexes = malloc(sizeof(int) * index->capacity);
+    for(int j = 0; j < old_capacity; j++) {
+      if(old_keys[j]) {
+	int slot = obj_index_slot(index, old_keys[j]);
+	index->keys[slot] = old_keys[j];
+	index->indexes[slot] = old_indexes[j];
+      }
+    }
+    free(old_keys);
+    free(old_indexes);
+  }
+  int slot = obj_index_slot(index, o);
+  index->keys[slot] = o;
+  index->indexes[slot] = i;
+  index->count++;
+}
+
+typedef struct {
+  ObjIndex index;
+  Obj **objs; // in the order they will be written
+  int obj_count;
+  int obj_capacity;
+} ImageWriter;
+
+void image_writer_add(Obj **ref, void *data) {
+  ImageWriter *w = data;
+  Obj *o = *ref;
+  if(obj_index_find(&w->index, o) >= 0) {
+    return;
+  }
+  if(w->obj_count == w->obj_capacity) {
+    w->obj_capacity *= 2;
+    w->objs = realloc(w->objs, sizeof(Obj*) * w->obj_capacity);
+  }
+  obj_index_add(&w->index, o, w->obj_count);
+  w->objs[w->obj_count++] = o;
+}
+
+int code_block_length(Code *code) {
+  Code *start = code;
+  while(*code != END_OF_CODES) {
+    Code c = *code;
+    code += 1 + code_obj_operand_count(c) * 2 + (pushes_int(c) ? 1 : 0);
+  }
+  return (int)(code - start) + 1;
+}
+
+size_t align8(size_t x) {
+  return (x + 7) & ~(size_t)7;
+}
+
+typedef struct {
+  ImageWriter *writer;
+  size_t objs_offset;
+} OffsetConverter;
+
+// Replaces a pointer with the file offset of the Obj it points to
+void image_writer_convert_ref(Obj **ref, void *data) {
+  OffsetConverter *c = data;
+  int i = obj_index_find(&c->writer->index, *ref);
+  *ref = (Obj*)(c->objs_offset + sizeof(Obj) * i);
+}
+
+// Walks everything reachable from the roots, 'objs' doubles as the work queue.
+// The global env, nil, true and the macros always come first, in that order.
+void image_writer_init(ImageWriter *w, Runtime *r) {
+  obj_index_init(&w->index);
+  w->obj_capacity = 1024;
+  w->obj_count = 0;
+  w->objs = malloc(sizeof(Obj*) * w->obj_capacity);
+
+  Obj *roots[] = { r->global_env, r->nil, r->true_val, r->macros };
+  for(int i = 0; i < 4; i++) {
+    image_writer_add(&roots[i], w);
+  }
+  for(int i = 0; i < w->obj_count; i++) {
+    obj_visit_refs(w->objs[i], image_writer_add, w);
+  }
+}
+
+void image_writer_free(ImageWriter *w) {
+  free(w->objs);
+  obj_index_free(&w->index);
+}
+
+// The size of the names, code blocks, node items and array data that follow the objects
+size_t image_data_size(ImageWriter *w) {
+  size_t data_size = 0;
+  for(int i = 0; i < w->obj_count; i++) {
+    Obj *o = w->objs[i];
+    if(o->type == SYMBOL || o->type == STRING) {
+      data_size = align8(data_size + o->length + 1);
+    }
+    else if(o->type == FUNC) {
+      data_size = align8(data_size + strlen(o->name) + 1);
+    }
+    else if(o->type == BYTECODE) {
+      data_size = align8(data_size + sizeof(Code) * code_block_length((Code*)o->code));
+    }
+    else if(o->type == VECTOR_NODE || o->type == MAP_NODE) {
+      data_size = align8(data_size + sizeof(Obj*) * o->count);
+    }
+    else if(o->type == ARRAY && !o->owner) {
+      data_size = align8(data_size + (size_t)o->count * array_element_size(o->element_type));
+    }
+  }
+  return data_size;
+}
+
+// Copies the objects into 'records' and what they point to into 'data'. The pointers are based at 'objs_base' and
+// 'data_base', which are file offsets in an image and the addresses of 'records' and 'data' in a code heap.
+void image_build(ImageWriter *w, Obj *records, char *data, size_t objs_base, size_t data_base) {
+  OffsetConverter converter = { .writer = w, .objs_offset = objs_base };
+  size_t data_pos = 0;
+  for(int i = 0; i < w->obj_count; i++) {
+    Obj *o = w->objs[i];
+    Obj *record = &records[i];
+    *record = *o;
+    record->next = NULL;
+    record->reachable = false;
+    record->external = true;
+
+    if(o->type == SYMBOL || o->type == STRING || o->type == FUNC) {
+      size_t length = (o->type == FUNC ? strlen(o->name) : o->length) + 1;
+      memcpy(data + data_pos, o->name, length);
+      record->name = (char*)(data_base + data_pos);
+      data_pos = align8(data_pos + length);
+      if(o->type == FUNC) {
+	record->func = NULL; // resolved by name when loading
+      }
+    }
+    else if(o->type == BYTECODE) {
+      // Every bytecode object gets its own copy of the code so that it's relocated exactly once
+      size_t size = sizeof(Code) * code_block_length((Code*)o->code);
+      memcpy(data + data_pos, o->code, size);
+      record->code = (enum eCode*)(data + data_pos);
+      obj_visit_refs(record, image_writer_convert_ref, &converter);
+      record->code = (enum eCode*)(data_base + data_pos);
+      data_pos = align8(data_pos + size);
+    }
+    else if(o->type == VECTOR_NODE || o->type == MAP_NODE) {
+      size_t size = sizeof(Obj*) * o->count;
+      memcpy(data + data_pos, o->items, size);
+      record->items = (Obj**)(data + data_pos);
+      obj_visit_refs(record, image_writer_convert_ref, &converter);
+      record->items = (Obj**)(data_base + data_pos);
+      data_pos = align8(data_pos + size);
+    }
+    else if(o->type == ARRAY && !o->owner) {
+      // The numbers are copied into the image (also for host buffers), the loaded array doesn't own them
+      size_t size = (size_t)o->count * array_element_size(o->element_type);
+      memcpy(data + data_pos, o->data, size);
+      record->data = (void*)(data_base + data_pos);
+      record->owns_data = false;
+      data_pos = align8(data_pos + size);
+    }
+    else {
+      obj_visit_refs(record, image_writer_convert_ref, &converter);
+    }
+  }
+
+  // Slices point into the data of their owner, which is known now that all owners have been written
+  for(int i = 0; i < w->obj_count; i++) {
+    Obj *o = w->objs[i];
+    if(o->type == ARRAY && o->owner) {
+      Obj *owner_record = &records[obj_index_find(&w->index, o->owner)];
+      records[i].data = (char*)owner_record->data + ((char*)o->data - (char*)o->owner->data);
+    }
+  }
+}
+
+bool image_save(Runtime *r, const char *path) {
+  ImageWriter w;
+  image_writer_init(&w, r);
+
+  ImageHeader header;
+  memset(&header, 0, sizeof(header));
+  memcpy(header.magic, IMAGE_MAGIC, sizeof(IMAGE_MAGIC));
+  header.version = IMAGE_VERSION;
+  header.code_count = END_OF_CODES;
+  header.obj_size = sizeof(Obj);
+  header.obj_count = w.obj_count;
+  header.global_env = 0;
+  header.nil = 1;
+  header.true_val = 2;
+  header.macros = 3;
+  header.objs_offset = align8(sizeof(ImageHeader));
+  header.data_offset = align8(header.objs_offset + sizeof(Obj) * w.obj_count);
+  header.data_size = image_data_size(&w);
+
+  // Names and code blocks go into the data section after the objects
+  Obj *records = calloc(w.obj_count, sizeof(Obj));
+  char *data = calloc(header.data_size ? header.data_size : 1, 1);
+  image_build(&w, records, data, header.objs_offset, header.data_offset);
+  size_t data_size = header.data_size;
+
+  bool ok = false;
+  FILE *f = fopen(path, "wb");
+  if(f) {
+    char padding[8] = {0};
+    ok = fwrite(&header, sizeof(header), 1, f) == 1 &&
+         fwrite(padding, 1, header.objs_offset - sizeof(header), f) == header.objs_offset - sizeof(header) &&
+         fwrite(records, sizeof(Obj), w.obj_count, f) == (size_t)w.obj_count &&
+         fwrite(padding, 1, header.data_offset - header.objs_offset - sizeof(Obj) * w.obj_count, f) ==
+           header.data_offset - header.objs_offset - sizeof(Obj) * w.obj_count &&
+         fwrite(data, 1, data_size, f) == data_size;
+    ok = (fclose(f) == 0) && ok;
+  }
+
+  free(records);
+  free(data);
+  image_writer_free(&w);
+  return ok;
+}
+
+void image_relocate_ref(Obj **ref, void *data) {
+  char *base = data;
+  *ref = (Obj*)(base + (uintptr_t)*ref);
+}
+
+Runtime *image_load(const char *path) {
+  int fd = open(path, O_RDONLY);
+  if(fd < 0) {
+    return NULL;
+  }
+  struct stat file_stat;
+  if(fstat(fd, &file_stat) < 0 || file_stat.st_size < (off_t)sizeof(ImageHeader)) {
+    close(fd);
+    return NULL;
+  }
+  size_t size = file_stat.st_size;
+
+  // A private mapping, the pages that get written to by relocation or mutation are copied on write
+  char *base = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if(base == MAP_FAILED) {
+    return NULL;
+  }
+
+  ImageHeader *header = (ImageHeader*)base;
+  if(memcmp(header->magic, IMAGE_MAGIC, sizeof(IMAGE_MAGIC)) != 0 ||
+     header->version != IMAGE_VERSION ||
+     header->code_count != END_OF_CODES ||
+     header->obj_size != sizeof(Obj) ||
+     header->data_offset + header->data_size > size ||
+     header->objs_offset + sizeof(Obj) * header->obj_count > size) {
+    printf("Can't use image '%s', it's broken or made by another version of Pilsner.\n", path);
+    munmap(base, size);
+    return NULL;
+  }
+
+  // The fresh runtime provides the primitive functions that FUNC objects are resolved against.
+  // Everything else in it will be garbage once the roots are replaced.
+  Runtime *r = runtime_new(true);
+
+  Obj *objs = (Obj*)(base + header->objs_offset);
+  for(int i = 0; i < header->obj_count; i++) {
+    Obj *o = &objs[i];
+    if(o->type == SYMBOL || o->type == STRING || o->type == FUNC) {
+      o->name = base + (uintptr_t)o->name;
+    }
+    if(o->type == FUNC) {
+      Obj *symbol = gc_make_symbol(r->gc, o->name);
+      Obj *binding_pair = runtime_env_find_pair(r->global_env, symbol);
+      if(!binding_pair || binding_pair->cdr->type != FUNC) {
+	printf("Can't find primitive function '%s' for image.\n", o->name);
+	o->func = NULL;
+      } else {
+	o->func = binding_pair->cdr->func;
+      }
+    }
+    else if(o->type == BYTECODE) {
+      o->code = (enum eCode*)(base + (uintptr_t)o->code);
+    }
+    else if(o->type == VECTOR_NODE || o->type == MAP_NODE) {
+      o->items = (Obj**)(base + (uintptr_t)o->items);
+    }
+    else if(o->type == ARRAY) {
+      o->data = base + (uintptr_t)o->data;
+    }
+    obj_visit_refs(o, image_relocate_ref, base);
+    gc_adopt_obj(r->gc, o);
+  }
+
+  r->global_env = &objs[header->global_env];
+  r->gc->stack[0] = r->global_env;
+  r->nil = &objs[header->nil];
+  r->gc->nil = r->nil;
+  r->true_val = &objs[header->true_val];
+  r->macros = &objs[header->macros];
+  r->image = base;
+  r->image_size = size;
+  return r;
+}
+
+struct sCodeHeap {
+  char *memory; // the objects followed by their data, read-only once it's built
+  size_t size;
+  Obj *global_env;
+  Obj *nil;
+  Obj *true_val;
+  Obj *macros;
+  Obj *objs;
+  int obj_count;
+  int *overlay_slots; // for each object, its slot in the overlay of a runtime if it's the binding pair of a global, else -1
+  int global_count;
+  int ref_count; // the creator and every runtime that uses the heap
+};
+
+CodeHeap *code_heap_new(Runtime *r) {
+  // Inlined bodies of globals can't be recompiled once they're frozen, but the globals can be redefined
+  compiler_remove_inlining(r);
+
+  ImageWriter w;
+  image_writer_init(&w, r);
+  for(int i = 0; i < w.obj_count; i++) {
+    Obj *o = w.objs[i];
+    if(o->type == ARRAY || (o->type == LAZY_SEQ && o->lazy_kind != LAZY_REALIZED)) {
+      printf("Can't freeze the globals, they refer to %s.\n", o->type == ARRAY ? "an array" : "a lazy seq that hasn't been realized");
+      image_writer_free(&w);
+      return NULL;
+    }
+  }
+
+  size_t objs_size = align8(sizeof(Obj) * w.obj_count);
+  size_t size = objs_size + image_data_size(&w);
+  char *memory = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if(memory == MAP_FAILED) {
+    image_writer_free(&w);
+    return NULL;
+  }
+  Obj *objs = (Obj*)memory;
+  image_build(&w, objs, memory + objs_size, (size_t)objs, (size_t)(memory + objs_size));
+
+  for(int i = 0; i < w.obj_count; i++) {
+    Obj *o = &objs[i];
+    if(o->type == FUNC) {
+      o->func = w.objs[i]->func; // the primitives are in the same process, no need to look them up by name
+    }
+    else if(o->type == CONS) {
+      // The realized lazy seqs are spliced out now, since 'lazy_realize_all' would do it by writing to the list
+      o->car = lazy_unwrap(o->car);
+      o->cdr = lazy_unwrap(o->cdr);
+    }
+  }
+  for(int i = 0; i < w.obj_count; i++) {
+    Obj *o = &objs[i];
+    if(o->type == SYMBOL || o->type == STRING || o->type == MAP) {
+      obj_hash(o); // cached in the object, so it has to happen before the memory is protected
+    }
+    o->reachable = true; // the GC of a runtime stops at frozen objects without writing to them
+  }
+  mprotect(memory, size, PROT_READ);
+
+  CodeHeap *heap = malloc(sizeof(CodeHeap));
+  heap->memory = memory;
+  heap->size = size;
+  heap->global_env = &objs[0];
+  heap->nil = &objs[1];
+  heap->true_val = &objs[2];
+  heap->macros = &objs[3];
+  heap->objs = objs;
+  heap->obj_count = w.obj_count;
+  heap->overlay_slots = malloc(sizeof(int) * w.obj_count);
+  for(int i = 0; i < w.obj_count; i++) {
+    heap->overlay_slots[i] = -1;
+  }
+  heap->global_count = 0;
+  for(Obj *binding = heap->global_env->car; binding->car; binding = binding->cdr) {
+    heap->overlay_slots[binding->car - objs] = heap->global_count++;
+  }
+  heap->ref_count = 1;
+  image_writer_free(&w);
+  return heap;
+}
+
+Runtime *code_heap_runtime_new(CodeHeap *heap) {
+  // The primitive functions are in the code heap, everything that the fresh runtime made will be garbage
+  Runtime *r = runtime_new(false);
+  code_heap_retain(heap);
+  r->code_heap = heap;
+  r->nil = heap->nil;
+  r->gc->nil = heap->nil;
+  r->true_val = heap->true_val;
+  r->retired_code = r->nil;
+  r->global_env = runtime_env_make_local(r, heap->global_env);
+  r->gc->stack[0] = r->global_env;
+  r->macros = runtime_env_make_local(r, heap->macros);
+  r->overlay = calloc(heap->global_count ? heap->global_count : 1, sizeof(Obj*));
+  return r;
+}
+
+Obj *code_heap_overlay(Runtime *r, Obj *frozen_pair) {
+  CodeHeap *heap = r->code_heap;
+  ptrdiff_t index = frozen_pair - heap->objs;
+  if(index < 0 || index >= heap->obj_count || heap->overlay_slots[index] < 0) {
+    return frozen_pair;
+  }
+  Obj *pair = r->overlay[heap->overlay_slots[index]];
+  return pair ? pair : frozen_pair;
+}
+
+void code_heap_set_overlay(Runtime *r, Obj *frozen_pair, Obj *pair) {
+  CodeHeap *heap = r->code_heap;
+  ptrdiff_t index = frozen_pair - heap->objs;
+  if(index >= 0 && index < heap->obj_count && heap->overlay_slots[index] >= 0) {
+    r->overlay[heap->overlay_slots[index]] = pair;
+  }
+}
+
+void code_heap_retain(CodeHeap *heap) {
+  __atomic_add_fetch(&heap->ref_count, 1, __ATOMIC_RELAXED);
+}
+
+void code_heap_release(CodeHeap *heap) {
+  if(__atomic_sub_fetch(&heap->ref_count, 1, __ATOMIC_ACQ_REL) == 0) {
+    munmap(heap->memory, heap->size);
+    free(heap->overlay_slots);
+    free(heap);
+  }
+}
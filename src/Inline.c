@@ -0,0 +1,62 @@
+#include "Inline.h"
+#include "GC.h"
+#include <stdlib.h>
+
+void inline_deps_init(InlineDeps *deps) {
+  deps->capacity = 16;
+  deps->count = 0;
+  deps->pairs = malloc(sizeof(Obj*) * deps->capacity);
+  deps->lambdas = malloc(sizeof(Obj*) * deps->capacity);
+  deps->self_names = malloc(sizeof(Obj*) * deps->capacity);
+}
+
+void inline_deps_free(InlineDeps *deps) {
+  free(deps->pairs);
+  free(deps->lambdas);
+  free(deps->self_names);
+}
+
+void inline_deps_add(InlineDeps *deps, Obj *binding_pair, Obj *lambda, Obj *self_name) {
+  for(int i = 0; i < deps->count; i++) {
+    if(deps->pairs[i] == binding_pair && deps->lambdas[i] == lambda) {
+      return; // the same function can be inlined at several call sites
+    }
+  }
+  if(deps->count == deps->capacity) {
+    deps->capacity *= 2;
+    deps->pairs = realloc(deps->pairs, sizeof(Obj*) * deps->capacity);
+    deps->lambdas = realloc(deps->lambdas, sizeof(Obj*) * deps->capacity);
+    deps->self_names = realloc(deps->self_names, sizeof(Obj*) * deps->capacity);
+  }
+  deps->pairs[deps->count] = binding_pair;
+  deps->lambdas[deps->count] = lambda;
+  deps->self_names[deps->count] = self_name;
+  deps->count++;
+}
+
+// Removes the entry at 'i' by moving the last one into its place.
+static void inline_deps_remove_at(InlineDeps *deps, int i) {
+  deps->count--;
+  deps->pairs[i] = deps->pairs[deps->count];
+  deps->lambdas[i] = deps->lambdas[deps->count];
+  deps->self_names[i] = deps->self_names[deps->count];
+}
+
+void inline_deps_remove_lambda(InlineDeps *deps, Obj *lambda) {
+  for(int i = deps->count - 1; i >= 0; i--) {
+    if(deps->lambdas[i] == lambda) {
+      inline_deps_remove_at(deps, i);
+    }
+  }
+}
+
+void inline_deps_mark(InlineDeps *deps) {
+  for(int i = deps->count - 1; i >= 0; i--) {
+    if(!deps->lambdas[i]->reachable || !deps->pairs[i]->reachable) {
+      inline_deps_remove_at(deps, i);
+    }
+    else if(deps->self_names[i]) {
+      gc_mark(deps->self_names[i]); // symbols have no references, so this can't make any lambda reachable
+    }
+  }
+}
@@ -0,0 +1,504 @@
+#include "Isolate.h"
+#include "Serialize.h"
+#include "Lazy.h"
+#include "Image.h"
+#include "Vector.h"
+#include "Map.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+
+// Every isolate that can receive messages, sending looks them up by id
+static pthread_mutex_t registry_lock = PTHREAD_MUTEX_INITIALIZER;
+static Isolate **registry = NULL;
+static int registry_count = 0;
+static int registry_capacity = 0;
+static int next_id = 1;
+
+// Spawned isolates wait in a queue for a thread. A thread runs one isolate at a time, so a new thread is only
+// started when there are more isolates waiting than idle threads, and at most ISOLATE_MAX_THREADS of them run.
+// An isolate that waits in 'receive' keeps its thread but doesn't count as running, otherwise isolates that
+// wait for isolates still in the queue would wait forever. Threads beyond the limit quit once their isolate is done.
+static pthread_mutex_t pool_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t pool_work = PTHREAD_COND_INITIALIZER;
+static Isolate *pool_first = NULL;
+static Isolate *pool_last = NULL;
+static int pool_queued = 0;
+static int pool_idle = 0;
+static int pool_threads = 0;
+static int pool_waiting = 0; // threads with an isolate that waits for a message
+static __thread bool on_pool_thread = false;
+
+static void pool_set_waiting(bool waiting);
+
+static Isolate *isolate_new() {
+  Isolate *isolate = malloc(sizeof(Isolate));
+  pthread_mutex_init(&isolate->lock, NULL);
+  pthread_cond_init(&isolate->arrived, NULL);
+  isolate->first = NULL;
+  isolate->last = NULL;
+  isolate->next_job = NULL;
+  isolate->code_heap = NULL;
+
+  pthread_mutex_lock(&registry_lock);
+  isolate->id = next_id++;
+  if(registry_count == registry_capacity) {
+    registry_capacity = registry_capacity ? registry_capacity * 2 : 16;
+    registry = realloc(registry, sizeof(Isolate*) * registry_capacity);
+  }
+  registry[registry_count++] = isolate;
+  pthread_mutex_unlock(&registry_lock);
+  return isolate;
+}
+
+static void message_free(Message *message) {
+  free(message->data);
+  free(message);
+}
+
+static void isolate_free(Isolate *isolate) {
+  Message *message = isolate->first;
+  while(message) {
+    Message *next = message->next;
+    message_free(message);
+    message = next;
+  }
+  pthread_mutex_destroy(&isolate->lock);
+  pthread_cond_destroy(&isolate->arrived);
+  free(isolate);
+}
+
+// The registry must be locked
+static Isolate *registry_find(int id) {
+  for(int i = 0; i < registry_count; i++) {
+    if(registry[i]->id == id) {
+      return registry[i];
+    }
+  }
+  return NULL;
+}
+
+// Takes ownership of 'data'
+static void mailbox_put(Isolate *isolate, char *data, size_t size) {
+  Message *message = malloc(sizeof(Message));
+  message->data = data;
+  message->size = size;
+  message->next = NULL;
+  pthread_mutex_lock(&isolate->lock);
+  if(isolate->last) {
+    isolate->last->next = message;
+  } else {
+    isolate->first = message;
+  }
+  isolate->last = message;
+  pthread_cond_signal(&isolate->arrived);
+  pthread_mutex_unlock(&isolate->lock);
+}
+
+static Message *mailbox_take(Isolate *isolate, double timeout) {
+  struct timespec deadline;
+  if(timeout >= 0.0) {
+    clock_gettime(CLOCK_REALTIME, &deadline);
+    deadline.tv_sec += (time_t)timeout;
+    deadline.tv_nsec += (long)((timeout - (time_t)timeout) * 1e9);
+    if(deadline.tv_nsec >= 1000000000L) {
+      deadline.tv_sec++;
+      deadline.tv_nsec -= 1000000000L;
+    }
+  }
+  pthread_mutex_lock(&isolate->lock);
+  bool waiting = !isolate->first;
+  if(waiting) {
+    pool_set_waiting(true);
+  }
+  while(!isolate->first) {
+    if(timeout < 0.0) {
+      pthread_cond_wait(&isolate->arrived, &isolate->lock);
+    }
+    else if(pthread_cond_timedwait(&isolate->arrived, &isolate->lock, &deadline) == ETIMEDOUT) {
+      break;
+    }
+  }
+  if(waiting) {
+    pool_set_waiting(false);
+  }
+  Message *message = isolate->first;
+  if(message) {
+    isolate->first = message->next;
+    if(!isolate->first) {
+      isolate->last = NULL;
+    }
+  }
+  pthread_mutex_unlock(&isolate->lock);
+  return message;
+}
+
+int isolate_self(Runtime *r) {
+  if(!r->isolate) {
+    r->isolate = isolate_new();
+  }
+  return r->isolate->id;
+}
+
+void isolate_release(Runtime *r) {
+  Isolate *isolate = r->isolate;
+  if(!isolate) {
+    return;
+  }
+  pthread_mutex_lock(&registry_lock);
+  for(int i = 0; i < registry_count; i++) {
+    if(registry[i] == isolate) {
+      registry[i] = registry[--registry_count];
+      break;
+    }
+  }
+  pthread_mutex_unlock(&registry_lock);
+  isolate_free(isolate);
+  r->isolate = NULL;
+}
+
+bool isolate_send(Runtime *r, int id, Obj *message) {
+  Serializer s;
+  serializer_init(&s);
+  if(!serialize_obj(&s, lazy_realize_all(r, message))) {
+    serializer_free(&s);
+    return false;
+  }
+  // The registry stays locked so that the receiver can't be released in the meantime
+  pthread_mutex_lock(&registry_lock);
+  Isolate *isolate = registry_find(id);
+  if(isolate) {
+    mailbox_put(isolate, s.data, s.size);
+  }
+  pthread_mutex_unlock(&registry_lock);
+  if(!isolate) {
+    serializer_free(&s);
+  }
+  return isolate != NULL;
+}
+
+Obj *isolate_receive(Runtime *r, double timeout) {
+  isolate_self(r);
+  Message *message = mailbox_take(r->isolate, timeout);
+  if(!message) {
+    return NULL;
+  }
+  Deserializer d;
+  deserializer_init(&d, message->data, message->size);
+  Obj *o = deserialize_obj(&d, r);
+  message_free(message);
+  return o ? o : r->nil;
+}
+
+// The first message of a spawned isolate is the forms that it evaluates, the last of them calls the function
+static void isolate_run(Isolate *isolate) {
+  Runtime *r = NULL;
+  if(isolate->code_heap) {
+    r = code_heap_runtime_new(isolate->code_heap);
+    code_heap_release(isolate->code_heap); // the runtime holds on to it now
+  } else {
+    r = runtime_new(true);
+  }
+  r->isolate = isolate;
+  Message *boot = mailbox_take(isolate, -1.0);
+  Deserializer d;
+  deserializer_init(&d, boot->data, boot->size);
+  Obj *form;
+  while(d.pos < d.end && (form = deserialize_obj(&d, r))) {
+    runtime_eval_form(r, form);
+  }
+  message_free(boot);
+  runtime_delete(r);
+}
+
+static void *pool_thread_run(void *data) {
+  on_pool_thread = true;
+  pthread_mutex_lock(&pool_lock);
+  while(pool_threads - pool_waiting <= ISOLATE_MAX_THREADS) {
+    while(!pool_first) {
+      pool_idle++;
+      pthread_cond_wait(&pool_work, &pool_lock);
+      pool_idle--;
+    }
+    Isolate *isolate = pool_first;
+    pool_first = isolate->next_job;
+    if(!pool_first) {
+      pool_last = NULL;
+    }
+    pool_queued--;
+    pthread_mutex_unlock(&pool_lock);
+    isolate_run(isolate);
+    pthread_mutex_lock(&pool_lock);
+  }
+  pool_threads--; // more threads are running than the limit, now that the isolates they waited for are done
+  pthread_mutex_unlock(&pool_lock);
+  return NULL;
+}
+
+// The pool must be locked
+static void pool_start_thread_if_needed() {
+  pthread_t thread;
+  if(pool_queued > pool_idle && pool_threads - pool_waiting < ISOLATE_MAX_THREADS &&
+     pthread_create(&thread, NULL, pool_thread_run, NULL) == 0) {
+    pthread_detach(thread);
+    pool_threads++;
+  } else if(pool_queued > 0) {
+    pthread_cond_signal(&pool_work); // or the isolate waits for one of the running threads to finish
+  }
+}
+
+static void pool_set_waiting(bool waiting) {
+  if(!on_pool_thread) {
+    return; // runtimes on the threads of the host don't take up a thread of the pool
+  }
+  pthread_mutex_lock(&pool_lock);
+  pool_waiting += waiting ? 1 : -1;
+  if(waiting) {
+    pool_start_thread_if_needed();
+  }
+  pthread_mutex_unlock(&pool_lock);
+}
+
+static void pool_submit(Isolate *isolate) {
+  pthread_mutex_lock(&pool_lock);
+  if(pool_last) {
+    pool_last->next_job = isolate;
+  } else {
+    pool_first = isolate;
+  }
+  pool_last = isolate;
+  pool_queued++;
+  pool_start_thread_if_needed();
+  pthread_mutex_unlock(&pool_lock);
+}
+
+int isolate_thread_count() {
+  pthread_mutex_lock(&pool_lock);
+  int count = pool_threads;
+  pthread_mutex_unlock(&pool_lock);
+  return count;
+}
+
+static Obj *quote(Runtime *r, Obj *o) {
+  Obj *items[] = { gc_make_symbol(r->gc, "quote"), o };
+  return make_list(r->gc, items, 2);
+}
+
+// A lambda is sent as its source and compiled again by the receiver. Closures can't be sent,
+// the locals that they captured only exist in the frames of the sender.
+static Obj *sendable_form(Runtime *r, Obj *o) {
+  if(o->type == LAMBDA) {
+    if(GET_ENV(o)) {
+      return NULL;
+    }
+    Obj *items[] = { gc_make_symbol(r->gc, "fn"), GET_ARGS(o), GET_BODY(o) };
+    return make_list(r->gc, items, 3);
+  }
+  else if(o->type == FUNC) {
+    return gc_make_symbol(r->gc, o->name); // every runtime has the same builtins
+  }
+  else {
+    return quote(r, o);
+  }
+}
+
+// Forms that can't be serialized are left out, returns false for those.
+static bool serialize_form(Serializer *s, Obj *form) {
+  size_t size = s->size;
+  if(!serialize_obj(s, form)) {
+    s->size = size;
+    s->failed = false;
+    return false;
+  }
+  return true;
+}
+
+// (defmacro name params body), the '&' goes back in before the last param if the macro takes the rest of the args
+static Obj *macro_form(Runtime *r, Obj *name, Obj *macro) {
+  Obj *lambda = macro->car;
+  bool rest = macro->cdr != r->nil;
+  int param_count = count(GET_ARGS(lambda));
+  Obj **params = malloc(sizeof(Obj*) * (param_count + 1));
+  int i = 0;
+  for(Obj *param = GET_ARGS(lambda); param && param->car; param = param->cdr) {
+    if(rest && i == param_count - 1) {
+      params[i++] = gc_make_symbol(r->gc, "&");
+    }
+    params[i++] = param->car;
+  }
+  Obj *items[] = { gc_make_symbol(r->gc, "defmacro"), name, make_list(r->gc, params, i), GET_BODY(lambda) };
+  free(params);
+  return make_list(r->gc, items, 4);
+}
+
+// The bindings of an env, oldest first
+static Obj **env_pairs(Obj *env, int *OUT_count) {
+  *OUT_count = count(env->car);
+  Obj **pairs = malloc(sizeof(Obj*) * (*OUT_count ? *OUT_count : 1));
+  int i = *OUT_count;
+  for(Obj *binding = env->car; binding->car; binding = binding->cdr) {
+    pairs[--i] = binding->car;
+  }
+  return pairs;
+}
+
+// A binding that was copied from the code heap and hasn't changed since, the new runtime has it already
+static bool is_inherited(Obj *env, Obj *pair) {
+  Obj *inherited = env->cdr ? runtime_env_find_pair(env->cdr, pair->car) : NULL;
+  return inherited && inherited->cdr == pair->cdr;
+}
+
+static bool is_basic_var(Obj *name) {
+  return strcmp(name->name, "nil") == 0 || strcmp(name->name, "false") == 0 || strcmp(name->name, "true") == 0;
+}
+
+// The binding pairs of the globals and macros that the function needs, found by following the symbols
+// in its body and in the bodies of the lambdas and macros that those refer to.
+typedef struct {
+  Runtime *r;
+  Obj **pairs;
+  int count;
+  int capacity;
+} References;
+
+static bool references_contain(References *refs, Obj *pair) {
+  for(int i = 0; i < refs->count; i++) {
+    if(refs->pairs[i] == pair) {
+      return true;
+    }
+  }
+  return false;
+}
+
+static void collect_references(References *refs, Obj *o);
+
+static void collect_map_entry_references(Obj *key, Obj *value, void *data) {
+  collect_references(data, key);
+  collect_references(data, value);
+}
+
+static void add_reference(References *refs, Obj *pair, Obj *body) {
+  if(references_contain(refs, pair)) {
+    return;
+  }
+  if(refs->count == refs->capacity) {
+    refs->capacity = refs->capacity ? refs->capacity * 2 : 16;
+    refs->pairs = realloc(refs->pairs, sizeof(Obj*) * refs->capacity);
+  }
+  refs->pairs[refs->count++] = pair;
+  if(body) {
+    collect_references(refs, body);
+  }
+}
+
+// Any symbol that names a global or a macro counts, also a quoted one (a macro might put it in its expansion)
+static void collect_references(References *refs, Obj *o) {
+  Runtime *r = refs->r;
+  for(; o; o = o->cdr) {
+    if(o->type == SYMBOL) {
+      Obj *macro = runtime_env_find_pair(r->macros, o);
+      if(macro && !is_inherited(r->macros, macro)) {
+	add_reference(refs, macro, GET_BODY(macro->cdr->car));
+      }
+      Obj *global = runtime_env_find_pair(r->global_env, o);
+      if(global && !is_inherited(r->global_env, global)) {
+	add_reference(refs, global, global->cdr->type == LAMBDA ? GET_BODY(global->cdr) : NULL);
+      }
+      return;
+    }
+    else if(o->type == VECTOR) {
+      for(int i = 0; i < o->count; i++) {
+	collect_references(refs, vector_nth(o, i));
+      }
+      return;
+    }
+    else if(o->type == MAP) {
+      map_visit_entries(o, collect_map_entry_references, refs);
+      return;
+    }
+    else if(o->type != CONS || !o->car) {
+      return;
+    }
+    collect_references(refs, o->car);
+  }
+}
+
+// Only the definitions in 'refs' are sent, the ones that can't be are reported
+static void serialize_definitions(Runtime *r, Serializer *s, References *refs) {
+  int macro_count;
+  Obj **macros = env_pairs(r->macros, &macro_count);
+  for(int i = 0; i < macro_count; i++) {
+    if(!references_contain(refs, macros[i])) {
+      continue;
+    }
+    if(!serialize_form(s, macro_form(r, macros[i]->car, macros[i]->cdr))) {
+      printf("Can't send macro '%s' to the new isolate.\n", macros[i]->car->name);
+    }
+  }
+  free(macros);
+
+  int global_count;
+  Obj **globals = env_pairs(r->global_env, &global_count);
+  for(int i = 0; i < global_count; i++) {
+    Obj *name = globals[i]->car;
+    Obj *value = globals[i]->cdr;
+    if(!references_contain(refs, globals[i]) || (value->type == FUNC && strcmp(value->name, name->name) == 0) || is_basic_var(name)) {
+      continue; // not needed, or the new runtime has it already
+    }
+    Obj *form = sendable_form(r, value);
+    bool sent = false;
+    if(form) {
+      Obj *items[] = { gc_make_symbol(r->gc, "def"), name, form };
+      sent = serialize_form(s, make_list(r->gc, items, 3));
+    }
+    if(!sent) {
+      printf("Can't send '%s' to the new isolate%s.\n", name->name, value->type == LAMBDA ? ", it's a closure" : "");
+    }
+  }
+  free(globals);
+}
+
+int isolate_spawn(Runtime *r, Obj *f, Obj *args[], int arg_count) {
+  if(f->type != LAMBDA && f->type != FUNC) {
+    return -1;
+  }
+
+  // Realizing lazy args can run code, so the call is rooted while it's built
+  Obj *call = gc_make_cons(r->gc, r->nil, r->nil);
+  gc_stack_push(r->gc, call);
+  Obj *last = call;
+  for(int i = 0; i < arg_count; i++) {
+    Obj *arg = quote(r, args[i]);
+    last->cdr = gc_make_cons(r->gc, arg, r->nil);
+    last = last->cdr;
+    SECOND(arg) = lazy_realize_all(r, SECOND(arg));
+  }
+  call->car = sendable_form(r, f);
+
+  References refs = { r, NULL, 0, 0 };
+  if(f->type == LAMBDA) {
+    collect_references(&refs, GET_BODY(f));
+  }
+  Serializer s;
+  serializer_init(&s);
+  serialize_definitions(r, &s, &refs);
+  free(refs.pairs);
+  bool sendable = call->car && serialize_obj(&s, call);
+  gc_stack_pop_safely(r->gc);
+  if(!sendable) {
+    serializer_free(&s);
+    return -1;
+  }
+
+  Isolate *isolate = isolate_new();
+  if(r->code_heap) {
+    code_heap_retain(r->code_heap);
+    isolate->code_heap = r->code_heap;
+  }
+  mailbox_put(isolate, s.data, s.size);
+  int id = isolate->id;
+  pool_submit(isolate);
+  return id;
+}
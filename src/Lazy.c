@@ -0,0 +1,166 @@
+#include "Lazy.h"
+#include "GC.h"
+
+// The items of a chunk hang off a head cons that is rooted on the GC stack, since the functions
+// of map and filter can run the GC.
+typedef struct {
+  Runtime *r;
+  Obj *head;
+  Obj *last;
+} Chunk;
+
+static void chunk_init(Chunk *chunk, Runtime *r) {
+  chunk->r = r;
+  chunk->head = gc_make_cons(r->gc, r->nil, r->nil);
+  chunk->last = chunk->head;
+  gc_stack_push(r->gc, chunk->head);
+}
+
+static void chunk_add(Chunk *chunk, Obj *item) {
+  Obj *new = gc_make_cons(chunk->r->gc, item, chunk->r->nil);
+  chunk->last->cdr = new;
+  chunk->last = new;
+}
+
+// Ends the items with 'tail', an empty chunk is just the tail.
+static Obj *chunk_finish(Chunk *chunk, Obj *tail) {
+  gc_stack_pop_safely(chunk->r->gc);
+  chunk->last->cdr = tail;
+  return chunk->head->cdr;
+}
+
+static bool is_end(Obj *list) {
+  return list->type != CONS || !list->car;
+}
+
+// Each of these adds the next chunk of items and returns what comes after them,
+// a new LAZY_SEQ, nil, or NULL if calling the function failed.
+
+static Obj *realize_range(Runtime *r, Obj *seq, Chunk *chunk) {
+  double x = seq->lazy_arg->number;
+  double end = seq->lazy_seq->number;
+  for(int i = 0; i < LAZY_CHUNK_SIZE && x <= end; i++) {
+    chunk_add(chunk, gc_make_number(r->gc, x));
+    x += 1.0;
+  }
+  return x <= end ? gc_make_lazy_seq(r->gc, LAZY_RANGE, gc_make_number(r->gc, x), seq->lazy_seq) : r->nil;
+}
+
+// map, filter and remove, the source items that have been used are still reachable from 'seq' during the calls.
+static Obj *realize_with_function(Runtime *r, Obj *seq, Chunk *chunk) {
+  Obj *source = seq->lazy_seq;
+  for(int i = 0; i < LAZY_CHUNK_SIZE; i++) {
+    source = lazy_force(r, source);
+    if(is_end(source)) {
+      return r->nil;
+    }
+    Obj *item = source->car;
+    Obj *value = runtime_call(r, seq->lazy_arg, &item, 1);
+    if(!value) {
+      return NULL;
+    }
+    if(seq->lazy_kind == LAZY_MAP) {
+      chunk_add(chunk, value);
+    }
+    else if(eq(value, r->nil) == (seq->lazy_kind == LAZY_REMOVE)) {
+      chunk_add(chunk, item);
+    }
+    source = source->cdr;
+  }
+  return gc_make_lazy_seq(r->gc, seq->lazy_kind, seq->lazy_arg, source);
+}
+
+static Obj *realize_take(Runtime *r, Obj *seq, Chunk *chunk) {
+  int n = (int)seq->lazy_arg->number;
+  Obj *source = seq->lazy_seq;
+  int taken = 0;
+  while(taken < n && taken < LAZY_CHUNK_SIZE) {
+    source = lazy_force(r, source);
+    if(is_end(source)) {
+      return r->nil;
+    }
+    chunk_add(chunk, source->car);
+    source = source->cdr;
+    taken++;
+  }
+  return taken < n ? gc_make_lazy_seq(r->gc, LAZY_TAKE, gc_make_number(r->gc, n - taken), source) : r->nil;
+}
+
+static void lazy_realize(Runtime *r, Obj *seq) {
+  gc_stack_push(r->gc, seq);
+  Chunk chunk;
+  chunk_init(&chunk, r);
+  Obj *rest = NULL;
+  if(seq->lazy_kind == LAZY_RANGE) {
+    rest = realize_range(r, seq, &chunk);
+  }
+  else if(seq->lazy_kind == LAZY_TAKE) {
+    rest = realize_take(r, seq, &chunk);
+  }
+  else {
+    rest = realize_with_function(r, seq, &chunk);
+  }
+  // A failed call has printed its error already, the seq ends with the items before it
+  Obj *items = chunk_finish(&chunk, rest ? rest : r->nil);
+  gc_stack_pop_safely(r->gc);
+  seq->lazy_kind = LAZY_REALIZED;
+  seq->lazy_arg = NULL;
+  seq->lazy_seq = items;
+}
+
+Obj *lazy_force(Runtime *r, Obj *seq) {
+  while(seq->type == LAZY_SEQ) {
+    if(seq->lazy_kind != LAZY_REALIZED) {
+      lazy_realize(r, seq);
+    }
+    seq = seq->lazy_seq;
+  }
+  return seq;
+}
+
+Obj *lazy_realize_all(Runtime *r, Obj *o) {
+  if(o->type != CONS && o->type != LAZY_SEQ) {
+    return o;
+  }
+  gc_stack_push(r->gc, o);
+  Obj *list = lazy_force(r, o);
+  Obj *result = list;
+  while(!is_end(list)) {
+    // The realized LAZY_SEQs are spliced out of the list on the way, plain lists are left untouched
+    Obj *item = lazy_realize_all(r, list->car);
+    if(item != list->car) {
+      list->car = item;
+    }
+    Obj *next = lazy_force(r, list->cdr);
+    if(next != list->cdr) {
+      list->cdr = next;
+    }
+    list = next;
+  }
+  gc_stack_pop_safely(r->gc);
+  return result;
+}
+
+static bool lazy_eq_internal(Runtime *r, Obj *a, Obj *b) {
+  while(true) {
+    a = lazy_force(r, a);
+    b = lazy_force(r, b);
+    if(a == b || is_end(a) || is_end(b)) {
+      return eq(a, b);
+    }
+    if(!lazy_eq_internal(r, a->car, b->car)) {
+      return false;
+    }
+    a = a->cdr;
+    b = b->cdr;
+  }
+}
+
+bool lazy_eq(Runtime *r, Obj *a, Obj *b) {
+  gc_stack_push(r->gc, a);
+  gc_stack_push(r->gc, b);
+  bool result = lazy_eq_internal(r, a, b);
+  gc_stack_pop_safely(r->gc);
+  gc_stack_pop_safely(r->gc);
+  return result;
+}
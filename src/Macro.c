@@ -0,0 +1,144 @@
+#include "Macro.h"
+#include "GC.h"
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define EXPANSION_CACHE_MIN_CAPACITY 64
+
+static unsigned form_hash(Obj *form) {
+  uintptr_t x = (uintptr_t)form >> 3;
+  return (unsigned)(x ^ (x >> 29)) * 2654435761u;
+}
+
+static void expansion_cache_alloc(ExpansionCache *cache, int capacity) {
+  cache->forms = calloc(capacity, sizeof(Obj*));
+  cache->expansions = calloc(capacity, sizeof(Obj*));
+  cache->capacity = capacity;
+  cache->count = 0;
+}
+
+void expansion_cache_init(ExpansionCache *cache) {
+  expansion_cache_alloc(cache, EXPANSION_CACHE_MIN_CAPACITY);
+}
+
+void expansion_cache_free(ExpansionCache *cache) {
+  free(cache->forms);
+  free(cache->expansions);
+}
+
+// Open addressing with linear probing, the capacity is always a power of two.
+static int expansion_cache_find_slot(ExpansionCache *cache, Obj *form) {
+  int mask = cache->capacity - 1;
+  int i = form_hash(form) & mask;
+  while(cache->forms[i] && cache->forms[i] != form) {
+    i = (i + 1) & mask;
+  }
+  return i;
+}
+
+Obj *expansion_cache_get(ExpansionCache *cache, Obj *form) {
+  int i = expansion_cache_find_slot(cache, form);
+  return cache->forms[i] ? cache->expansions[i] : NULL;
+}
+
+// Moves the entries (only the ones with reachable forms if asked to) into a new table with room for 'min_count' entries.
+static void expansion_cache_rebuild(ExpansionCache *cache, int min_count, bool only_reachable) {
+  Obj **forms = cache->forms;
+  Obj **expansions = cache->expansions;
+  int old_capacity = cache->capacity;
+
+  int capacity = EXPANSION_CACHE_MIN_CAPACITY;
+  while(capacity < min_count * 2) {
+    capacity *= 2;
+  }
+  expansion_cache_alloc(cache, capacity);
+
+  for(int i = 0; i < old_capacity; i++) {
+    if(forms[i] && (!only_reachable || forms[i]->reachable)) {
+      int slot = expansion_cache_find_slot(cache, forms[i]);
+      cache->forms[slot] = forms[i];
+      cache->expansions[slot] = expansions[i];
+      cache->count++;
+    }
+  }
+
+  free(forms);
+  free(expansions);
+}
+
+void expansion_cache_put(ExpansionCache *cache, Obj *form, Obj *expansion) {
+  if((cache->count + 1) * 2 > cache->capacity) {
+    expansion_cache_rebuild(cache, cache->count + 1, false);
+  }
+  int i = expansion_cache_find_slot(cache, form);
+  if(!cache->forms[i]) {
+    cache->forms[i] = form;
+    cache->count++;
+  }
+  cache->expansions[i] = expansion;
+}
+
+void expansion_cache_mark(ExpansionCache *cache) {
+  // An expansion can contain other call sites (it usually contains parts of its own form),
+  // so keep marking until no more forms become reachable.
+  bool marked_more = true;
+  while(marked_more) {
+    marked_more = false;
+    for(int i = 0; i < cache->capacity; i++) {
+      if(cache->forms[i] && cache->forms[i]->reachable && !cache->expansions[i]->reachable) {
+	gc_mark(cache->expansions[i]);
+	marked_more = true;
+      }
+    }
+  }
+
+  int live_count = 0;
+  for(int i = 0; i < cache->capacity; i++) {
+    if(cache->forms[i] && cache->forms[i]->reachable) {
+      live_count++;
+    }
+  }
+  if(live_count < cache->count) {
+    expansion_cache_rebuild(cache, live_count, true);
+  }
+}
+
+void macro_deps_init(MacroDeps *deps) {
+  deps->names = NULL;
+  deps->hashes = NULL;
+  deps->count = 0;
+  deps->capacity = 0;
+}
+
+void macro_deps_free(MacroDeps *deps) {
+  for(int i = 0; i < deps->count; i++) {
+    free(deps->names[i]);
+  }
+  free(deps->names);
+  free(deps->hashes);
+}
+
+void macro_deps_add(MacroDeps *deps, const char *name, unsigned hash) {
+  for(int i = 0; i < deps->count; i++) {
+    if(strcmp(deps->names[i], name) == 0) {
+      return;
+    }
+  }
+  if(deps->count == deps->capacity) {
+    deps->capacity = deps->capacity ? deps->capacity * 2 : 8;
+    deps->names = realloc(deps->names, sizeof(char*) * deps->capacity);
+    deps->hashes = realloc(deps->hashes, sizeof(unsigned) * deps->capacity);
+  }
+  deps->names[deps->count] = strdup(name);
+  deps->hashes[deps->count] = hash;
+  deps->count++;
+}
+
+unsigned macro_hash(Obj *macro) {
+  Obj *lambda = macro->car;
+  unsigned hash = obj_hash(GET_ARGS(lambda));
+  hash = hash * 31 + obj_hash(GET_BODY(lambda));
+  bool rest = !(macro->cdr->type == CONS && !macro->cdr->car); // anything but nil
+  return hash * 31 + rest;
+}
@@ -0,0 +1,230 @@
+#include "Map.h"
+#include <string.h>
+
+#define HASH_BITS 32
+
+// Nodes on levels where all bits of the hash have been used up are collision nodes.
+static bool is_collision_level(int shift) {
+  return shift >= HASH_BITS;
+}
+
+static unsigned bit_for(unsigned hash, int shift) {
+  return 1u << ((hash >> shift) & MAP_MASK);
+}
+
+// Position of the entry for 'bit' among the entries that are present in the node.
+static int entry_index(Obj *node, unsigned bit) {
+  return __builtin_popcount(node->bitmap & (bit - 1));
+}
+
+static Obj *node_get(Obj *node, int shift, unsigned hash, Obj *key) {
+  while(node) {
+    if(is_collision_level(shift)) {
+      for(int i = 0; i < node->count; i += 2) {
+	if(eq(node->items[i], key)) {
+	  return node->items[i + 1];
+	}
+      }
+      return NULL;
+    }
+    unsigned bit = bit_for(hash, shift);
+    if(!(node->bitmap & bit)) {
+      return NULL;
+    }
+    int i = 2 * entry_index(node, bit);
+    Obj *entry_key = node->items[i];
+    if(entry_key == NULL) {
+      node = node->items[i + 1]; // descend into the child
+      shift += MAP_BITS;
+    }
+    else {
+      return eq(entry_key, key) ? node->items[i + 1] : NULL;
+    }
+  }
+  return NULL;
+}
+
+Obj *map_get(Obj *map, Obj *key) {
+  return node_get(map->root, 0, obj_hash(key), key);
+}
+
+static Obj *copy_node(GC *gc, Obj *node) {
+  Obj *copy = gc_make_map_node(gc, node->count, node->bitmap);
+  memcpy(copy->items, node->items, sizeof(Obj*) * node->count);
+  return copy;
+}
+
+// Copies the node and opens up two slots at 'index' for a new entry.
+static Obj *copy_node_with_gap(GC *gc, Obj *node, int index, unsigned bitmap) {
+  int count = node ? node->count : 0;
+  Obj *copy = gc_make_map_node(gc, count + 2, bitmap);
+  if(node) {
+    memcpy(copy->items, node->items, sizeof(Obj*) * index);
+    memcpy(copy->items + index + 2, node->items + index, sizeof(Obj*) * (count - index));
+  }
+  return copy;
+}
+
+// Copies the node without the two slots at 'index'.
+static Obj *copy_node_without(GC *gc, Obj *node, int index, unsigned bitmap) {
+  Obj *copy = gc_make_map_node(gc, node->count - 2, bitmap);
+  memcpy(copy->items, node->items, sizeof(Obj*) * index);
+  memcpy(copy->items + index, node->items + index + 2, sizeof(Obj*) * (node->count - index - 2));
+  return copy;
+}
+
+static Obj *node_assoc(GC *gc, Obj *node, int shift, unsigned hash, Obj *key, Obj *value, bool *added);
+
+// Makes a node on level 'shift' holding two entries that collided on the level above.
+static Obj *node_from_two_entries(GC *gc, int shift, Obj *key1, Obj *value1, unsigned hash2, Obj *key2, Obj *value2) {
+  bool added = false;
+  Obj *node = node_assoc(gc, NULL, shift, obj_hash(key1), key1, value1, &added);
+  return node_assoc(gc, node, shift, hash2, key2, value2, &added);
+}
+
+static Obj *node_assoc(GC *gc, Obj *node, int shift, unsigned hash, Obj *key, Obj *value, bool *added) {
+  if(is_collision_level(shift)) {
+    int count = node ? node->count : 0;
+    for(int i = 0; i < count; i += 2) {
+      if(eq(node->items[i], key)) {
+	if(node->items[i + 1] == value) {
+	  return node;
+	}
+	Obj *copy = copy_node(gc, node);
+	copy->items[i + 1] = value;
+	return copy;
+      }
+    }
+    *added = true;
+    Obj *copy = copy_node_with_gap(gc, node, count, 0);
+    copy->items[count] = key;
+    copy->items[count + 1] = value;
+    return copy;
+  }
+
+  unsigned bitmap = node ? node->bitmap : 0;
+  unsigned bit = bit_for(hash, shift);
+
+  if(!(bitmap & bit)) {
+    *added = true;
+    int i = node ? 2 * entry_index(node, bit) : 0;
+    Obj *copy = copy_node_with_gap(gc, node, i, bitmap | bit);
+    copy->items[i] = key;
+    copy->items[i + 1] = value;
+    return copy;
+  }
+
+  int i = 2 * entry_index(node, bit);
+  Obj *entry_key = node->items[i];
+  Obj *entry_value = node->items[i + 1];
+  Obj *copy;
+
+  if(entry_key == NULL) {
+    Obj *child = node_assoc(gc, entry_value, shift + MAP_BITS, hash, key, value, added);
+    if(child == entry_value) {
+      return node;
+    }
+    copy = copy_node(gc, node);
+    copy->items[i + 1] = child;
+  }
+  else if(eq(entry_key, key)) {
+    if(entry_value == value) {
+      return node;
+    }
+    copy = copy_node(gc, node);
+    copy->items[i + 1] = value;
+  }
+  else {
+    // Two different keys want the same slot, push both of them down into a new child
+    *added = true;
+    copy = copy_node(gc, node);
+    copy->items[i] = NULL;
+    copy->items[i + 1] = node_from_two_entries(gc, shift + MAP_BITS, entry_key, entry_value, hash, key, value);
+  }
+  return copy;
+}
+
+Obj *map_assoc(GC *gc, Obj *map, Obj *key, Obj *value) {
+  bool added = false;
+  Obj *root = node_assoc(gc, map->root, 0, obj_hash(key), key, value, &added);
+  if(root == map->root) {
+    return map;
+  }
+  return gc_make_map(gc, root, map->count + (added ? 1 : 0));
+}
+
+// Returns the node without the key, NULL if the node became empty.
+static Obj *node_dissoc(GC *gc, Obj *node, int shift, unsigned hash, Obj *key) {
+  if(is_collision_level(shift)) {
+    for(int i = 0; i < node->count; i += 2) {
+      if(eq(node->items[i], key)) {
+	return node->count == 2 ? NULL : copy_node_without(gc, node, i, 0);
+      }
+    }
+    return node;
+  }
+
+  unsigned bit = bit_for(hash, shift);
+  if(!(node->bitmap & bit)) {
+    return node;
+  }
+
+  int i = 2 * entry_index(node, bit);
+  Obj *entry_key = node->items[i];
+  if(entry_key == NULL) {
+    Obj *child = node_dissoc(gc, node->items[i + 1], shift + MAP_BITS, hash, key);
+    if(child == node->items[i + 1]) {
+      return node;
+    }
+    else if(child) {
+      Obj *copy = copy_node(gc, node);
+      copy->items[i + 1] = child;
+      return copy;
+    }
+  }
+  else if(!eq(entry_key, key)) {
+    return node;
+  }
+
+  // The entry (or the child that became empty) is removed from this node
+  if(node->bitmap == bit) {
+    return NULL;
+  }
+  return copy_node_without(gc, node, i, node->bitmap & ~bit);
+}
+
+Obj *map_dissoc(GC *gc, Obj *map, Obj *key) {
+  if(!map->root) {
+    return map;
+  }
+  Obj *root = node_dissoc(gc, map->root, 0, obj_hash(key), key);
+  if(root == map->root) {
+    return map;
+  }
+  return gc_make_map(gc, root, map->count - 1);
+}
+
+Obj *map_from_array(GC *gc, Obj *items[], int item_count) {
+  Obj *map = gc_make_map(gc, NULL, 0);
+  for(int i = 0; i + 1 < item_count; i += 2) {
+    map = map_assoc(gc, map, items[i], items[i + 1]);
+  }
+  return map;
+}
+
+static void node_visit_entries(Obj *node, void (*visit)(Obj *key, Obj *value, void *data), void *data) {
+  // Collision nodes never hold children, so they can be visited like any other node
+  for(int i = 0; i < node->count; i += 2) {
+    if(node->items[i]) {
+      visit(node->items[i], node->items[i + 1], data);
+    } else {
+      node_visit_entries(node->items[i + 1], visit, data);
+    }
+  }
+}
+
+void map_visit_entries(Obj *map, void (*visit)(Obj *key, Obj *value, void *data), void *data) {
+  if(map->root) {
+    node_visit_entries(map->root, visit, data);
+  }
+}
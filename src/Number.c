@@ -0,0 +1,395 @@
+#include "Number.h"
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+// Formatting uses Grisu2 (Florian Loitsch, "Printing Floating-Point Numbers Quickly and Accurately with Integers").
+// It works on 64 bit integers only and always produces digits that read back to the same double,
+// in all but a tiny fraction of cases they are also the shortest such digits.
+
+typedef struct {
+  uint64_t f;
+  int e;
+} DiyFp;
+
+#define DOUBLE_SIGNIFICAND_MASK 0x000FFFFFFFFFFFFFULL
+#define DOUBLE_EXPONENT_MASK    0x7FF0000000000000ULL
+#define DOUBLE_HIDDEN_BIT       0x0010000000000000ULL
+#define DOUBLE_EXPONENT_BIAS    (0x3FF + 52)
+#define DOUBLE_MIN_EXPONENT     (-DOUBLE_EXPONENT_BIAS)
+
+// Normalized 64 bit approximations of 10^-348, 10^-340, ..., 10^340
+static const uint64_t cached_powers_f[] = {
+  0xfa8fd5a0081c0288ULL, 0xbaaee17fa23ebf76ULL, 0x8b16fb203055ac76ULL, 0xcf42894a5dce35eaULL,
+  0x9a6bb0aa55653b2dULL, 0xe61acf033d1a45dfULL, 0xab70fe17c79ac6caULL, 0xff77b1fcbebcdc4fULL,
+  0xbe5691ef416bd60cULL, 0x8dd01fad907ffc3cULL, 0xd3515c2831559a83ULL, 0x9d71ac8fada6c9b5ULL,
+  0xea9c227723ee8bcbULL, 0xaecc49914078536dULL, 0x823c12795db6ce57ULL, 0xc21094364dfb5637ULL,
+  0x9096ea6f3848984fULL, 0xd77485cb25823ac7ULL, 0xa086cfcd97bf97f4ULL, 0xef340a98172aace5ULL,
+  0xb23867fb2a35b28eULL, 0x84c8d4dfd2c63f3bULL, 0xc5dd44271ad3cdbaULL, 0x936b9fcebb25c996ULL,
+  0xdbac6c247d62a584ULL, 0xa3ab66580d5fdaf6ULL, 0xf3e2f893dec3f126ULL, 0xb5b5ada8aaff80b8ULL,
+  0x87625f056c7c4a8bULL, 0xc9bcff6034c13053ULL, 0x964e858c91ba2655ULL, 0xdff9772470297ebdULL,
+  0xa6dfbd9fb8e5b88fULL, 0xf8a95fcf88747d94ULL, 0xb94470938fa89bcfULL, 0x8a08f0f8bf0f156bULL,
+  0xcdb02555653131b6ULL, 0x993fe2c6d07b7facULL, 0xe45c10c42a2b3b06ULL, 0xaa242499697392d3ULL,
+  0xfd87b5f28300ca0eULL, 0xbce5086492111aebULL, 0x8cbccc096f5088ccULL, 0xd1b71758e219652cULL,
+  0x9c40000000000000ULL, 0xe8d4a51000000000ULL, 0xad78ebc5ac620000ULL, 0x813f3978f8940984ULL,
+  0xc097ce7bc90715b3ULL, 0x8f7e32ce7bea5c70ULL, 0xd5d238a4abe98068ULL, 0x9f4f2726179a2245ULL,
+  0xed63a231d4c4fb27ULL, 0xb0de65388cc8ada8ULL, 0x83c7088e1aab65dbULL, 0xc45d1df942711d9aULL,
+  0x924d692ca61be758ULL, 0xda01ee641a708deaULL, 0xa26da3999aef774aULL, 0xf209787bb47d6b85ULL,
+  0xb454e4a179dd1877ULL, 0x865b86925b9bc5c2ULL, 0xc83553c5c8965d3dULL, 0x952ab45cfa97a0b3ULL,
+  0xde469fbd99a05fe3ULL, 0xa59bc234db398c25ULL, 0xf6c69a72a3989f5cULL, 0xb7dcbf5354e9beceULL,
+  0x88fcf317f22241e2ULL, 0xcc20ce9bd35c78a5ULL, 0x98165af37b2153dfULL, 0xe2a0b5dc971f303aULL,
+  0xa8d9d1535ce3b396ULL, 0xfb9b7cd9a4a7443cULL, 0xbb764c4ca7a44410ULL, 0x8bab8eefb6409c1aULL,
+  0xd01fef10a657842cULL, 0x9b10a4e5e9913129ULL, 0xe7109bfba19c0c9dULL, 0xac2820d9623bf429ULL,
+  0x80444b5e7aa7cf85ULL, 0xbf21e44003acdd2dULL, 0x8e679c2f5e44ff8fULL, 0xd433179d9c8cb841ULL,
+  0x9e19db92b4e31ba9ULL, 0xeb96bf6ebadf77d9ULL, 0xaf87023b9bf0ee6bULL
+};
+
+static const int16_t cached_powers_e[] = {
+  -1220, -1193, -1166, -1140, -1113, -1087, -1060, -1034, -1007, -980, -954, -927,
+  -901, -874, -847, -821, -794, -768, -741, -715, -688, -661, -635, -608,
+  -582, -555, -529, -502, -475, -449, -422, -396, -369, -343, -316, -289,
+  -263, -236, -210, -183, -157, -130, -103, -77, -50, -24, 3, 30,
+  56, 83, 109, 136, 162, 189, 216, 242, 269, 295, 322, 348,
+  375, 402, 428, 455, 481, 508, 534, 561, 588, 614, 641, 667,
+  694, 720, 747, 774, 800, 827, 853, 880, 907, 933, 960, 986,
+  1013, 1039, 1066
+};
+
+static const uint64_t pow10_table[] = {
+  1ULL, 10ULL, 100ULL, 1000ULL, 10000ULL, 100000ULL, 1000000ULL, 10000000ULL, 100000000ULL,
+  1000000000ULL, 10000000000ULL, 100000000000ULL, 1000000000000ULL, 10000000000000ULL,
+  100000000000000ULL, 1000000000000000ULL, 10000000000000000ULL, 100000000000000000ULL,
+  1000000000000000000ULL, 10000000000000000000ULL,
+};
+
+static DiyFp diy_fp_from_double(double x) {
+  uint64_t bits;
+  memcpy(&bits, &x, sizeof(double));
+  int biased_e = (int)((bits & DOUBLE_EXPONENT_MASK) >> 52);
+  uint64_t significand = bits & DOUBLE_SIGNIFICAND_MASK;
+  DiyFp fp;
+  if(biased_e != 0) {
+    fp.f = significand + DOUBLE_HIDDEN_BIT;
+    fp.e = biased_e - DOUBLE_EXPONENT_BIAS;
+  } else {
+    fp.f = significand;
+    fp.e = DOUBLE_MIN_EXPONENT + 1;
+  }
+  return fp;
+}
+
+static DiyFp diy_fp_multiply(DiyFp a, DiyFp b) {
+  unsigned __int128 product = (unsigned __int128)a.f * b.f;
+  DiyFp fp;
+  fp.f = (uint64_t)(product >> 64) + (((uint64_t)product >> 63) & 1); // round
+  fp.e = a.e + b.e + 64;
+  return fp;
+}
+
+static DiyFp diy_fp_normalize(DiyFp fp) {
+  int shift = __builtin_clzll(fp.f);
+  fp.f <<= shift;
+  fp.e -= shift;
+  return fp;
+}
+
+// The boundaries m- and m+ lie halfway between x and its neighbouring doubles.
+static void normalized_boundaries(DiyFp v, DiyFp *minus, DiyFp *plus) {
+  DiyFp pl = { (v.f << 1) + 1, v.e - 1 };
+  pl = diy_fp_normalize(pl);
+  DiyFp mi;
+  if(v.f == DOUBLE_HIDDEN_BIT) {
+    mi.f = (v.f << 2) - 1; // the lower neighbour is closer when x is a power of two
+    mi.e = v.e - 2;
+  } else {
+    mi.f = (v.f << 1) - 1;
+    mi.e = v.e - 1;
+  }
+  mi.f <<= mi.e - pl.e;
+  mi.e = pl.e;
+  *minus = mi;
+  *plus = pl;
+}
+
+// Finds a cached power c = 10^-K so that the exponent of c * 2^e ends up in [-60, -32].
+static DiyFp cached_power(int e, int *K) {
+  double dk = (-61 - e) * 0.30102999566398114 + 347; // log10(2)
+  int k = (int)dk;
+  if(dk - k > 0.0) {
+    k++;
+  }
+  int index = (k >> 3) + 1;
+  *K = -(-348 + index * 8);
+  DiyFp fp = { cached_powers_f[index], cached_powers_e[index] };
+  return fp;
+}
+
+static void grisu_round(char *buffer, int length, uint64_t delta, uint64_t rest, uint64_t ten_kappa, uint64_t wp_w) {
+  while(rest < wp_w && delta - rest >= ten_kappa &&
+	(rest + ten_kappa < wp_w || wp_w - rest > rest + ten_kappa - wp_w)) {
+    buffer[length - 1]--;
+    rest += ten_kappa;
+  }
+}
+
+static int count_decimal_digits(uint32_t n) {
+  int digits = 1;
+  while(digits < 10 && n >= pow10_table[digits]) {
+    digits++;
+  }
+  return digits;
+}
+
+static int digit_gen(DiyFp w, DiyFp mp, uint64_t delta, char *buffer, int *K) {
+  DiyFp one = { 1ULL << -mp.e, mp.e };
+  uint64_t wp_w = mp.f - w.f;
+  uint32_t p1 = (uint32_t)(mp.f >> -one.e);
+  uint64_t p2 = mp.f & (one.f - 1);
+  int kappa = count_decimal_digits(p1);
+  int length = 0;
+
+  // Integer part
+  while(kappa > 0) {
+    uint32_t divisor = (uint32_t)pow10_table[kappa - 1];
+    uint32_t d = p1 / divisor;
+    p1 %= divisor;
+    if(d || length) {
+      buffer[length++] = '0' + d;
+    }
+    kappa--;
+    uint64_t rest = ((uint64_t)p1 << -one.e) + p2;
+    if(rest <= delta) {
+      *K += kappa;
+      grisu_round(buffer, length, delta, rest, pow10_table[kappa] << -one.e, wp_w);
+      return length;
+    }
+  }
+
+  // Fractional part
+  while(1) {
+    p2 *= 10;
+    delta *= 10;
+    char d = (char)(p2 >> -one.e);
+    if(d || length) {
+      buffer[length++] = '0' + d;
+    }
+    p2 &= one.f - 1;
+    kappa--;
+    if(p2 < delta) {
+      *K += kappa;
+      int index = -kappa;
+      grisu_round(buffer, length, delta, p2, one.f, wp_w * (index < 20 ? pow10_table[index] : 0));
+      return length;
+    }
+  }
+}
+
+// Writes the digits of a positive, finite x to buffer and returns their count, x = digits * 10^K.
+static int grisu2(double x, char *buffer, int *K) {
+  DiyFp v = diy_fp_from_double(x);
+  DiyFp w_minus, w_plus;
+  normalized_boundaries(v, &w_minus, &w_plus);
+
+  DiyFp c_mk = cached_power(w_plus.e, K);
+  DiyFp w = diy_fp_multiply(diy_fp_normalize(v), c_mk);
+  DiyFp wp = diy_fp_multiply(w_plus, c_mk);
+  DiyFp wm = diy_fp_multiply(w_minus, c_mk);
+  wm.f++;
+  wp.f--;
+  return digit_gen(w, wp, wp.f - wm.f, buffer, K);
+}
+
+static int write_exponent(int k, char *out) {
+  char *start = out;
+  if(k < 0) {
+    *out++ = '-';
+    k = -k;
+  }
+  if(k >= 100) {
+    *out++ = '0' + k / 100;
+    k %= 100;
+    *out++ = '0' + k / 10;
+  }
+  else if(k >= 10) {
+    *out++ = '0' + k / 10;
+  }
+  *out++ = '0' + k % 10;
+  return out - start;
+}
+
+// Places the decimal point, 'length' digits are in buffer and the number is 0.digits * 10^point.
+static int prettify(char *buffer, int length, int point) {
+  if(length <= point && point <= 21) {
+    // 1234e7 -> 12340000000
+    memset(buffer + length, '0', point - length);
+    return point;
+  }
+  else if(0 < point && point <= 21) {
+    // 1234e-2 -> 12.34
+    memmove(buffer + point + 1, buffer + point, length - point);
+    buffer[point] = '.';
+    return length + 1;
+  }
+  else if(-6 < point && point <= 0) {
+    // 1234e-6 -> 0.001234
+    int zeros = -point;
+    memmove(buffer + 2 + zeros, buffer, length);
+    buffer[0] = '0';
+    buffer[1] = '.';
+    memset(buffer + 2, '0', zeros);
+    return length + 2 + zeros;
+  }
+  else if(length == 1) {
+    // 1e30
+    buffer[1] = 'e';
+    return 2 + write_exponent(point - 1, buffer + 2);
+  }
+  else {
+    // 1234e30 -> 1.234e33
+    memmove(buffer + 2, buffer + 1, length - 1);
+    buffer[1] = '.';
+    buffer[length + 1] = 'e';
+    return length + 2 + write_exponent(point - 1, buffer + length + 2);
+  }
+}
+
+static int format_integer(uint64_t n, char *buffer) {
+  char digits[20];
+  int count = 0;
+  do {
+    digits[count++] = '0' + n % 10;
+    n /= 10;
+  } while(n);
+  for(int i = 0; i < count; i++) {
+    buffer[i] = digits[count - 1 - i];
+  }
+  return count;
+}
+
+int number_format(double x, char *buffer) {
+  if(isnan(x)) {
+    memcpy(buffer, "nan", 4);
+    return 3;
+  }
+
+  char *out = buffer;
+  if(signbit(x)) {
+    *out++ = '-';
+    x = -x;
+  }
+
+  int length;
+  if(isinf(x)) {
+    memcpy(out, "inf", 3);
+    length = 3;
+  }
+  else if(x == 0.0) {
+    *out = '0';
+    length = 1;
+  }
+  else if(x < 9007199254740992.0 && x == (double)(uint64_t)x) {
+    length = format_integer((uint64_t)x, out); // integers below 2^53 are printed exactly
+  }
+  else {
+    int K;
+    length = grisu2(x, out, &K);
+    length = prettify(out, length, length + K);
+  }
+  out[length] = '\0';
+  return (out - buffer) + length;
+}
+
+// Powers of ten that are exact doubles, used by the fast path of number_parse.
+static const double exact_powers_of_ten[] = {
+  1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+  1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22,
+};
+
+static bool is_digit(char c) {
+  return c >= '0' && c <= '9';
+}
+
+const char *number_parse(const char *start, const char *end, double *OUT_number) {
+  const char *p = start;
+  bool negative = false;
+  if(p < end && *p == '-') {
+    negative = true;
+    p++;
+  }
+  if(p >= end || !is_digit(*p)) {
+    return NULL;
+  }
+
+  uint64_t mantissa = 0;
+  int significant_digits = 0;
+  int exponent = 0;
+
+  for(; p < end && is_digit(*p); p++) {
+    if(significant_digits < 19) {
+      mantissa = mantissa * 10 + (*p - '0');
+      if(mantissa) {
+	significant_digits++;
+      }
+    } else {
+      exponent++; // the digit is dropped, strtod will have to do the work
+      significant_digits++;
+    }
+  }
+  if(p < end && *p == '.') {
+    p++;
+    for(; p < end && is_digit(*p); p++) {
+      if(significant_digits < 19) {
+	mantissa = mantissa * 10 + (*p - '0');
+	if(mantissa) {
+	  significant_digits++;
+	}
+	exponent--;
+      } else {
+	significant_digits++;
+      }
+    }
+  }
+  if(p + 1 < end && (*p == 'e' || *p == 'E')) {
+    const char *e = p + 1;
+    bool negative_exponent = false;
+    if(*e == '+' || *e == '-') {
+      negative_exponent = (*e == '-');
+      e++;
+    }
+    if(e < end && is_digit(*e)) {
+      int written_exponent = 0;
+      for(; e < end && is_digit(*e); e++) {
+	if(written_exponent < 100000) {
+	  written_exponent = written_exponent * 10 + (*e - '0');
+	}
+      }
+      exponent += negative_exponent ? -written_exponent : written_exponent;
+      p = e;
+    }
+  }
+
+  // Fast path (Clinger): both the mantissa and the power of ten are exact doubles,
+  // so a single multiplication or division is correctly rounded.
+  if(significant_digits <= 15 && exponent >= -22 && exponent <= 22) {
+    double x = (double)mantissa;
+    x = exponent < 0 ? x / exact_powers_of_ten[-exponent] : x * exact_powers_of_ten[exponent];
+    *OUT_number = negative ? -x : x;
+    return p;
+  }
+
+  // Slow path, strtod is exact but needs a terminated string, use the stack unless the literal is absurdly long
+  size_t length = p - start;
+  char buffer[64];
+  char *s = buffer;
+  if(length >= sizeof(buffer)) {
+    s = malloc(length + 1);
+  }
+  memcpy(s, start, length);
+  s[length] = '\0';
+  *OUT_number = strtod(s, NULL);
+  if(s != buffer) {
+    free(s);
+  }
+  return p;
+}
@@ -1,8 +1,13 @@
 #include "Obj.h"
 #include "Bytecode.h"
+#include "Vector.h"
+#include "Map.h"
+#include "Array.h"
+#include <math.h>
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
+#include <stdint.h>
 
 const char *type_to_str(Type type) {
   if(type == CONS) return "CONS";
@@ -12,98 +17,158 @@ const char *type_to_str(Type type) {
   else if(type == NUMBER) return "NUMBER";
   else if(type == LAMBDA) return "LAMBDA";
   else if(type == BYTECODE) return "BYTECODE";
+  else if(type == VECTOR) return "VECTOR";
+  else if(type == VECTOR_NODE) return "VECTOR_NODE";
+  else if(type == MAP) return "MAP";
+  else if(type == MAP_NODE) return "MAP_NODE";
+  else if(type == ARRAY) return "ARRAY";
+  else if(type == LAZY_SEQ) return "LAZY_SEQ";
+  else if(type == XFORM) return "XFORM";
   else return "UNKNOWN";
 }
 
-const char *obj_to_str(Obj *o) {
-  if(o == NULL) {
-    return "NULL";
-  }
-  else if(o->type == CONS) {
-    return "CONS";
-  }
-  else if(o->type == SYMBOL) {
-    return o->name;
-  }
-  else if(o->type == FUNC) {
-    char *s = malloc(sizeof(char) * strlen(o->name) + sizeof(char) * 2); // LEAK! SHOULD BE A PROPER OBJ STRING
-    s[0] = '#';
-    s[strlen(o->name) - 1] = '\0';
-    char *s1 = &s[1];
-    strcpy(s1, o->name);
-    return s;
-  }
-  else if(o->type == NUMBER) {
-    const int MAX_STR_LEN = 50;
-    char *output = malloc(sizeof(char) * MAX_STR_LEN); // MEMORY LEAK!!!!!
-    snprintf(output, MAX_STR_LEN, "%f", o->number);
-    return output;
-  }
-  else if(o->type == STRING) {
-    return o->name;
-  }
-  else if(o->type == LAMBDA) {
-    return "λ";
-  }
-  else if(o->type == BYTECODE) {
-    return "BYTECODE";
-  }
-  else {
-    error("Can't print unknown type.");
-    return NULL;
+typedef struct {
+  StrBuilder *sb;
+  bool first;
+} MapPrinter;
+
+void print_map_entry(Obj *key, Obj *value, void *data) {
+  MapPrinter *printer = data;
+  if(!printer->first) {
+    str_builder_append_char(printer->sb, ' ');
   }
+  printer->first = false;
+  obj_print_to(printer->sb, key, true);
+  str_builder_append_char(printer->sb, ' ');
+  obj_print_to(printer->sb, value, true);
 }
 
-void print_obj(Obj *o) {
+void obj_print_to(StrBuilder *sb, Obj *o, bool readably) {
+  o = lazy_unwrap(o);
   if(o == NULL) {
-    printf("NULL");
+    str_builder_append_str(sb, "NULL");
   }
   else if(o->type == CONS && o->car == NULL && o->cdr == NULL) {
-    printf("nil");
+    str_builder_append_str(sb, "nil");
   }
-  else if(o->type == CONS && o->cdr != NULL && o->cdr->type == CONS) {
-    printf("(");
+  else if(o->type == LAZY_SEQ || (o->type == CONS && o->cdr != NULL && (o->cdr->type == CONS || o->cdr->type == LAZY_SEQ))) {
+    // The part of a lazy seq that hasn't been realized yet is printed as '...'
+    str_builder_append_char(sb, '(');
     Obj *curr = o;
-    while(curr) {
-      if(curr->cdr) {
-	print_obj(curr->car);
-	if(curr->cdr->cdr) {
-	  // the next cell is not nil
-	  printf(" ");
-	}
+    bool first = true;
+    while(curr->type == CONS && curr->cdr) {
+      if(!first) {
+	str_builder_append_char(sb, ' ');
       }
-      curr = curr->cdr;
+      obj_print_to(sb, curr->car, true);
+      first = false;
+      curr = lazy_unwrap(curr->cdr);
     }
-    printf(")");
+    if(curr->type == LAZY_SEQ) {
+      str_builder_append_str(sb, first ? "..." : " ...");
+    }
+    else if(curr->type != CONS) {
+      str_builder_append_str(sb, " . ");
+      obj_print_to(sb, curr, true);
+    }
+    str_builder_append_char(sb, ')');
   }
   else if(o->type == CONS) {
-    printf("(");
-    print_obj(o->car);
-    printf(" . ");
-    print_obj(o->cdr);
-    printf(")");
+    str_builder_append_char(sb, '(');
+    obj_print_to(sb, o->car, true);
+    str_builder_append_str(sb, " . ");
+    obj_print_to(sb, o->cdr, true);
+    str_builder_append_char(sb, ')');
   }
   else if(o->type == SYMBOL) {
-    printf("%s", o->name);
+    str_builder_append(sb, o->name, o->length);
   }
   else if(o->type == FUNC) {
-    printf("#%s", o->name);
+    str_builder_append_char(sb, '#');
+    str_builder_append_str(sb, o->name);
   }
   else if(o->type == NUMBER) {
-    printf("%f", o->number);
+    str_builder_append_number(sb, o->number);
   }
   else if(o->type == STRING) {
-    printf("\"%s\"", o->name);
+    if(readably) {
+      str_builder_append_char(sb, '"');
+    }
+    str_builder_append(sb, o->name, o->length);
+    if(readably) {
+      str_builder_append_char(sb, '"');
+    }
   }
   else if(o->type == LAMBDA) {
-    printf("λ");
+    str_builder_append_str(sb, "λ");
   }
   else if(o->type == BYTECODE) {
+    str_builder_append_str(sb, "BYTECODE");
+  }
+  else if(o->type == XFORM) {
+    str_builder_append_str(sb, "#xform");
+  }
+  else if(o->type == VECTOR) {
+    str_builder_append_char(sb, '[');
+    for(int i = 0; i < o->count; i++) {
+      if(i > 0) {
+	str_builder_append_char(sb, ' ');
+      }
+      obj_print_to(sb, vector_nth(o, i), true);
+    }
+    str_builder_append_char(sb, ']');
+  }
+  else if(o->type == MAP) {
+    MapPrinter printer = { .sb = sb, .first = true };
+    str_builder_append_char(sb, '{');
+    map_visit_entries(o, print_map_entry, &printer);
+    str_builder_append_char(sb, '}');
+  }
+  else if(o->type == ARRAY) {
+    str_builder_append_char(sb, '#');
+    str_builder_append_str(sb, array_type_to_str(o->element_type));
+    str_builder_append_char(sb, '[');
+    for(int i = 0; i < o->count; i++) {
+      if(i > 0) {
+	str_builder_append_char(sb, ' ');
+      }
+      str_builder_append_number(sb, array_get(o, i));
+    }
+    str_builder_append_char(sb, ']');
+  }
+  else {
+    str_builder_append_str(sb, "UNKNOWN");
+  }
+}
+
+void print_obj(Obj *o) {
+  if(o && o->type == BYTECODE) {
     code_print((Code*)o->code);
+    return;
+  }
+  StrBuilder sb;
+  str_builder_init(&sb, 64);
+  obj_print_to(&sb, o, true);
+  fwrite(sb.data, 1, sb.length, stdout);
+  str_builder_free(&sb);
+}
+
+typedef struct {
+  Obj *other;
+  bool equal;
+} MapComparison;
+
+void compare_map_entry(Obj *key, Obj *value, void *data) {
+  MapComparison *comparison = data;
+  if(comparison->equal) {
+    Obj *other_value = map_get(comparison->other, key);
+    comparison->equal = other_value && eq(value, other_value);
   }
 }
 
 bool eq(Obj *a, Obj *b) {
+  a = lazy_unwrap(a);
+  b = lazy_unwrap(b);
   if(a == b) {
     return true;
   }
@@ -120,25 +185,181 @@ bool eq(Obj *a, Obj *b) {
     return eq(a->car, b->car) && eq(a->cdr, b->cdr);
   }
   else if(a->type == SYMBOL || a->type == STRING) {
-    return a->name == b->name || (strcmp(a->name, b->name) == 0);
+    if(a->name == b->name) {
+      return true;
+    }
+    if(a->length != b->length || (a->hash && b->hash && a->hash != b->hash)) {
+      return false;
+    }
+    return memcmp(a->name, b->name, a->length) == 0;
   }
   else if(a->type == NUMBER) {
     return a->number == b->number; // TODO: this is not a good way to compare doubles, I guess?
   }
+  else if(a->type == VECTOR) {
+    if(a->count != b->count) {
+      return false;
+    }
+    for(int i = 0; i < a->count; i++) {
+      if(!eq(vector_nth(a, i), vector_nth(b, i))) {
+	return false;
+      }
+    }
+    return true;
+  }
+  else if(a->type == MAP) {
+    if(a->count != b->count) {
+      return false;
+    }
+    MapComparison comparison = { .other = b, .equal = true };
+    map_visit_entries(a, compare_map_entry, &comparison);
+    return comparison.equal;
+  }
   else {
     return false;
   }
 }
 
+// FNV-1a
+unsigned hash_bytes(const char *bytes, int length, unsigned seed) {
+  unsigned hash = 2166136261u ^ seed;
+  for(int i = 0; i < length; i++) {
+    hash ^= (unsigned char)bytes[i];
+    hash *= 16777619u;
+  }
+  return hash;
+}
+
+unsigned hash_combine(unsigned hash, unsigned item_hash) {
+  return hash * 31 + item_hash;
+}
+
+void hash_map_entry(Obj *key, Obj *value, void *data) {
+  unsigned *hash = data;
+  *hash += obj_hash(key) ^ (obj_hash(value) * 0x9E3779B9u); // a sum, since the order of the entries is unspecified
+}
+
+unsigned obj_hash(Obj *o) {
+  o = lazy_unwrap(o);
+  if(o->type == SYMBOL || o->type == STRING) {
+    if(!o->hash) {
+      unsigned hash = hash_bytes(o->name, o->length, o->type);
+      o->hash = hash ? hash : 1; // 0 means 'not computed'
+    }
+    return o->hash;
+  }
+  else if(o->type == NUMBER) {
+    double x = o->number == 0.0 ? 0.0 : o->number; // 0.0 and -0.0 are eq
+    uint64_t bits;
+    memcpy(&bits, &x, sizeof(double));
+    bits ^= bits >> 33;
+    bits *= 0xff51afd7ed558ccdULL;
+    bits ^= bits >> 33;
+    return (unsigned)bits;
+  }
+  else if(o->type == CONS) {
+    unsigned hash = 1;
+    while(o->type == CONS && o->car && o->cdr) {
+      hash = hash_combine(hash, obj_hash(o->car));
+      o = lazy_unwrap(o->cdr);
+    }
+    return hash_combine(hash, o->type == CONS ? 0 : obj_hash(o));
+  }
+  else if(o->type == VECTOR) {
+    unsigned hash = 2;
+    for(int i = 0; i < o->count; i++) {
+      hash = hash_combine(hash, obj_hash(vector_nth(o, i)));
+    }
+    return hash;
+  }
+  else if(o->type == MAP) {
+    if(!o->map_hash) {
+      unsigned hash = 3;
+      map_visit_entries(o, hash_map_entry, &hash);
+      o->map_hash = hash ? hash : 1;
+    }
+    return o->map_hash;
+  }
+  else {
+    // Everything else is only eq to itself
+    uintptr_t address = (uintptr_t)o;
+    return (unsigned)(address ^ (address >> 32));
+  }
+}
+
+void obj_visit_refs(Obj *o, void (*visit)(Obj **ref, void *data), void *data) {
+  if(o->type == CONS || o->type == LAMBDA) {
+    if(o->car) {
+      visit(&o->car, data);
+    }
+    if(o->cdr) {
+      visit(&o->cdr, data);
+    }
+  }
+  else if(o->type == VECTOR || o->type == MAP) {
+    if(o->root) {
+      visit(&o->root, data);
+    }
+    if(o->tail) {
+      visit(&o->tail, data);
+    }
+  }
+  else if(o->type == VECTOR_NODE || o->type == MAP_NODE) {
+    for(int i = 0; i < o->count; i++) {
+      if(o->items[i]) {
+	visit(&o->items[i], data);
+      }
+    }
+  }
+  else if(o->type == ARRAY) {
+    if(o->owner) {
+      visit(&o->owner, data);
+    }
+  }
+  else if(o->type == XFORM) {
+    visit(&o->xform_arg, data);
+  }
+  else if(o->type == LAZY_SEQ) {
+    if(o->lazy_arg) {
+      visit(&o->lazy_arg, data);
+    }
+    if(o->lazy_seq) {
+      visit(&o->lazy_seq, data);
+    }
+  }
+  else if(o->type == BYTECODE) {
+    Code *code = (Code*)o->code;
+    while(*code != END_OF_CODES) {
+      Code c = *code;
+      code++;
+      for(int i = 0; i < code_obj_operand_count(c); i++) {
+	visit((Obj**)code, data);
+	code += 2;
+      }
+      if(pushes_int(c)) {
+	code++;
+      }
+    }
+  }
+}
+
 int count(Obj *list) {
   int i = 0;
-  while(list->cdr != NULL) {
+  list = lazy_unwrap(list);
+  while(list->type == CONS && list->cdr != NULL) {
     i++;
-    list = list->cdr;
+    list = lazy_unwrap(list->cdr);
   }
   return i;
 }
 
+Obj *lazy_unwrap(Obj *o) {
+  while(o && o->type == LAZY_SEQ && o->lazy_kind == LAZY_REALIZED) {
+    o = o->lazy_seq;
+  }
+  return o;
+}
+
 void obj_describe(const char *description, Obj *o) {
   printf("%s ", description);
   print_obj(o);
@@ -1,120 +1,93 @@
 #include "Parser.h"
+#include "Number.h"
+#include "Vector.h"
+#include "Map.h"
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdbool.h>
 #include <string.h>
-#include <ctype.h>
 
-typedef struct {
-  int pos;
-} Parser;
+// Every byte of the source is classified with a single table lookup.
+// Bytes not listed are allowed in symbols (this includes all UTF-8 sequences, like λ and π).
+enum {
+  CHAR_SYMBOL     = 0,
+  CHAR_WHITESPACE = 1 << 0,
+  CHAR_DELIMITER  = 1 << 1, // can't be part of a symbol
+  CHAR_DIGIT      = 1 << 2,
+};
 
-Parser *parser_make() {
-  Parser *p = malloc(sizeof(Parser));
-  p->pos = 0;
-  return p;
-}
+static const unsigned char char_class[256] = {
+  ['\0'] = CHAR_DELIMITER,
+  [' ']  = CHAR_WHITESPACE | CHAR_DELIMITER,
+  ['\t'] = CHAR_WHITESPACE | CHAR_DELIMITER,
+  ['\n'] = CHAR_WHITESPACE | CHAR_DELIMITER,
+  ['\r'] = CHAR_WHITESPACE | CHAR_DELIMITER,
+  ['(']  = CHAR_DELIMITER,
+  [')']  = CHAR_DELIMITER,
+  ['[']  = CHAR_DELIMITER,
+  [']']  = CHAR_DELIMITER,
+  ['{']  = CHAR_DELIMITER,
+  ['}']  = CHAR_DELIMITER,
+  ['"']  = CHAR_DELIMITER,
+  [';']  = CHAR_DELIMITER,
+  ['#']  = CHAR_DELIMITER,
+  ['0']  = CHAR_DIGIT, ['1'] = CHAR_DIGIT, ['2'] = CHAR_DIGIT, ['3'] = CHAR_DIGIT, ['4'] = CHAR_DIGIT,
+  ['5']  = CHAR_DIGIT, ['6'] = CHAR_DIGIT, ['7'] = CHAR_DIGIT, ['8'] = CHAR_DIGIT, ['9'] = CHAR_DIGIT,
+};
 
-Obj *parse_list(GC *gc, Parser *p, const char *source);
+#define CHAR_CLASS(c) (char_class[(unsigned char)(c)])
 
-bool iswhitespace(char c) {
-  return c == ' ' || c == '\t' || c == '\n';
-}
+Obj *parse_form(GC *gc, Parser *p);
 
-static const char *reserved = "()#\";\0";
-  
-bool isokinsymbol(char c, bool is_first_char) {
-  for (int i = 0; i < strlen(reserved); i++) {
-    if((is_first_char && isdigit(c)) ||
-       (is_first_char && c == '\'') ||
-       reserved[i] == c ||
-       iswhitespace(c)) {
-      return false;
-    }
-  }
-  return true;
+// Copies the token between start and end into a new string, this is the only allocation made for a token.
+char *copy_token(const char *start, const char *end) {
+  size_t length = end - start;
+  char *s = malloc(length + 1);
+  memcpy(s, start, length);
+  s[length] = '\0';
+  return s;
 }
 
-Obj *parse_form(GC *gc, Parser *p, const char *source) {
-  //printf("Parsing form\n");
-  if (source[p->pos] == '(') {
-    //printf("Found (\n");
-    return parse_list(gc, p, source);
-  }
-  else if(source[p->pos] == ';') {
-    while(source[p->pos] != '\n' && source[p->pos] != '\0') {
+void skip_whitespace_and_comments(Parser *p) {
+  while(p->pos < p->end) {
+    char c = *p->pos;
+    if(CHAR_CLASS(c) & CHAR_WHITESPACE) {
       p->pos++;
     }
-  }
-  else if(source[p->pos] == '\'') {
-    p->pos++;
-    Obj *quote = gc_make_symbol(gc, "quote");
-    Obj *quoted_form = parse_form(gc, p, source);
-    Obj *rest = gc_make_cons(gc, quoted_form, gc->nil);
-    Obj *cons = gc_make_cons(gc, quote, rest);
-    return cons;
-  }
-  else if(isokinsymbol(source[p->pos], true)) {
-    char *name = malloc(sizeof(char) * 256);
-    int i = 0;
-    while(isokinsymbol(source[p->pos], false)) {
-      name[i++] = source[p->pos];
-      p->pos++;
-      if(i >= 256) {
-	name[256] = '\0';
-	error("Can't have symbols longer than 256 chars: ");
-	printf("%s\n", name);
-      }
+    else if(c == ';') {
+      const char *newline = memchr(p->pos, '\n', p->end - p->pos);
+      p->pos = newline ? newline + 1 : p->end;
     }
-    name[i] = '\0';
-    return gc_make_symbol_from_malloced_string(gc, name);
-  }
-  else if(source[p->pos] == '"') {
-    char *text = malloc(sizeof(char) * 256);
-    int i = 0;
-    p->pos++;
-    while(source[p->pos] != '"' && source[p->pos] != '\0') {
-      text[i++] = source[p->pos];
-      p->pos++;
+    else {
+      return;
     }
-    text[i] = '\0';
-    return gc_make_string(gc, text); // TODO: use other function here?
-  }
-  else if(isdigit(source[p->pos])) {
-    char s[256];
-    int i = 0;
-    bool hit_period = false;
-    while((isdigit(source[p->pos]) || (source[p->pos] == '.' && !hit_period)) &&
-	  source[p->pos] != '\0')
-    {
-      s[i++] = source[p->pos];
-      if(source[p->pos] == '.') {
-	hit_period = true;
-      }
-      p->pos++;
-    }
-    s[i] = '\0';
-    double num = atof(s);
-    return gc_make_number(gc, num);
   }
-  
-  return NULL;
 }
 
-Obj *parse_list(GC *gc, Parser *p, const char *source) {
+Obj *parse_list(GC *gc, Parser *p) {
   Obj *list = gc->nil;
   Obj *last_cons = NULL;
 
   p->pos++; // move beyond the first paren
 
-  if(source[p->pos] == ')') {
-    p->pos++;
-    return list;
-  }
-  
   while(1) {
-        
-    Obj *item = parse_form(gc, p, source);
+    skip_whitespace_and_comments(p);
+
+    if(p->pos >= p->end) {
+      printf("Parser error: Missing ending parenthesis.\n");
+      p->failed = true;
+      return NULL;
+    }
+
+    if(*p->pos == ')') {
+      p->pos++;
+      break;
+    }
+
+    Obj *item = parse_form(gc, p);
+    if(p->failed) {
+      return NULL;
+    }
     if(item) {
       Obj *new = gc_make_cons(gc, item, gc->nil);
       if(last_cons) {
@@ -124,44 +97,203 @@ Obj *parse_list(GC *gc, Parser *p, const char *source) {
       }
       last_cons = new;
     }
+  }
 
-    if(source[p->pos] == '\0') {
-      printf("Parser error: Missing ending parenthesis.\n");
+  return list;
+}
+
+Obj *parse_vector(GC *gc, Parser *p) {
+  Obj *vector = gc_make_vector(gc, NULL, NULL, 0, VECTOR_BITS);
+
+  p->pos++; // move beyond the first bracket
+
+  while(1) {
+    skip_whitespace_and_comments(p);
+
+    if(p->pos >= p->end) {
+      printf("Parser error: Missing ending bracket.\n");
+      p->failed = true;
+      return NULL;
+    }
+
+    if(*p->pos == ']') {
+      p->pos++;
+      break;
+    }
+
+    Obj *item = parse_form(gc, p);
+    if(p->failed) {
+      return NULL;
+    }
+    if(item) {
+      vector = vector_conj(gc, vector, item);
+    }
+  }
+
+  return vector;
+}
+
+Obj *parse_map(GC *gc, Parser *p) {
+  Obj *map = gc_make_map(gc, NULL, 0);
+  Obj *key = NULL;
+
+  p->pos++; // move beyond the first brace
+
+  while(1) {
+    skip_whitespace_and_comments(p);
+
+    if(p->pos >= p->end) {
+      printf("Parser error: Missing ending brace.\n");
+      p->failed = true;
       return NULL;
     }
 
-    if(source[p->pos] == ')') {
+    if(*p->pos == '}') {
       p->pos++;
       break;
     }
-    
+
+    Obj *item = parse_form(gc, p);
+    if(p->failed) {
+      return NULL;
+    }
+    if(!item) {
+      continue;
+    }
+    if(key) {
+      map = map_assoc(gc, map, key, item);
+      key = NULL;
+    } else {
+      key = item;
+    }
+  }
+
+  if(key) {
+    printf("Parser error: Map literal is missing a value for its last key.\n");
+    p->failed = true;
+    return NULL;
+  }
+
+  return map;
+}
+
+Obj *parse_string(GC *gc, Parser *p) {
+  const char *start = ++p->pos; // skip the opening quote
+  const char *closing = memchr(start, '"', p->end - start);
+  if(!closing) {
+    printf("Parser error: Missing ending quote for string.\n");
+    p->failed = true;
+    return NULL;
+  }
+  p->pos = closing + 1;
+  return gc_make_string_with_length(gc, copy_token(start, closing), closing - start);
+}
+
+Obj *parse_number(GC *gc, Parser *p) {
+  double num;
+  p->pos = number_parse(p->pos, p->end, &num);
+  return gc_make_number(gc, num);
+}
+
+Obj *parse_symbol(GC *gc, Parser *p) {
+  const char *start = p->pos;
+  while(p->pos < p->end && !(CHAR_CLASS(*p->pos) & CHAR_DELIMITER)) {
     p->pos++;
   }
+  return gc_make_symbol_from_malloced_string(gc, copy_token(start, p->pos));
+}
 
-  return list;
+// Parses the form at the current position, returns NULL if there is nothing to parse.
+Obj *parse_form(GC *gc, Parser *p) {
+  skip_whitespace_and_comments(p);
+  if(p->pos >= p->end) {
+    return NULL;
+  }
+
+  char c = *p->pos;
+  unsigned char kind = CHAR_CLASS(c);
+
+  if(c == '(') {
+    return parse_list(gc, p);
+  }
+  else if(c == ')') {
+    printf("Parser error: Unexpected ending parenthesis.\n");
+    p->pos++;
+    return NULL;
+  }
+  else if(c == '[') {
+    return parse_vector(gc, p);
+  }
+  else if(c == ']') {
+    printf("Parser error: Unexpected ending bracket.\n");
+    p->pos++;
+    return NULL;
+  }
+  else if(c == '{') {
+    return parse_map(gc, p);
+  }
+  else if(c == '}') {
+    printf("Parser error: Unexpected ending brace.\n");
+    p->pos++;
+    return NULL;
+  }
+  else if(c == '"') {
+    return parse_string(gc, p);
+  }
+  else if(c == '\'') {
+    p->pos++;
+    Obj *quoted_form = parse_form(gc, p);
+    if(!quoted_form) {
+      return NULL;
+    }
+    Obj *quote = gc_make_symbol(gc, "quote");
+    Obj *rest = gc_make_cons(gc, quoted_form, gc->nil);
+    return gc_make_cons(gc, quote, rest);
+  }
+  else if((kind & CHAR_DIGIT) || (c == '-' && p->pos + 1 < p->end && (CHAR_CLASS(p->pos[1]) & CHAR_DIGIT))) {
+    return parse_number(gc, p);
+  }
+  else if(kind & CHAR_DELIMITER) {
+    p->pos++; // skip stray characters like '#'
+    return NULL;
+  }
+  else {
+    return parse_symbol(gc, p);
+  }
+}
+
+void parser_init(Parser *p, const char *source, size_t length) {
+  p->pos = source;
+  p->end = source + length;
+  p->failed = false;
+}
+
+Obj *parser_next_form(GC *gc, Parser *p) {
+  while(p->pos < p->end && !p->failed) {
+    Obj *form = parse_form(gc, p);
+    if(form) {
+      return form;
+    }
+  }
+  return NULL;
 }
 
 Obj *parse(GC *gc, const char *source) {
-  Parser* p = parser_make();
-  int source_len = strlen(source);
-  int parens = 0;
+  Parser p;
+  parser_init(&p, source, strlen(source));
 
   Obj *forms = gc->nil;
   Obj *last_cons = NULL;
-  
-  while(p->pos < source_len) {
-    Obj *form = parse_form(gc, p, source);
-    if(form) {
-      Obj *new = gc_make_cons(gc, form, gc->nil);
-      if(last_cons) {
-	last_cons->cdr = new;
-      } else {
-	forms = new;
-      }
-      last_cons = new;
-    }
 
-    p->pos++;
+  Obj *form;
+  while((form = parser_next_form(gc, &p))) {
+    Obj *new = gc_make_cons(gc, form, gc->nil);
+    if(last_cons) {
+      last_cons->cdr = new;
+    } else {
+      forms = new;
+    }
+    last_cons = new;
   }
 
   return forms;
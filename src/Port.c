@@ -0,0 +1,53 @@
+#include "Port.h"
+#include <string.h>
+
+#define PORT_BUFFER_SIZE (64 * 1024)
+
+void port_init(Port *port, FILE *file, PortBuffering buffering) {
+  str_builder_init(&port->buffer, PORT_BUFFER_SIZE);
+  port->file = file;
+  port->buffering = buffering;
+  port->flush_size = PORT_BUFFER_SIZE;
+}
+
+void port_free(Port *port) {
+  port_flush(port);
+  str_builder_free(&port->buffer);
+}
+
+void port_flush(Port *port) {
+  if(port->buffer.length > 0) {
+    fwrite(port->buffer.data, 1, port->buffer.length, port->file);
+    str_builder_clear(&port->buffer);
+  }
+  fflush(port->file);
+}
+
+// Called after something has been written to the buffer, starting at 'start'.
+void port_written(Port *port, int start) {
+  if(port->buffer.length >= port->flush_size) {
+    port_flush(port);
+  }
+  else if(port->buffering == PORT_BUFFER_LINE &&
+	  memchr(port->buffer.data + start, '\n', port->buffer.length - start)) {
+    port_flush(port);
+  }
+}
+
+void port_write(Port *port, const char *s, int length) {
+  int start = port->buffer.length;
+  str_builder_append(&port->buffer, s, length);
+  port_written(port, start);
+}
+
+void port_write_char(Port *port, char c) {
+  int start = port->buffer.length;
+  str_builder_append_char(&port->buffer, c);
+  port_written(port, start);
+}
+
+void port_write_obj(Port *port, Obj *o, bool readably) {
+  int start = port->buffer.length;
+  obj_print_to(&port->buffer, o, readably); // the printer writes straight into the buffer
+  port_written(port, start);
+}
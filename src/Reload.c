@@ -0,0 +1,112 @@
+#include "Reload.h"
+#include <stdlib.h>
+#include <string.h>
+
+void form_hashes_init(FormHashes *forms) {
+  forms->hashes = NULL;
+  forms->names = NULL;
+  forms->count = 0;
+  forms->capacity = 0;
+}
+
+void form_hashes_free(FormHashes *forms) {
+  for(int i = 0; i < forms->count; i++) {
+    free(forms->names[i]);
+  }
+  free(forms->hashes);
+  free(forms->names);
+}
+
+void form_hashes_add(FormHashes *forms, unsigned hash, const char *name) {
+  if(forms->count == forms->capacity) {
+    forms->capacity = forms->capacity ? forms->capacity * 2 : 64;
+    forms->hashes = realloc(forms->hashes, sizeof(unsigned) * forms->capacity);
+    forms->names = realloc(forms->names, sizeof(char*) * forms->capacity);
+  }
+  forms->hashes[forms->count] = hash;
+  forms->names[forms->count] = name ? strdup(name) : NULL;
+  forms->count++;
+}
+
+int form_hashes_find(FormHashes *forms, unsigned hash, bool used[], int start) {
+  for(int n = 0; n < forms->count; n++) {
+    int i = (start + n) % forms->count;
+    if(forms->hashes[i] == hash && !used[i]) {
+      return i;
+    }
+  }
+  return -1;
+}
+
+bool form_hashes_defines(FormHashes *forms, const char *name) {
+  for(int i = 0; i < forms->count; i++) {
+    if(forms->names[i] && strcmp(forms->names[i], name) == 0) {
+      return true;
+    }
+  }
+  return false;
+}
+
+const char *form_defined_name(Obj *form) {
+  if(form->type != CONS || !form->car || form->car->type != SYMBOL ||
+     (strcmp(form->car->name, "def") != 0 && strcmp(form->car->name, "defmacro") != 0)) {
+    return NULL;
+  }
+  Obj *rest = form->cdr;
+  if(rest->type != CONS || !rest->car || rest->car->type != SYMBOL) {
+    return NULL;
+  }
+  return rest->car->name;
+}
+
+void loaded_files_init(LoadedFiles *files) {
+  files->paths = NULL;
+  files->forms = NULL;
+  files->count = 0;
+  files->capacity = 0;
+}
+
+void loaded_files_free(LoadedFiles *files) {
+  for(int i = 0; i < files->count; i++) {
+    free(files->paths[i]);
+    form_hashes_free(&files->forms[i]);
+  }
+  free(files->paths);
+  free(files->forms);
+}
+
+FormHashes *loaded_files_get(LoadedFiles *files, const char *path) {
+  for(int i = 0; i < files->count; i++) {
+    if(strcmp(files->paths[i], path) == 0) {
+      return &files->forms[i];
+    }
+  }
+  return NULL;
+}
+
+void loaded_files_take(LoadedFiles *files, const char *path, FormHashes *OUT_forms) {
+  FormHashes *forms = loaded_files_get(files, path);
+  if(forms) {
+    *OUT_forms = *forms;
+    form_hashes_init(forms);
+  } else {
+    form_hashes_init(OUT_forms);
+  }
+}
+
+void loaded_files_put(LoadedFiles *files, const char *path, FormHashes *forms) {
+  FormHashes *old = loaded_files_get(files, path);
+  if(old) {
+    form_hashes_free(old);
+    *old = *forms;
+    return;
+  }
+  if(files->count == files->capacity) {
+    files->capacity = files->capacity ? files->capacity * 2 : 8;
+    files->paths = realloc(files->paths, sizeof(char*) * files->capacity);
+    files->forms = realloc(files->forms, sizeof(FormHashes) * files->capacity);
+  }
+  files->paths[files->count] = strdup(path);
+  files->forms[files->count] = *forms;
+  files->count++;
+}
@@ -2,12 +2,20 @@
 #include "Parser.h"
 #include "BuiltinFuncs.h"
 #include "Compiler.h"
+#include "Serialize.h"
+#include "Image.h"
+#include "Isolate.h"
 
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdbool.h>
 #include <string.h>
 #include <ctype.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
 
 #define TAIL_CALLS_ENABLED 1
 
@@ -20,7 +28,11 @@
 
 #define HAS_PARENT_ENV(env) (env->cdr != NULL)
 
-void runtime_eval_internal(Runtime *r, Obj *env, const char *source, bool print_result, int top_frame_index, int break_frame_index);
+void eval_top_form_safely(Runtime *r, Obj *env, Obj *form, Serializer *cache, bool print_result, int top_frame_index, int break_frame_index);
+void runtime_eval_internal(Runtime *r, Obj *env, const char *source, size_t length, Serializer *cache, bool print_result, int top_frame_index, int break_frame_index);
+bool runtime_load_code_cache(Runtime *r, const char *filename, const char *cache_path, const struct stat *source_stat);
+void run_top_code_safely(Runtime *r, Obj *code_obj, int top_frame_index);
+void run_top_code(Runtime *r, Code *bytecode, int top_frame_index, int break_frame_index);
 Obj *runtime_apply(Runtime *r, Obj *args[], int arg_count);
   
 // The environments root is a cons cell where the car
@@ -49,6 +61,34 @@ void runtime_env_assoc(Runtime *r, Obj *env, Obj *key, Obj *value) {
   }
 }
 
+// Like 'runtime_env_find_pair' but a binding that is only found in the parent of 'env' (the frozen env of a code heap)
+// is copied into 'env' first. Code compiled by the runtime then refers to its own binding, which a redefinition updates.
+// The frozen code finds the copy of a global through the overlay of the runtime, so it sees the redefinition too.
+Obj *runtime_env_find_or_inherit_pair(Runtime *r, Obj *env, Obj *key) {
+  Obj *pair = runtime_env_find_pair(env, key);
+  if(!pair && env->cdr) {
+    Obj *inherited = runtime_env_find_pair(env->cdr, key);
+    if(inherited) {
+      runtime_env_assoc(r, env, key, inherited->cdr);
+      pair = runtime_env_find_pair(env, key);
+      if(env == r->global_env && r->code_heap) {
+	code_heap_set_overlay(r, inherited, pair);
+      }
+    }
+  }
+  return pair;
+}
+
+// Returns the binding pair of 'key', a new one (bound to nil) is added to 'env' if it doesn't have one, or inherit one.
+Obj *runtime_env_find_or_define_pair(Runtime *r, Obj *env, Obj *key) {
+  Obj *pair = runtime_env_find_or_inherit_pair(r, env, key);
+  if(!pair) {
+    pair = gc_make_cons(r->gc, key, r->nil);
+    env->car = gc_make_cons(r->gc, pair, env->car);
+  }
+  return pair;
+}
+
 Obj *runtime_env_lookup(Obj *env, Obj *key) {
   Obj *pair = runtime_env_find_pair(env, key);
   if(pair) {
@@ -121,42 +161,317 @@ void runtime_print_frames(Runtime *r) {
   printf("\e[0m\n");
 }
 
+// (gc) only marks, the dead objects are swept as the program allocates new ones.
 Obj *runtime_gc_collect(Runtime *r, Obj *args[], int arg_count) {
-  gc_collect(r->gc);
+  gc_collect_lazily(r->gc);
   return r->nil;
 }
 
+// (gc-threads n) sets how many threads the GC marks and sweeps with, returns the count that is used.
+Obj *runtime_gc_threads(Runtime *r, Obj *args[], int arg_count) {
+  if(arg_count != 1 || args[0]->type != NUMBER) {
+    printf("Must call 'gc-threads' with a number.\n");
+    return r->nil;
+  }
+  gc_set_thread_count(r->gc, (int)args[0]->number);
+  return gc_make_number(r->gc, r->gc->thread_count);
+}
+
+// Files are remembered by their real path, so that they're found however they're named when reloaded
+static char *loaded_file_path(const char *filename) {
+  char *path = realpath(filename, NULL);
+  return path ? path : strdup(filename);
+}
+
+// Map the file instead of reading it, pages are brought in as the parser reaches them
+// and only one top-level form at a time is turned into objects. Returns NULL if the file can't be read,
+// an empty file has no mapping (and is "" with the length 0). The stat is of the file that was mapped.
+static char *map_source_file(const char *filename, size_t *OUT_length, struct stat *OUT_stat) {
+  int fd = open(filename, O_RDONLY);
+  if(fd < 0) {
+    printf("Failed to open file: %s\n", filename);
+    return NULL;
+  }
+
+  if(fstat(fd, OUT_stat) < 0) {
+    printf("Failed to read size of file: %s\n", filename);
+    close(fd);
+    return NULL;
+  }
+
+  *OUT_length = OUT_stat->st_size;
+  if(*OUT_length == 0) {
+    close(fd);
+    return "";
+  }
+
+  char *source = mmap(NULL, *OUT_length, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if(source == MAP_FAILED) {
+    printf("Failed to map file: %s\n", filename);
+    return NULL;
+  }
+  madvise(source, *OUT_length, MADV_SEQUENTIAL);
+  return source;
+}
+
+static void unmap_source_file(char *source, size_t length) {
+  if(length > 0) {
+    munmap(source, length);
+  }
+}
+
 bool runtime_load_file(Runtime *r, const char *filename, bool silent) {
   if(!silent) {
     printf("Loading '%s' - ", filename);
   }
-  
-  char * buffer = 0;
-  long length;
-  FILE * f = fopen (filename, "rb");
-
-  if(f) {
-    fseek (f, 0, SEEK_END);
-    length = ftell (f);
-    fseek (f, 0, SEEK_SET);
-    buffer = malloc (length + 1);
-    if (buffer)	{
-      fread (buffer, 1, length, f);
-      buffer[length] = '\0';
-    }
-    fclose (f);
-  } else {
-    printf("Failed to open file: %s\n", filename);
+
+  // Skip parsing and compiling if there is a precompiled version of the file
+  char cache_path[2048];
+  bool cacheable = code_cache_path(filename, cache_path, sizeof(cache_path));
+  struct stat source_stat;
+  if(cacheable && stat(filename, &source_stat) == 0 && runtime_load_code_cache(r, filename, cache_path, &source_stat)) {
+    return true;
+  }
+
+  size_t length = 0;
+  char *source = map_source_file(filename, &length, &source_stat);
+  if(!source) {
     return false;
   }
 
-  if (buffer) {
-    runtime_eval_internal(r, r->global_env, buffer, false, r->top_frame + 1, -1);
-    return true;
-  } else {
-    printf("Failed to open buffer from file: %s\n", filename);
+  Serializer cache;
+  serializer_init(&cache);
+  FormHashes forms;
+  form_hashes_init(&forms);
+
+  Parser parser;
+  parser_init(&parser, source, length);
+  Obj *form;
+  while((form = parser_next_form(r->gc, &parser))) {
+    unsigned hash = obj_hash(form);
+    const char *name = form_defined_name(form);
+    form_hashes_add(&forms, hash, name);
+    code_cache_write_form_info(&cache, hash, name);
+    eval_top_form_safely(r, r->global_env, form, &cache, false, r->top_frame + 1, -1);
+  }
+  port_flush(&r->out);
+
+  unmap_source_file(source, length);
+
+  char *path = loaded_file_path(filename);
+  loaded_files_put(&r->loaded_files, path, &forms);
+  free(path);
+
+  if(cacheable && length > 0) {
+    code_cache_write(&cache, cache_path, &source_stat);
+  }
+  serializer_free(&cache);
+  return true;
+}
+
+static void free_macro_deps(MacroDeps *deps, int count) {
+  for(int i = 0; i < count; i++) {
+    macro_deps_free(&deps[i]);
+  }
+  free(deps);
+}
+
+// True if the macros are still defined the way they were when the code that expanded them was compiled
+static bool macro_deps_are_current(Runtime *r, MacroDeps *deps) {
+  for(int i = 0; i < deps->count; i++) {
+    Obj *pair = NULL;
+    for(Obj *env = r->macros; env && !pair; env = env->cdr) {
+      for(Obj *current = env->car; current->car; current = current->cdr) {
+	if(strcmp(current->car->car->name, deps->names[i]) == 0) {
+	  pair = current->car;
+	  break;
+	}
+      }
+    }
+    if(!pair || macro_hash(pair->cdr) != deps->hashes[i]) {
+      return false;
+    }
+  }
+  return true;
+}
+
+// Returns false if there's no cache for this version of the source, or if it's broken. The whole cache is read
+// before any of it runs, so that a broken one hasn't run half of the file when it's then loaded from the source.
+bool runtime_load_code_cache(Runtime *r, const char *filename, const char *cache_path, const struct stat *source_stat) {
+  int fd = open(cache_path, O_RDONLY);
+  if(fd < 0) {
+    return false;
+  }
+  struct stat file_stat;
+  if(fstat(fd, &file_stat) < 0 || file_stat.st_size == 0) {
+    close(fd);
+    return false;
+  }
+  size_t length = file_stat.st_size;
+  char *data = mmap(NULL, length, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if(data == MAP_FAILED) {
+    return false;
+  }
+
+  Deserializer d;
+  deserializer_init(&d, data, length);
+  if(!code_cache_read_header(&d, source_stat)) {
+    munmap(data, length);
     return false;
   }
+
+  FormHashes forms;
+  form_hashes_init(&forms);
+  MacroDeps *deps = NULL; // one for each form
+  Obj *codes = gc_make_cons(r->gc, r->nil, r->nil); // the BYTECODE objects hang off a rooted head cons
+  gc_stack_push(r->gc, codes);
+  Obj *last = codes;
+  while(d.pos < d.end) {
+    unsigned hash;
+    char *name;
+    Code *bytecode = NULL;
+    if(code_cache_read_form_info(&d, &hash, &name)) {
+      form_hashes_add(&forms, hash, name);
+      free(name);
+      deps = realloc(deps, sizeof(MacroDeps) * forms.count);
+      macro_deps_init(&deps[forms.count - 1]);
+      if(code_cache_read_macro_deps(&d, &deps[forms.count - 1])) {
+	bytecode = deserialize_code(&d, r);
+      }
+    }
+    if(!bytecode) {
+      d.failed = true;
+      break;
+    }
+    last->cdr = gc_make_cons(r->gc, gc_make_bytecode(r->gc, bytecode), r->nil);
+    last = last->cdr;
+  }
+  munmap(data, length);
+
+  if(d.failed) {
+    printf("Broken code cache: %s\n", cache_path);
+    free_macro_deps(deps, forms.count);
+    form_hashes_free(&forms);
+    gc_stack_pop_safely(r->gc);
+    return false;
+  }
+
+  // A form that expanded a macro which has been redefined since (in another file, most likely) is compiled again
+  // from the source. The cache is then removed, the next load writes a new one.
+  bool stale = false;
+  char *source = NULL;
+  size_t source_length = 0;
+  Parser parser;
+  int parsed_count = 0;
+  int top_frame_index = r->top_frame + 1;
+  int i = 0;
+  for(Obj *code = codes->cdr; code->type == CONS && code->car; code = code->cdr, i++) {
+    if(macro_deps_are_current(r, &deps[i])) {
+      run_top_code_safely(r, code->car, top_frame_index);
+      continue;
+    }
+    if(!source) {
+      struct stat current_stat;
+      source = map_source_file(filename, &source_length, &current_stat);
+      if(!source) {
+	break;
+      }
+      parser_init(&parser, source, source_length);
+    }
+    Obj *form = NULL;
+    while(parsed_count <= i && (form = parser_next_form(r->gc, &parser))) {
+      parsed_count++;
+    }
+    if(form) {
+      eval_top_form_safely(r, r->global_env, form, NULL, false, top_frame_index, -1);
+    }
+    stale = true;
+  }
+  port_flush(&r->out);
+  gc_stack_pop_safely(r->gc);
+  free_macro_deps(deps, forms.count);
+  if(source) {
+    unmap_source_file(source, source_length);
+  }
+  if(stale) {
+    unlink(cache_path);
+  }
+
+  char *path = loaded_file_path(filename);
+  loaded_files_put(&r->loaded_files, path, &forms);
+  free(path);
+  return true;
+}
+
+// A form that is still in the file (has the same hash as one of the forms that were loaded) isn't evaluated again,
+// so a (def score 0) keeps the current score. The forms that are evaluated update the existing binding pairs,
+// and since compiled code refers to those pairs directly every caller sees the new definitions right away.
+// Forms that were removed from the file are reported, but what they defined stays defined.
+Obj *runtime_reload_file(Runtime *r, const char *filename) {
+  size_t length = 0;
+  struct stat source_stat;
+  char *source = map_source_file(filename, &length, &source_stat);
+  if(!source) {
+    return NULL;
+  }
+
+  // The old forms are taken out of the table, a changed form that loads a file would otherwise move them
+  char *path = loaded_file_path(filename);
+  FormHashes old_forms;
+  loaded_files_take(&r->loaded_files, path, &old_forms);
+  FormHashes *old = &old_forms;
+  bool *used = calloc(old->count + 1, sizeof(bool));
+  FormHashes forms;
+  form_hashes_init(&forms);
+
+  // The names are collected in a list that hangs off a rooted head cons, the evaluated forms can run the GC
+  Obj *head = gc_make_cons(r->gc, r->nil, r->nil);
+  gc_stack_push(r->gc, head);
+  Obj *last = head;
+
+  printf("Reloading '%s'\n", filename);
+  int next = 0;
+  int unchanged = 0;
+  int evaluated = 0;
+  Parser parser;
+  parser_init(&parser, source, length);
+  Obj *form;
+  while((form = parser_next_form(r->gc, &parser))) {
+    unsigned hash = obj_hash(form);
+    const char *name = form_defined_name(form);
+    form_hashes_add(&forms, hash, name);
+    int match = form_hashes_find(old, hash, used, next);
+    if(match >= 0) {
+      used[match] = true;
+      next = match + 1;
+      unchanged++;
+      continue;
+    }
+    if(name) {
+      printf("  %s %s\n", form_hashes_defines(old, name) ? "changed" : "added", name);
+      last->cdr = gc_make_cons(r->gc, SECOND(form), r->nil);
+      last = last->cdr;
+    }
+    eval_top_form_safely(r, r->global_env, form, NULL, false, r->top_frame + 1, -1);
+    evaluated++;
+  }
+  for(int i = 0; i < old->count; i++) {
+    if(!used[i] && old->names[i] && !form_hashes_defines(&forms, old->names[i])) {
+      printf("  removed %s (it's still defined)\n", old->names[i]);
+    }
+  }
+  printf("%d form%s evaluated, %d unchanged.\n", evaluated, evaluated == 1 ? "" : "s", unchanged);
+  port_flush(&r->out);
+
+  loaded_files_put(&r->loaded_files, path, &forms);
+  form_hashes_free(&old_forms);
+  free(used);
+  free(path);
+  unmap_source_file(source, length);
+  gc_stack_pop_safely(r->gc);
+  return head->cdr;
 }
 
 Obj *runtime_load(Runtime *r, Obj *args[], int arg_count) {
@@ -169,6 +484,88 @@ Obj *runtime_load(Runtime *r, Obj *args[], int arg_count) {
   }
 }
 
+// (reload "file.lisp") evaluates the forms that changed since the file was loaded, returns the names that were defined
+Obj *runtime_reload(Runtime *r, Obj *args[], int arg_count) {
+  ASSERT_ARG_COUNT("reload", 1);
+  ASSERT_ARG_TYPE("reload", 0, STRING);
+  Obj *names = runtime_reload_file(r, args[0]->name);
+  return names ? names : r->nil;
+}
+
+Obj *runtime_save_image(Runtime *r, Obj *args[], int arg_count) {
+  ASSERT_ARG_COUNT("save-image", 1);
+  ASSERT_ARG_TYPE("save-image", 0, STRING);
+  if(image_save(r, args[0]->name)) {
+    return r->true_val;
+  } else {
+    printf("Failed to save image to '%s'.\n", args[0]->name);
+    return r->nil;
+  }
+}
+
+// (spawn f & args) calls f with the args in a new isolate, returns the id of the isolate.
+Obj *runtime_spawn(Runtime *r, Obj *args[], int arg_count) {
+  if(arg_count < 1) {
+    printf("Must call 'spawn' with a function and the args for it.\n");
+    return r->nil;
+  }
+  int id = isolate_spawn(r, args[0], args + 1, arg_count - 1);
+  if(id < 0) {
+    printf("Can't spawn, the function must be a builtin or a lambda that doesn't capture any locals, and the args must be data.\n");
+    return r->nil;
+  }
+  return gc_make_number(r->gc, id);
+}
+
+// (send id message) copies the message to the mailbox of the isolate, returns the message.
+Obj *runtime_send(Runtime *r, Obj *args[], int arg_count) {
+  ASSERT_ARG_COUNT("send", 2);
+  ASSERT_ARG_TYPE("send", 0, NUMBER);
+  if(!isolate_send(r, (int)args[0]->number, args[1])) {
+    printf("Failed to send to isolate %d, it doesn't exist or the message isn't data.\n", (int)args[0]->number);
+    return r->nil;
+  }
+  return args[1];
+}
+
+// (receive) waits for the next message, (receive seconds) returns nil if none arrives in time.
+Obj *runtime_receive(Runtime *r, Obj *args[], int arg_count) {
+  if(arg_count > 1 || (arg_count == 1 && args[0]->type != NUMBER)) {
+    printf("Must call 'receive' with no args or a timeout in seconds.\n");
+    return r->nil;
+  }
+  Obj *message = isolate_receive(r, arg_count == 1 ? args[0]->number : -1.0);
+  return message ? message : r->nil;
+}
+
+Obj *runtime_self(Runtime *r, Obj *args[], int arg_count) {
+  ASSERT_ARG_COUNT("self", 0);
+  return gc_make_number(r->gc, isolate_self(r));
+}
+
+Obj *runtime_flush(Runtime *r, Obj *args[], int arg_count) {
+  ASSERT_ARG_COUNT("flush", 0);
+  port_flush(&r->out);
+  return r->nil;
+}
+
+Obj *runtime_set_output_buffering(Runtime *r, Obj *args[], int arg_count) {
+  ASSERT_ARG_COUNT("set-output-buffering", 1);
+  ASSERT_ARG_TYPE("set-output-buffering", 0, SYMBOL);
+  if(strcmp(args[0]->name, "line") == 0) {
+    r->out.buffering = PORT_BUFFER_LINE;
+  }
+  else if(strcmp(args[0]->name, "full") == 0) {
+    r->out.buffering = PORT_BUFFER_FULL;
+  }
+  else {
+    printf("Output buffering must be 'line or 'full.\n");
+    return r->nil;
+  }
+  port_flush(&r->out);
+  return args[0];
+}
+
 Obj *runtime_push_value(Runtime *r, Obj *args[], int arg_count) {
   ASSERT_ARG_COUNT("push", 1);
   gc_stack_push(r->gc, args[0]);
@@ -239,11 +636,56 @@ void register_builtin_funcs(Runtime *r) {
   register_func(r, "string?", &string_p);
   register_func(r, "callable?", &callable_p);
   register_func(r, "bytecode?", &bytecode_p);
+  register_func(r, "vector?", &vector_p);
+  register_func(r, "vector", &vector);
+  register_func(r, "conj", &internal_conj);
+  register_func(r, "nth", &nth);
+  register_func(r, "assoc", &assoc);
+  register_func(r, "count", &count_items);
+  register_func(r, "map", &map);
+  register_func(r, "keep", &keep);
+  register_func(r, "filter", &filter);
+  register_func(r, "remove", &internal_remove);
+  register_func(r, "reduce", &reduce);
+  register_func(r, "range", &range);
+  register_func(r, "take", &take);
+  register_func(r, "mapping", &mapping);
+  register_func(r, "filtering", &filtering);
+  register_func(r, "taking", &taking);
+  register_func(r, "transduce", &transduce);
+  register_func(r, "replicate", &replicate);
+  register_func(r, "zip", &zip);
+  register_func(r, "reverse", &reverse);
+  register_func(r, "concat", &concat);
+  register_func(r, "map?", &map_p);
+  register_func(r, "hash-map", &hash_map);
+  register_func(r, "get", &get);
+  register_func(r, "dissoc", &dissoc);
+  register_func(r, "keys", &keys);
+  register_func(r, "vals", &vals);
+  register_func(r, "make-f64array", &make_f64array);
+  register_func(r, "make-f32array", &make_f32array);
+  register_func(r, "make-i32array", &make_i32array);
+  register_func(r, "array?", &array_p);
+  register_func(r, "aget", &aget);
+  register_func(r, "aset!", &aset);
+  register_func(r, "aslice", &aslice);
+  register_func(r, "a+", &array_add);
+  register_func(r, "a-", &array_sub);
+  register_func(r, "a*", &array_mul);
+  register_func(r, "a/", &array_div);
+  register_func(r, "afma", &array_fma);
+  register_func(r, "aclamp", &array_clamp);
+  register_func(r, "asum", &array_sum);
+  register_func(r, "adot", &array_dot);
+  register_func(r, "amin", &array_min);
+  register_func(r, "amax", &array_max);
   register_func(r, "not", &not);
   register_func(r, "print", &print);
   register_func(r, "println", &println);
   register_func(r, "str", &str);
   register_func(r, "time", &get_time);
+  register_func(r, "gensym", &gensym);
 
   register_func(r, "eval", &runtime_user_eval);
   register_func(r, "apply", &runtime_apply);
@@ -257,12 +699,21 @@ void register_builtin_funcs(Runtime *r) {
   register_func(r, "compile", &runtime_compile);
 
   register_func(r, "load", &runtime_load);
+  register_func(r, "reload", &runtime_reload);
+  register_func(r, "save-image", &runtime_save_image);
+  register_func(r, "spawn", &runtime_spawn);
+  register_func(r, "send", &runtime_send);
+  register_func(r, "receive", &runtime_receive);
+  register_func(r, "self", &runtime_self);
+  register_func(r, "flush", &runtime_flush);
+  register_func(r, "set-output-buffering", &runtime_set_output_buffering);
   register_func(r, "env", &runtime_env);
   register_func(r, "stack", &runtime_print_stack);
 }
 
 void register_basic_funcs(Runtime *r) {
   register_func(r, "gc", &runtime_gc_collect);
+  register_func(r, "gc-threads", &runtime_gc_threads);
 }
 
 void register_basic_vars(Runtime *r) {
@@ -271,6 +722,37 @@ void register_basic_vars(Runtime *r) {
   register_var(r, "true", r->true_val);
 }
 
+// The handles of the host and the args and let-bound locals of the frames are roots too, they might not be anywhere on the stack.
+void runtime_mark_roots(void *data) {
+  Runtime *r = data;
+  gc_mark(r->macros);
+  if(r->top_frame < 0) {
+    r->retired_code = r->nil; // no frame can be running the code that was replaced by recompilation
+  }
+  gc_mark(r->retired_code);
+  for(int i = 0; i < r->handle_count; i++) {
+    if(r->handles[i]) {
+      gc_mark(r->handles[i]);
+    }
+  }
+  for(int i = 0; i <= r->top_frame; i++) {
+    Frame *frame = &r->frames[i];
+    for(int j = 0; j < frame->slot_count; j++) {
+      gc_mark(frame->args[j]);
+    }
+    if(frame->arg_symbols) {
+      gc_mark(frame->arg_symbols);
+    }
+  }
+}
+
+// These are called once everything else has been marked since they depend on what has been marked.
+void runtime_mark_weak_refs(void *data) {
+  Runtime *r = data;
+  expansion_cache_mark(&r->expansions);
+  inline_deps_mark(&r->inline_deps);
+}
+
 Runtime *runtime_new(bool builtins) {
   GC *gc = gc_new();
   Runtime *r = malloc(sizeof(Runtime));
@@ -280,6 +762,28 @@ Runtime *runtime_new(bool builtins) {
   r->true_val = gc_make_symbol(r->gc, "true");
   r->top_frame = -1;
   r->mode = RUNTIME_MODE_RUN;
+  r->image = NULL;
+  r->image_size = 0;
+  r->isolate = NULL;
+  r->code_heap = NULL;
+  r->handles = NULL;
+  r->free_handles = NULL;
+  r->free_handle_count = 0;
+  r->handle_count = 0;
+  r->handle_capacity = 0;
+  loaded_files_init(&r->loaded_files);
+  r->macros = runtime_env_make_local(r, NULL);
+  r->gensym_counter = 0;
+  r->random_state = ((uint64_t)time(NULL) ^ (uint64_t)(uintptr_t)r) | 1; // must never be 0
+  inline_deps_init(&r->inline_deps);
+  r->retired_code = r->nil;
+  expansion_cache_init(&r->expansions);
+  r->macro_deps = NULL;
+  r->overlay = NULL;
+  gc->mark_extra_roots = &runtime_mark_roots;
+  gc->mark_weak_refs = &runtime_mark_weak_refs;
+  gc->extra_roots_data = r;
+  port_init(&r->out, stdout, isatty(STDOUT_FILENO) ? PORT_BUFFER_LINE : PORT_BUFFER_FULL);
   gc_stack_push(r->gc, r->global_env); // root the global env so it won't get GC:d
   register_basic_funcs(r);
   register_basic_vars(r);
@@ -290,7 +794,21 @@ Runtime *runtime_new(bool builtins) {
 }
 
 void runtime_delete(Runtime *r) {
+  isolate_release(r);
+  port_free(&r->out);
   gc_delete(r->gc);
+  expansion_cache_free(&r->expansions);
+  inline_deps_free(&r->inline_deps);
+  free(r->handles);
+  free(r->free_handles);
+  loaded_files_free(&r->loaded_files);
+  if(r->image) {
+    munmap(r->image, r->image_size);
+  }
+  if(r->code_heap) {
+    code_heap_release(r->code_heap);
+  }
+  free(r->overlay);
   free(r);
 }
 
@@ -301,6 +819,7 @@ Frame *runtime_frame_init(Runtime *r, int arg_count, Obj *arg_symbols, Code *cod
   for(int i = arg_count - 1; i >= 0; i--) {
     frame->args[i] = gc_stack_pop_safely(r->gc);
   }
+  frame->slot_count = arg_count;
   frame->arg_symbols = arg_symbols;  
   return frame;
 }
@@ -308,8 +827,8 @@ Frame *runtime_frame_init(Runtime *r, int arg_count, Obj *arg_symbols, Code *cod
 Frame *runtime_frame_push(Runtime *r, int arg_count, Obj *arg_symbols, Code *code, const char *name) {
   r->top_frame++;
   if(r->top_frame >= MAX_FRAMES) {
-    printf("Can't push more stack frames, reached max limit %d.\n", MAX_FRAMES);
-    exit(1);
+    r->top_frame--;
+    error(&r->gc->error, "Can't push more stack frames, reached the max limit.");
   }
   return runtime_frame_init(r, arg_count, arg_symbols, code, name);
 }
@@ -321,7 +840,7 @@ void runtime_frame_pop(Runtime *r) {
 // Changes the current frame, just as if popping and then pushing a new one.
 Frame *runtime_frame_replace(Runtime *r, int arg_count, Obj *arg_symbols, Code *code, const char *name) {
   if(r->top_frame < 0) {
-    error("Can't replace top frame because there are no frames.\n");
+    error(&r->gc->error, "Can't replace top frame because there are no frames.");
   }
   return runtime_frame_init(r, arg_count, arg_symbols, code, name);
 }
@@ -340,7 +859,9 @@ void call_func(Runtime *r, Obj *f, int arg_count) {
 void call_lambda(Runtime *r, Obj *f, int arg_count, bool tail_call) {
   int proper_arg_count = count(GET_ARGS(f));
   if(proper_arg_count != arg_count) {
-    printf("Can't call function %s with %d args (should be %d).\n", obj_to_str(f), arg_count, proper_arg_count);
+    printf("Can't call function ");
+    print_obj(f);
+    printf(" with %d args (should be %d).\n", arg_count, proper_arg_count);
     gc_stack_push(r->gc, r->nil);
     return;
   }
@@ -356,6 +877,44 @@ void call_lambda(Runtime *r, Obj *f, int arg_count, bool tail_call) {
 }
 
 
+// Calls a lambda or primitive function from C and runs it until it returns.
+// Returns NULL if the call didn't finish, like when breaking into the debugger.
+Obj *runtime_call(Runtime *r, Obj *f, Obj *args[], int arg_count) {
+  int base_frame = r->top_frame;
+  for(int i = 0; i < arg_count; i++) {
+    gc_stack_push(r->gc, args[i]);
+  }
+  if(f->type == FUNC) {
+    call_func(r, f, arg_count);
+  }
+  else if(f->type == LAMBDA) {
+    call_lambda(r, f, arg_count, false);
+  }
+  else {
+    printf("Can't call something that's not a lambda or func: ");
+    print_obj(f);
+    printf("\n");
+    for(int i = 0; i < arg_count; i++) {
+      gc_stack_pop_safely(r->gc);
+    }
+    return NULL;
+  }
+  // The outer evaluation might have stopped in break mode, the nested call runs anyway
+  RuntimeMode mode = r->mode;
+  r->mode = RUNTIME_MODE_RUN;
+  while(r->top_frame > base_frame && r->mode == RUNTIME_MODE_RUN) {
+    runtime_step_eval(r);
+  }
+  if(r->top_frame != base_frame) {
+    while(r->top_frame > base_frame) {
+      runtime_frame_pop(r);
+    }
+    return NULL;
+  }
+  r->mode = mode;
+  return gc_stack_pop_safely(r->gc);
+}
+
 Obj *runtime_apply(Runtime *r, Obj *args[], int arg_count) {
   if(arg_count != 2) {
      printf("Must call 'apply' with exactly two arguments.\n");
@@ -415,7 +974,7 @@ void runtime_step_eval(Runtime *r) {
   #endif
 
   #if LOG_OBJ_COUNT
-  int old_obj_count = g_obj_count;
+  int old_obj_count = r->gc->obj_count;
   #endif
   
   frame->p++;
@@ -441,6 +1000,9 @@ void runtime_step_eval(Runtime *r) {
   }
   else if(code == DIRECT_LOOKUP_VAR) {
     Obj *binding_pair = read_next_code_as_obj(frame);
+    if(binding_pair->external && r->code_heap) {
+      binding_pair = code_heap_overlay(r, binding_pair); // frozen code, the runtime might have redefined the global
+    }
     gc_stack_push(r->gc, binding_pair->cdr); // the value is stored in the cdr of the binding pair
   }
   else if(code == LOOKUP_ARG) {
@@ -448,6 +1010,17 @@ void runtime_step_eval(Runtime *r) {
     Obj *value = frame->args[arg_index];
     gc_stack_push(r->gc, value);
   }
+  else if(code == LOAD_LOCAL) {
+    int slot = read_next_code_as_int(frame);
+    gc_stack_push(r->gc, frame->args[slot]);
+  }
+  else if(code == STORE_LOCAL) {
+    int slot = read_next_code_as_int(frame);
+    frame->args[slot] = gc_stack_pop_safely(r->gc);
+    if(slot >= frame->slot_count) {
+      frame->slot_count = slot + 1;
+    }
+  }
   else if(code == POP_AND_DISCARD) {
     gc_stack_pop_safely(r->gc);
   }
@@ -474,21 +1047,36 @@ void runtime_step_eval(Runtime *r) {
   else if(code == EQ) {
     Obj *a = gc_stack_pop_safely(r->gc);
     Obj *b = gc_stack_pop_safely(r->gc);
-    gc_stack_push(r->gc, eq(a, b) ? r->true_val : r->nil);
+    gc_stack_push(r->gc, lazy_eq(r, a, b) ? r->true_val : r->nil);
   }
   else if(code == DEFINE) {
     Obj *sym = read_next_code_as_obj(frame);
     Obj *value = gc_stack_pop_safely(r->gc);
-    runtime_env_assoc(r, r->global_env, sym, value);
+    Obj *binding_pair = runtime_env_find_or_define_pair(r, r->global_env, sym); // a frozen global gets overlaid
+    binding_pair->cdr = value;
+    if(r->inline_deps.count > 0) {
+      compiler_invalidate_inlined(r, binding_pair);
+    }
+    gc_stack_push(r->gc, sym);
+  }
+  else if(code == DEFINE_MACRO) {
+    Obj *sym = read_next_code_as_obj(frame);
+    Obj *rest = gc_stack_pop_safely(r->gc);
+    Obj *lambda = gc_stack_pop_safely(r->gc);
+    runtime_env_assoc(r, r->macros, sym, gc_make_cons(r->gc, lambda, rest));
     gc_stack_push(r->gc, sym);
   }
   else if(code == PUSH_LAMBDA) {
     Obj *args = read_next_code_as_obj(frame);
     Obj *body = read_next_code_as_obj(frame);
-    int code_length = 0;
-    Code *bytecode = compile(r, true, body, &code_length, args);
-    if(bytecode) {
-      Obj *lambda = gc_make_lambda(r->gc, args, body, bytecode);
+    Obj *scope = read_next_code_as_obj(frame);
+    Obj *self_name = read_next_code_as_obj(frame);
+    // Let the compiler see the locals that are visible where the lambda is created, not only the args
+    Obj *arg_symbols = frame->arg_symbols;
+    frame->arg_symbols = scope;
+    Obj *lambda = compile_lambda(r, args, body, self_name == r->nil ? NULL : self_name);
+    frame->arg_symbols = arg_symbols;
+    if(lambda) {
       gc_stack_push(r->gc, lambda);
     } else {
       pop_to_global_scope_and_push_nil(r);
@@ -507,6 +1095,9 @@ void runtime_step_eval(Runtime *r) {
       printf("Can't call something that's not a lambda or func: ");
       print_obj(f);
       printf("\n");
+      for(int i = 0; i < arg_count; i++) {
+	gc_stack_pop_safely(r->gc);
+      }
       gc_stack_push(r->gc, r->nil);
     }
   }
@@ -523,28 +1114,17 @@ void runtime_step_eval(Runtime *r) {
 #endif
 
 #if LOG_OBJ_COUNT
-  printf("+ %d Obj:s\n", g_obj_count - old_obj_count);
+  printf("+ %d Obj:s\n", r->gc->obj_count - old_obj_count);
 #endif
 }
 
-void eval_top_form(Runtime *r, Obj *env, Obj *form, int top_frame_index, int break_frame_index) {
-
-  int code_length = 0;
-  Code *bytecode = compile(r, false, form, &code_length, NULL);
-
-  if(!bytecode) {
-    /* printf("Failed to compile top form: "); */
-    /* print_obj(form); */
-    /* printf("\n"); */
-    gc_stack_push(r->gc, r->gc->nil);
-    return;
-  }
-  
+// Runs a block of top-level code, leaving its result on the value stack.
+void run_top_code(Runtime *r, Code *bytecode, int top_frame_index, int break_frame_index) {
   #if LOG_BYTECODE
   code_print(bytecode);
   #endif
   
-  int old_obj_count = g_obj_count;
+  int old_obj_count = r->gc->obj_count;
   
   runtime_frame_push(r, 0, NULL, bytecode, "top-level");
   
@@ -565,6 +1145,7 @@ void eval_top_form(Runtime *r, Obj *env, Obj *form, int top_frame_index, int bre
       break;
     }
     else {
+      port_flush(&r->out);
       runtime_print_frames(r);
       printf("Debug REPL, press return to continue execution.\n");
       printf("\e[35m➜\e[0m ");
@@ -573,7 +1154,7 @@ void eval_top_form(Runtime *r, Obj *env, Obj *form, int top_frame_index, int bre
       fgets(str, BUFFER_SIZE, stdin);
       r->mode = RUNTIME_MODE_RUN;
       if(strlen(str) > 0) {
-	runtime_eval_internal(r, r->global_env, str, true, 0, r->top_frame);
+	runtime_eval_internal(r, r->global_env, str, strlen(str), NULL, true, 0, r->top_frame);
       }
       else {
 	// continue normal execution
@@ -582,27 +1163,124 @@ void eval_top_form(Runtime *r, Obj *env, Obj *form, int top_frame_index, int bre
   }
 
   #if LOG_OBJ_COUNT_TOP_LEVEL
-  printf("+ %d Obj:s\n", g_obj_count - old_obj_count);
+  printf("+ %d Obj:s\n", r->gc->obj_count - old_obj_count);
   #endif
 }
 
-void runtime_eval_internal(Runtime *r, Obj *env, const char *source, bool print_result, int top_frame_index, int break_frame_index) {
-  Obj *top_level_forms = parse(r->gc, source);
-  gc_stack_push(r->gc, top_level_forms); // root current forms to be evaluated so that GC doesn't eat them
-  Obj *current_form = top_level_forms;
-  while(current_form && current_form->car) {
-    eval_top_form(r, env, current_form->car, top_frame_index, break_frame_index);
+// Compiles and runs a top-level form. If 'cache' is given the compiled code is also written to it.
+void eval_top_form(Runtime *r, Obj *env, Obj *form, Serializer *cache, MacroDeps *deps, int top_frame_index, int break_frame_index) {
+  int code_length = 0;
+  // The cached code has the expansions of the macros baked in, record which ones so that it isn't used after they change
+  MacroDeps *outer_deps = r->macro_deps;
+  if(cache) {
+    r->macro_deps = deps;
+  }
+  Code *bytecode = compile(r, false, form, &code_length, NULL);
+  r->macro_deps = outer_deps;
+  if(cache) {
+    code_cache_write_macro_deps(cache, deps);
+  }
+
+  if(!bytecode) {
+    /* printf("Failed to compile top form: "); */
+    /* print_obj(form); */
+    /* printf("\n"); */
+    if(cache) {
+      cache->failed = true;
+    }
+    gc_stack_push(r->gc, r->gc->nil);
+    return;
+  }
+
+  if(cache) {
+    serialize_code(cache, bytecode);
+  }
+
+  run_top_code(r, bytecode, top_frame_index, break_frame_index);
+}
+
+// Evaluates (and prints) a top-level form, a fatal error unwinds the stacks to where they were before the form.
+void eval_top_form_safely(Runtime *r, Obj *env, Obj *form, Serializer *cache, bool print_result, int top_frame_index, int break_frame_index) {
+  int stack_size = r->gc->stackSize;
+  int top_frame = r->top_frame;
+  RuntimeMode mode = r->mode;
+  MacroDeps *outer_deps = r->macro_deps;
+  MacroDeps deps; // owned here so that it's freed after a fatal error too
+  macro_deps_init(&deps);
+  jmp_buf handler;
+  jmp_buf *outer_handler = r->gc->error.handler;
+  r->gc->error.handler = &handler;
+  if(setjmp(handler) == 0) {
+    gc_stack_push(r->gc, form); // root the current form so that GC doesn't eat it
+    eval_top_form(r, env, form, cache, &deps, top_frame_index, break_frame_index);
     Obj *result = gc_stack_pop_safely(r->gc);
     if(print_result && result) {
-      print_obj(result);
-      printf("\n");
+      result = lazy_realize_all(r, result);
+      port_write_obj(&r->out, result, true);
+      port_write_char(&r->out, '\n');
     }
-    current_form = current_form->cdr;
+    gc_stack_pop_safely(r->gc);
   }
-  gc_stack_pop_safely(r->gc);
+  else {
+    r->gc->stackSize = stack_size;
+    r->top_frame = top_frame;
+    r->mode = mode;
+    r->macro_deps = outer_deps;
+    if(cache) {
+      cache->failed = true;
+    }
+  }
+  r->gc->error.handler = outer_handler;
+  macro_deps_free(&deps);
+}
+
+// Like 'eval_top_form_safely' for a form that was compiled already (it comes from a code cache)
+void run_top_code_safely(Runtime *r, Obj *code_obj, int top_frame_index) {
+  int stack_size = r->gc->stackSize;
+  int top_frame = r->top_frame;
+  RuntimeMode mode = r->mode;
+  jmp_buf handler;
+  jmp_buf *outer_handler = r->gc->error.handler;
+  r->gc->error.handler = &handler;
+  if(setjmp(handler) == 0) {
+    gc_stack_push(r->gc, code_obj); // root the constants in the code
+    run_top_code(r, (Code*)code_obj->code, top_frame_index, -1);
+    gc_stack_pop_safely(r->gc); // the result
+    gc_stack_pop_safely(r->gc);
+  }
+  else {
+    r->gc->stackSize = stack_size;
+    r->top_frame = top_frame;
+    r->mode = mode;
+  }
+  r->gc->error.handler = outer_handler;
+}
+
+void runtime_eval_internal(Runtime *r, Obj *env, const char *source, size_t length, Serializer *cache, bool print_result, int top_frame_index, int break_frame_index) {
+  Parser parser;
+  parser_init(&parser, source, length);
+  Obj *form;
+  while((form = parser_next_form(r->gc, &parser))) {
+    eval_top_form_safely(r, env, form, cache, print_result, top_frame_index, break_frame_index);
+  }
+  port_flush(&r->out);
+}
+
+// xorshift64*
+uint64_t runtime_random(Runtime *r) {
+  uint64_t x = r->random_state;
+  x ^= x >> 12;
+  x ^= x << 25;
+  x ^= x >> 27;
+  r->random_state = x;
+  return x * 0x2545F4914F6CDD9DULL;
 }
 
 void runtime_eval(Runtime *r, const char *source) {
-  runtime_eval_internal(r, r->global_env, source, true, 0, -1);
+  runtime_eval_internal(r, r->global_env, source, strlen(source), NULL, true, 0, -1);
 }
 
+void runtime_eval_form(Runtime *r, Obj *form) {
+  eval_top_form_safely(r, r->global_env, form, NULL, false, 0, -1);
+  port_flush(&r->out);
+}
@@ -0,0 +1,494 @@
+#include "Serialize.h"
+#include "Vector.h"
+#include "Map.h"
+#include "Array.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define CODE_CACHE_MAGIC "PLC"
+#define CODE_CACHE_VERSION 7
+
+// Tags for the serialized objects
+enum {
+  TAG_NIL = 'n',
+  TAG_NUMBER = 'N',
+  TAG_STRING = 'S',
+  TAG_SYMBOL = 'Y',
+  TAG_LIST = 'L', // item count, the items and then the tail of the last cons
+  TAG_VECTOR = 'V', // item count and the items
+  TAG_MAP = 'M', // entry count and the keys and values
+  TAG_ARRAY = 'A', // element type, item count and the packed items
+};
+
+void serializer_init(Serializer *s) {
+  s->capacity = 1024;
+  s->data = malloc(s->capacity);
+  s->size = 0;
+  s->failed = false;
+}
+
+void serializer_free(Serializer *s) {
+  free(s->data);
+  s->data = NULL;
+  s->size = 0;
+  s->capacity = 0;
+}
+
+void serialize_bytes(Serializer *s, const void *bytes, size_t length) {
+  if(s->size + length > s->capacity) {
+    while(s->size + length > s->capacity) {
+      s->capacity *= 2;
+    }
+    s->data = realloc(s->data, s->capacity);
+  }
+  memcpy(s->data + s->size, bytes, length);
+  s->size += length;
+}
+
+void serialize_tag(Serializer *s, char tag) {
+  serialize_bytes(s, &tag, 1);
+}
+
+void serialize_int(Serializer *s, int i) {
+  serialize_bytes(s, &i, sizeof(int));
+}
+
+void serialize_text(Serializer *s, const char *text, int length) {
+  serialize_int(s, length);
+  serialize_bytes(s, text, length);
+}
+
+void serialize_map_entry(Obj *key, Obj *value, void *data) {
+  serialize_obj(data, key);
+  serialize_obj(data, value);
+}
+
+bool serialize_obj(Serializer *s, Obj *o) {
+  o = lazy_unwrap(o); // lazy seqs that haven't been realized can't be serialized
+  if(o == NULL) {
+    s->failed = true;
+  }
+  else if(o->type == CONS && o->car == NULL && o->cdr == NULL) {
+    serialize_tag(s, TAG_NIL);
+  }
+  else if(o->type == CONS) {
+    // Lists are written as a flat sequence to avoid recursing down long cdr chains
+    int item_count = 0;
+    Obj *tail = o;
+    while(tail->type == CONS && tail->car && tail->cdr) {
+      item_count++;
+      tail = lazy_unwrap(tail->cdr);
+    }
+    serialize_tag(s, TAG_LIST);
+    serialize_int(s, item_count);
+    for(Obj *item = o; item != tail; item = lazy_unwrap(item->cdr)) {
+      serialize_obj(s, item->car);
+    }
+    serialize_obj(s, tail);
+  }
+  else if(o->type == NUMBER) {
+    serialize_tag(s, TAG_NUMBER);
+    serialize_bytes(s, &o->number, sizeof(double));
+  }
+  else if(o->type == STRING) {
+    serialize_tag(s, TAG_STRING);
+    serialize_text(s, o->name, o->length);
+  }
+  else if(o->type == SYMBOL) {
+    serialize_tag(s, TAG_SYMBOL);
+    serialize_text(s, o->name, o->length);
+  }
+  else if(o->type == VECTOR) {
+    serialize_tag(s, TAG_VECTOR);
+    serialize_int(s, o->count);
+    for(int i = 0; i < o->count; i++) {
+      serialize_obj(s, vector_nth(o, i));
+    }
+  }
+  else if(o->type == MAP) {
+    serialize_tag(s, TAG_MAP);
+    serialize_int(s, o->count);
+    map_visit_entries(o, serialize_map_entry, s);
+  }
+  else if(o->type == ARRAY) {
+    unsigned char element_type = o->element_type;
+    serialize_tag(s, TAG_ARRAY);
+    serialize_bytes(s, &element_type, 1);
+    serialize_int(s, o->count);
+    serialize_bytes(s, o->data, (size_t)o->count * array_element_size(o->element_type));
+  }
+  else {
+    // Primitive functions, lambdas, etc can only exist in a live runtime
+    s->failed = true;
+  }
+  return !s->failed;
+}
+
+Obj *read_code_as_obj(Code *code) {
+  Obj **oo = (Obj**)code;
+  return *oo;
+}
+
+bool serialize_code(Serializer *s, Code *code) {
+  while(!s->failed) {
+    Code c = *code;
+    unsigned char byte = (unsigned char)c;
+    serialize_bytes(s, &byte, 1);
+    code++;
+
+    if(c == END_OF_CODES) {
+      break;
+    }
+    else if(c == DIRECT_LOOKUP_VAR) {
+      // The binding pair is written as its symbol, it will be looked up again when loading
+      Obj *binding_pair = read_code_as_obj(code);
+      serialize_obj(s, binding_pair->car);
+      code += 2;
+    }
+    else {
+      for(int i = 0; i < code_obj_operand_count(c); i++) {
+	serialize_obj(s, read_code_as_obj(code));
+	code += 2;
+      }
+    }
+
+    if(pushes_int(c)) {
+      serialize_int(s, *(int*)code);
+      code++;
+    }
+  }
+  return !s->failed;
+}
+
+void deserializer_init(Deserializer *d, const char *data, size_t length) {
+  d->pos = data;
+  d->end = data + length;
+  d->failed = false;
+}
+
+bool deserialize_bytes(Deserializer *d, void *OUT_bytes, size_t length) {
+  if(d->failed || d->pos + length > d->end) {
+    d->failed = true;
+    return false;
+  }
+  memcpy(OUT_bytes, d->pos, length);
+  d->pos += length;
+  return true;
+}
+
+int deserialize_int(Deserializer *d) {
+  int i = 0;
+  deserialize_bytes(d, &i, sizeof(int));
+  return i;
+}
+
+char *deserialize_text(Deserializer *d, int *OUT_length) {
+  int length = deserialize_int(d);
+  *OUT_length = length;
+  if(d->failed || length < 0 || d->pos + length > d->end) {
+    d->failed = true;
+    return NULL;
+  }
+  char *text = malloc(length + 1);
+  memcpy(text, d->pos, length);
+  text[length] = '\0';
+  d->pos += length;
+  return text;
+}
+
+Obj *deserialize_obj(Deserializer *d, Runtime *r) {
+  char tag = 0;
+  if(!deserialize_bytes(d, &tag, 1)) {
+    return NULL;
+  }
+
+  if(tag == TAG_NIL) {
+    return r->nil;
+  }
+  else if(tag == TAG_NUMBER) {
+    double x = 0.0;
+    deserialize_bytes(d, &x, sizeof(double));
+    return gc_make_number(r->gc, x);
+  }
+  else if(tag == TAG_STRING) {
+    int length;
+    char *text = deserialize_text(d, &length);
+    return text ? gc_make_string_with_length(r->gc, text, length) : NULL;
+  }
+  else if(tag == TAG_SYMBOL) {
+    int length;
+    char *name = deserialize_text(d, &length);
+    return name ? gc_make_symbol_from_malloced_string(r->gc, name) : NULL;
+  }
+  else if(tag == TAG_LIST) {
+    int item_count = deserialize_int(d);
+    Obj *list = NULL;
+    Obj *last_cons = NULL;
+    for(int i = 0; i < item_count && !d->failed; i++) {
+      Obj *item = deserialize_obj(d, r);
+      if(!item) {
+	return NULL;
+      }
+      Obj *new = gc_make_cons(r->gc, item, r->nil);
+      if(last_cons) {
+	last_cons->cdr = new;
+      } else {
+	list = new;
+      }
+      last_cons = new;
+    }
+    Obj *tail = deserialize_obj(d, r);
+    if(!tail) {
+      return NULL;
+    }
+    if(last_cons) {
+      last_cons->cdr = tail;
+      return list;
+    } else {
+      return tail;
+    }
+  }
+  else if(tag == TAG_VECTOR) {
+    int item_count = deserialize_int(d);
+    Obj *vector = gc_make_vector(r->gc, NULL, NULL, 0, VECTOR_BITS);
+    for(int i = 0; i < item_count && !d->failed; i++) {
+      Obj *item = deserialize_obj(d, r);
+      if(!item) {
+	return NULL;
+      }
+      vector = vector_conj(r->gc, vector, item);
+    }
+    return d->failed ? NULL : vector;
+  }
+  else if(tag == TAG_MAP) {
+    int entry_count = deserialize_int(d);
+    Obj *map = gc_make_map(r->gc, NULL, 0);
+    for(int i = 0; i < entry_count && !d->failed; i++) {
+      Obj *key = deserialize_obj(d, r);
+      Obj *value = key ? deserialize_obj(d, r) : NULL;
+      if(!value) {
+	return NULL;
+      }
+      map = map_assoc(r->gc, map, key, value);
+    }
+    return d->failed ? NULL : map;
+  }
+  else if(tag == TAG_ARRAY) {
+    unsigned char element_type = 0;
+    deserialize_bytes(d, &element_type, 1);
+    int item_count = deserialize_int(d);
+    if(d->failed || element_type > ARRAY_I32 || item_count < 0) {
+      d->failed = true;
+      return NULL;
+    }
+    Obj *array = gc_make_array(r->gc, element_type, item_count);
+    if(!deserialize_bytes(d, array->data, (size_t)item_count * array_element_size(element_type))) {
+      return NULL;
+    }
+    return array;
+  }
+  else {
+    d->failed = true;
+    return NULL;
+  }
+}
+
+// Returns NULL if the data is broken, the caller owns the returned code block.
+Code *deserialize_code(Deserializer *d, Runtime *r) {
+  CodeWriter writer;
+  code_writer_init(&writer, 256);
+
+  while(!d->failed) {
+    unsigned char byte = 0;
+    if(!deserialize_bytes(d, &byte, 1)) {
+      break;
+    }
+    Code c = (Code)byte;
+    if(c > END_OF_CODES) {
+      d->failed = true;
+      break;
+    }
+    code_write_code(&writer, c);
+
+    if(c == END_OF_CODES) {
+      break;
+    }
+    else if(c == DIRECT_LOOKUP_VAR) {
+      Obj *symbol = deserialize_obj(d, r);
+      if(!symbol || symbol->type != SYMBOL) {
+	d->failed = true;
+	break;
+      }
+      code_write_obj(&writer, runtime_env_find_or_define_pair(r, r->global_env, symbol));
+    }
+    else {
+      for(int i = 0; i < code_obj_operand_count(c); i++) {
+	Obj *o = deserialize_obj(d, r);
+	if(!o) {
+	  d->failed = true;
+	  break;
+	}
+	if(c == DEFINE) {
+	  // The compiler pre-defines bindings before the value is computed, do the same here
+	  runtime_env_find_or_define_pair(r, r->global_env, o);
+	}
+	code_write_obj(&writer, o);
+      }
+    }
+
+    if(pushes_int(c)) {
+      code_write_int(&writer, deserialize_int(d));
+    }
+  }
+
+  if(d->failed || writer.error) {
+    free(writer.codes);
+    return NULL;
+  }
+  return writer.codes;
+}
+
+bool code_cache_path(const char *source_path, char *OUT_path, size_t max_length) {
+  const char *extension = ".lisp";
+  size_t length = strlen(source_path);
+  size_t extension_length = strlen(extension);
+  if(length < extension_length || strcmp(source_path + length - extension_length, extension) != 0) {
+    return false;
+  }
+  size_t base_length = length - extension_length;
+  if(base_length + strlen(".plc") + 1 > max_length) {
+    return false;
+  }
+  memcpy(OUT_path, source_path, base_length);
+  strcpy(OUT_path + base_length, ".plc");
+  return true;
+}
+
+// Identifies the version of the source file that a cache was compiled from. A cache is only used when the stamp
+// matches exactly, the nanoseconds catch edits made within the same second as the cache was written.
+typedef struct {
+  long long size;
+  long long mtime_sec;
+  long long mtime_nsec;
+} SourceStamp;
+
+static SourceStamp source_stamp(const struct stat *source_stat) {
+  return (SourceStamp){
+    .size = source_stat->st_size,
+    .mtime_sec = source_stat->st_mtim.tv_sec,
+    .mtime_nsec = source_stat->st_mtim.tv_nsec,
+  };
+}
+
+void code_cache_write_header(Serializer *s, const struct stat *source_stat) {
+  serialize_bytes(s, CODE_CACHE_MAGIC, sizeof(CODE_CACHE_MAGIC));
+  serialize_int(s, CODE_CACHE_VERSION);
+  serialize_int(s, END_OF_CODES); // changes whenever codes are added
+  SourceStamp stamp = source_stamp(source_stat);
+  serialize_bytes(s, &stamp, sizeof(stamp));
+}
+
+bool code_cache_read_header(Deserializer *d, const struct stat *source_stat) {
+  char magic[sizeof(CODE_CACHE_MAGIC)];
+  if(!deserialize_bytes(d, magic, sizeof(magic)) || memcmp(magic, CODE_CACHE_MAGIC, sizeof(magic)) != 0) {
+    return false;
+  }
+  int version = deserialize_int(d);
+  int code_count = deserialize_int(d);
+  SourceStamp stamp;
+  SourceStamp expected = source_stamp(source_stat);
+  return deserialize_bytes(d, &stamp, sizeof(stamp)) && version == CODE_CACHE_VERSION && code_count == END_OF_CODES &&
+    stamp.size == expected.size && stamp.mtime_sec == expected.mtime_sec && stamp.mtime_nsec == expected.mtime_nsec;
+}
+
+void code_cache_write_form_info(Serializer *s, unsigned hash, const char *name) {
+  serialize_int(s, (int)hash);
+  int length = name ? (int)strlen(name) : -1;
+  serialize_int(s, length);
+  if(name) {
+    serialize_bytes(s, name, length);
+  }
+}
+
+bool code_cache_read_form_info(Deserializer *d, unsigned *OUT_hash, char **OUT_name) {
+  *OUT_hash = (unsigned)deserialize_int(d);
+  int length = deserialize_int(d);
+  *OUT_name = NULL;
+  if(length >= 0 && !d->failed) {
+    *OUT_name = malloc(length + 1);
+    if(!deserialize_bytes(d, *OUT_name, length)) {
+      free(*OUT_name);
+      *OUT_name = NULL;
+      return false;
+    }
+    (*OUT_name)[length] = '\0';
+  }
+  return !d->failed;
+}
+
+void code_cache_write_macro_deps(Serializer *s, MacroDeps *deps) {
+  serialize_int(s, deps->count);
+  for(int i = 0; i < deps->count; i++) {
+    int length = (int)strlen(deps->names[i]);
+    serialize_int(s, length);
+    serialize_bytes(s, deps->names[i], length);
+    serialize_int(s, (int)deps->hashes[i]);
+  }
+}
+
+bool code_cache_read_macro_deps(Deserializer *d, MacroDeps *deps) {
+  int count = deserialize_int(d);
+  for(int i = 0; i < count && !d->failed; i++) {
+    int length = deserialize_int(d);
+    if(length < 0 || d->failed || d->pos + length > d->end) {
+      d->failed = true;
+      return false;
+    }
+    char *name = malloc(length + 1);
+    if(!deserialize_bytes(d, name, length)) {
+      free(name);
+      return false;
+    }
+    name[length] = '\0';
+    unsigned hash = (unsigned)deserialize_int(d);
+    macro_deps_add(deps, name, hash);
+    free(name);
+  }
+  return !d->failed;
+}
+
+bool code_cache_write(Serializer *s, const char *cache_path, const struct stat *source_stat) {
+  if(s->failed) {
+    return false;
+  }
+
+  Serializer header;
+  serializer_init(&header);
+  code_cache_write_header(&header, source_stat);
+
+  // Write to a temporary file and move it into place so that a half written cache is never read.
+  // Every process gets a file of its own, processes that start at the same time would overwrite each other otherwise.
+  char tmp_path[2048];
+  snprintf(tmp_path, sizeof(tmp_path), "%s.XXXXXX", cache_path);
+  int fd = mkstemp(tmp_path);
+  FILE *f = fd >= 0 ? fdopen(fd, "wb") : NULL;
+  bool ok = false;
+  if(f) {
+    ok = fwrite(header.data, 1, header.size, f) == header.size &&
+         fwrite(s->data, 1, s->size, f) == s->size;
+    ok = (fclose(f) == 0) && ok;
+    ok = ok && rename(tmp_path, cache_path) == 0;
+    if(!ok) {
+      remove(tmp_path);
+    }
+  }
+  else if(fd >= 0) {
+    close(fd);
+    remove(tmp_path);
+  }
+  serializer_free(&header);
+  return ok;
+}
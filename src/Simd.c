@@ -0,0 +1,494 @@
+#include "Simd.h"
+#include <math.h>
+#include <stdint.h>
+#include <string.h>
+#include <stdbool.h>
+#include <pthread.h>
+
+#if defined(__x86_64__)
+#define SIMD_X86 1
+#include <immintrin.h>
+#else
+#define SIMD_X86 0
+#endif
+
+// sin and cos: x = k * pi/2 + r with |r| <= pi/4, then a polynomial in r chosen by the quadrant k & 3.
+// pi/2 is split in two parts (Cody-Waite) so that k * PIO2_HI is exact for the k:s that are used.
+#define TWO_OVER_PI 0.63661977236758134308
+#define PIO2_HI 1.57079632673412561417e+00
+#define PIO2_LO 6.07710050650619224932e-11
+#define ROUNDING_MAGIC 6755399441055744.0 // 2^52 + 2^51, adding it rounds to an integer kept in the low bits
+#define TRIG_LIMIT 1e5
+
+// Minimax coefficients for |r| <= pi/4 (from Cephes)
+#define S1 -1.66666666666666307295E-1
+#define S2  8.33333333332211858878E-3
+#define S3 -1.98412698295895385996E-4
+#define S4  2.75573136213857245213E-6
+#define S5 -2.50507477628578072866E-8
+#define S6  1.58962301576546568060E-10
+#define C1  4.16666666666665929218E-2
+#define C2 -1.38888888888730564116E-3
+#define C3  2.48015872888517045348E-5
+#define C4 -2.75573141792967388112E-7
+#define C5  2.08757008419747316778E-9
+#define C6 -1.13585365213876817300E-11
+
+// -------- Scalar --------
+
+static double trig_scalar(double x, int quadrant_offset) {
+  if(!(fabs(x) <= TRIG_LIMIT)) {
+    return quadrant_offset ? cos(x) : sin(x);
+  }
+  double t = x * TWO_OVER_PI + ROUNDING_MAGIC;
+  double k = t - ROUNDING_MAGIC;
+  uint64_t bits;
+  memcpy(&bits, &t, sizeof(double));
+  int quadrant = (int)((bits + quadrant_offset) & 3);
+
+  double r = (x - k * PIO2_HI) - k * PIO2_LO;
+  double z = r * r;
+  double s = r + r * z * (S1 + z * (S2 + z * (S3 + z * (S4 + z * (S5 + z * S6)))));
+  double c = 1.0 - 0.5 * z + z * z * (C1 + z * (C2 + z * (C3 + z * (C4 + z * (C5 + z * C6)))));
+  double result = (quadrant & 1) ? c : s;
+  return (quadrant & 2) ? -result : result;
+}
+
+static void add_scalar(double *out, const double *a, const double *b, int n) {
+  for(int i = 0; i < n; i++) out[i] = a[i] + b[i];
+}
+
+static void sub_scalar(double *out, const double *a, const double *b, int n) {
+  for(int i = 0; i < n; i++) out[i] = a[i] - b[i];
+}
+
+static void mul_scalar(double *out, const double *a, const double *b, int n) {
+  for(int i = 0; i < n; i++) out[i] = a[i] * b[i];
+}
+
+static void div_scalar(double *out, const double *a, const double *b, int n) {
+  for(int i = 0; i < n; i++) out[i] = a[i] / b[i];
+}
+
+static void fma_scalar(double *out, const double *a, const double *b, const double *c, int n) {
+  for(int i = 0; i < n; i++) out[i] = a[i] * b[i] + c[i];
+}
+
+static void fma_scalar_scalar(double *out, const double *a, double b, const double *c, int n) {
+  for(int i = 0; i < n; i++) out[i] = a[i] * b + c[i];
+}
+
+static void clamp_scalar(double *out, const double *a, double lo, double hi, int n) {
+  for(int i = 0; i < n; i++) out[i] = a[i] < lo ? lo : (a[i] > hi ? hi : a[i]);
+}
+
+static void sin_scalar(double *out, const double *a, int n) {
+  for(int i = 0; i < n; i++) out[i] = trig_scalar(a[i], 0);
+}
+
+static void cos_scalar(double *out, const double *a, int n) {
+  for(int i = 0; i < n; i++) out[i] = trig_scalar(a[i], 1);
+}
+
+static double sum_scalar(const double *a, int n) {
+  double sum = 0.0;
+  for(int i = 0; i < n; i++) sum += a[i];
+  return sum;
+}
+
+static double dot_scalar(const double *a, const double *b, int n) {
+  double sum = 0.0;
+  for(int i = 0; i < n; i++) sum += a[i] * b[i];
+  return sum;
+}
+
+static double min_scalar(const double *a, int n) {
+  double m = a[0];
+  for(int i = 1; i < n; i++) m = a[i] < m ? a[i] : m;
+  return m;
+}
+
+static double max_scalar(const double *a, int n) {
+  double m = a[0];
+  for(int i = 1; i < n; i++) m = a[i] > m ? a[i] : m;
+  return m;
+}
+
+static const SimdKernels scalar_kernels = {
+  "scalar", add_scalar, sub_scalar, mul_scalar, div_scalar, fma_scalar, fma_scalar_scalar,
+  clamp_scalar, sin_scalar, cos_scalar, sum_scalar, dot_scalar, min_scalar, max_scalar,
+};
+
+#if SIMD_X86
+
+// -------- SSE2, two doubles at a time --------
+// Loops do the bulk with vectors and leave the last odd element to the scalar kernel.
+
+#define SSE2_BINARY(name, op)						\
+  static void name##_sse2(double *out, const double *a, const double *b, int n) { \
+    int i = 0;								\
+    for(; i + 2 <= n; i += 2) {						\
+      _mm_storeu_pd(out + i, op(_mm_loadu_pd(a + i), _mm_loadu_pd(b + i))); \
+    }									\
+    name##_scalar(out + i, a + i, b + i, n - i);			\
+  }
+
+SSE2_BINARY(add, _mm_add_pd)
+SSE2_BINARY(sub, _mm_sub_pd)
+SSE2_BINARY(mul, _mm_mul_pd)
+SSE2_BINARY(div, _mm_div_pd)
+
+static void fma_sse2(double *out, const double *a, const double *b, const double *c, int n) {
+  int i = 0;
+  for(; i + 2 <= n; i += 2) {
+    __m128d product = _mm_mul_pd(_mm_loadu_pd(a + i), _mm_loadu_pd(b + i));
+    _mm_storeu_pd(out + i, _mm_add_pd(product, _mm_loadu_pd(c + i)));
+  }
+  fma_scalar(out + i, a + i, b + i, c + i, n - i);
+}
+
+static void fma_scalar_sse2(double *out, const double *a, double b, const double *c, int n) {
+  __m128d vb = _mm_set1_pd(b);
+  int i = 0;
+  for(; i + 2 <= n; i += 2) {
+    _mm_storeu_pd(out + i, _mm_add_pd(_mm_mul_pd(_mm_loadu_pd(a + i), vb), _mm_loadu_pd(c + i)));
+  }
+  fma_scalar_scalar(out + i, a + i, b, c + i, n - i);
+}
+
+static void clamp_sse2(double *out, const double *a, double lo, double hi, int n) {
+  __m128d vlo = _mm_set1_pd(lo);
+  __m128d vhi = _mm_set1_pd(hi);
+  int i = 0;
+  for(; i + 2 <= n; i += 2) {
+    _mm_storeu_pd(out + i, _mm_min_pd(_mm_max_pd(_mm_loadu_pd(a + i), vlo), vhi));
+  }
+  clamp_scalar(out + i, a + i, lo, hi, n - i);
+}
+
+static __m128d trig_sse2(__m128d x, int quadrant_offset) {
+  __m128d magic = _mm_set1_pd(ROUNDING_MAGIC);
+  __m128d t = _mm_add_pd(_mm_mul_pd(x, _mm_set1_pd(TWO_OVER_PI)), magic);
+  __m128d k = _mm_sub_pd(t, magic);
+  __m128i quadrant = _mm_add_epi64(_mm_castpd_si128(t), _mm_set1_epi64x(quadrant_offset));
+
+  __m128d r = _mm_sub_pd(x, _mm_mul_pd(k, _mm_set1_pd(PIO2_HI)));
+  r = _mm_sub_pd(r, _mm_mul_pd(k, _mm_set1_pd(PIO2_LO)));
+  __m128d z = _mm_mul_pd(r, r);
+
+  __m128d ps = _mm_set1_pd(S6);
+  ps = _mm_add_pd(_mm_mul_pd(ps, z), _mm_set1_pd(S5));
+  ps = _mm_add_pd(_mm_mul_pd(ps, z), _mm_set1_pd(S4));
+  ps = _mm_add_pd(_mm_mul_pd(ps, z), _mm_set1_pd(S3));
+  ps = _mm_add_pd(_mm_mul_pd(ps, z), _mm_set1_pd(S2));
+  ps = _mm_add_pd(_mm_mul_pd(ps, z), _mm_set1_pd(S1));
+  __m128d s = _mm_add_pd(r, _mm_mul_pd(_mm_mul_pd(r, z), ps));
+
+  __m128d pc = _mm_set1_pd(C6);
+  pc = _mm_add_pd(_mm_mul_pd(pc, z), _mm_set1_pd(C5));
+  pc = _mm_add_pd(_mm_mul_pd(pc, z), _mm_set1_pd(C4));
+  pc = _mm_add_pd(_mm_mul_pd(pc, z), _mm_set1_pd(C3));
+  pc = _mm_add_pd(_mm_mul_pd(pc, z), _mm_set1_pd(C2));
+  pc = _mm_add_pd(_mm_mul_pd(pc, z), _mm_set1_pd(C1));
+  __m128d c = _mm_sub_pd(_mm_set1_pd(1.0), _mm_mul_pd(_mm_set1_pd(0.5), z));
+  c = _mm_add_pd(c, _mm_mul_pd(_mm_mul_pd(z, z), pc));
+
+  // Odd quadrants use the cosine polynomial, quadrant 2 and 3 flip the sign
+  __m128i one = _mm_set1_epi64x(1);
+  __m128i odd = _mm_cmpeq_epi32(_mm_and_si128(quadrant, one), one);
+  odd = _mm_shuffle_epi32(odd, _MM_SHUFFLE(2, 2, 0, 0)); // widen the mask of the low 32 bits to 64 bits
+  __m128d swap = _mm_castsi128_pd(odd);
+  __m128d result = _mm_or_pd(_mm_and_pd(swap, c), _mm_andnot_pd(swap, s));
+  __m128i sign = _mm_slli_epi64(_mm_and_si128(quadrant, _mm_set1_epi64x(2)), 62);
+  return _mm_xor_pd(result, _mm_castsi128_pd(sign));
+}
+
+static void trig_array_sse2(double *out, const double *a, int n, int quadrant_offset) {
+  __m128d limit = _mm_set1_pd(TRIG_LIMIT);
+  __m128d abs_mask = _mm_castsi128_pd(_mm_set1_epi64x(0x7FFFFFFFFFFFFFFFLL));
+  int i = 0;
+  for(; i + 2 <= n; i += 2) {
+    __m128d x = _mm_loadu_pd(a + i);
+    if(_mm_movemask_pd(_mm_cmpnle_pd(_mm_and_pd(x, abs_mask), limit))) {
+      out[i] = trig_scalar(a[i], quadrant_offset); // huge or NaN, let libm handle it
+      out[i + 1] = trig_scalar(a[i + 1], quadrant_offset);
+    } else {
+      _mm_storeu_pd(out + i, trig_sse2(x, quadrant_offset));
+    }
+  }
+  for(; i < n; i++) {
+    out[i] = trig_scalar(a[i], quadrant_offset);
+  }
+}
+
+static void sin_sse2(double *out, const double *a, int n) {
+  trig_array_sse2(out, a, n, 0);
+}
+
+static void cos_sse2(double *out, const double *a, int n) {
+  trig_array_sse2(out, a, n, 1);
+}
+
+static double horizontal_sum_sse2(__m128d v) {
+  return _mm_cvtsd_f64(_mm_add_sd(v, _mm_unpackhi_pd(v, v)));
+}
+
+static double sum_sse2(const double *a, int n) {
+  __m128d acc = _mm_setzero_pd();
+  int i = 0;
+  for(; i + 2 <= n; i += 2) {
+    acc = _mm_add_pd(acc, _mm_loadu_pd(a + i));
+  }
+  return horizontal_sum_sse2(acc) + sum_scalar(a + i, n - i);
+}
+
+static double dot_sse2(const double *a, const double *b, int n) {
+  __m128d acc = _mm_setzero_pd();
+  int i = 0;
+  for(; i + 2 <= n; i += 2) {
+    acc = _mm_add_pd(acc, _mm_mul_pd(_mm_loadu_pd(a + i), _mm_loadu_pd(b + i)));
+  }
+  return horizontal_sum_sse2(acc) + dot_scalar(a + i, b + i, n - i);
+}
+
+static double min_sse2(const double *a, int n) {
+  if(n < 2) {
+    return min_scalar(a, n);
+  }
+  __m128d m = _mm_loadu_pd(a);
+  int i = 2;
+  for(; i + 2 <= n; i += 2) {
+    m = _mm_min_pd(m, _mm_loadu_pd(a + i));
+  }
+  double lanes[2];
+  _mm_storeu_pd(lanes, m);
+  double result = lanes[0] < lanes[1] ? lanes[0] : lanes[1];
+  return i < n && a[i] < result ? a[i] : result;
+}
+
+static double max_sse2(const double *a, int n) {
+  if(n < 2) {
+    return max_scalar(a, n);
+  }
+  __m128d m = _mm_loadu_pd(a);
+  int i = 2;
+  for(; i + 2 <= n; i += 2) {
+    m = _mm_max_pd(m, _mm_loadu_pd(a + i));
+  }
+  double lanes[2];
+  _mm_storeu_pd(lanes, m);
+  double result = lanes[0] > lanes[1] ? lanes[0] : lanes[1];
+  return i < n && a[i] > result ? a[i] : result;
+}
+
+static const SimdKernels sse2_kernels = {
+  "sse2", add_sse2, sub_sse2, mul_sse2, div_sse2, fma_sse2, fma_scalar_sse2,
+  clamp_sse2, sin_sse2, cos_sse2, sum_sse2, dot_sse2, min_sse2, max_sse2,
+};
+
+// -------- AVX2 + FMA, four doubles at a time --------
+// Compiled for these instructions even when the rest of the program isn't, only called after checking the CPU.
+
+#define AVX2 __attribute__((target("avx2,fma")))
+
+#define AVX2_BINARY(name, op)						\
+  AVX2 static void name##_avx2(double *out, const double *a, const double *b, int n) { \
+    int i = 0;								\
+    for(; i + 4 <= n; i += 4) {						\
+      _mm256_storeu_pd(out + i, op(_mm256_loadu_pd(a + i), _mm256_loadu_pd(b + i))); \
+    }									\
+    name##_scalar(out + i, a + i, b + i, n - i);			\
+  }
+
+AVX2_BINARY(add, _mm256_add_pd)
+AVX2_BINARY(sub, _mm256_sub_pd)
+AVX2_BINARY(mul, _mm256_mul_pd)
+AVX2_BINARY(div, _mm256_div_pd)
+
+AVX2 static void fma_avx2(double *out, const double *a, const double *b, const double *c, int n) {
+  int i = 0;
+  for(; i + 4 <= n; i += 4) {
+    _mm256_storeu_pd(out + i, _mm256_fmadd_pd(_mm256_loadu_pd(a + i), _mm256_loadu_pd(b + i), _mm256_loadu_pd(c + i)));
+  }
+  fma_scalar(out + i, a + i, b + i, c + i, n - i);
+}
+
+AVX2 static void fma_scalar_avx2(double *out, const double *a, double b, const double *c, int n) {
+  __m256d vb = _mm256_set1_pd(b);
+  int i = 0;
+  for(; i + 4 <= n; i += 4) {
+    _mm256_storeu_pd(out + i, _mm256_fmadd_pd(_mm256_loadu_pd(a + i), vb, _mm256_loadu_pd(c + i)));
+  }
+  fma_scalar_scalar(out + i, a + i, b, c + i, n - i);
+}
+
+AVX2 static void clamp_avx2(double *out, const double *a, double lo, double hi, int n) {
+  __m256d vlo = _mm256_set1_pd(lo);
+  __m256d vhi = _mm256_set1_pd(hi);
+  int i = 0;
+  for(; i + 4 <= n; i += 4) {
+    _mm256_storeu_pd(out + i, _mm256_min_pd(_mm256_max_pd(_mm256_loadu_pd(a + i), vlo), vhi));
+  }
+  clamp_scalar(out + i, a + i, lo, hi, n - i);
+}
+
+AVX2 static __m256d trig_avx2(__m256d x, int quadrant_offset) {
+  __m256d magic = _mm256_set1_pd(ROUNDING_MAGIC);
+  __m256d t = _mm256_fmadd_pd(x, _mm256_set1_pd(TWO_OVER_PI), magic);
+  __m256d k = _mm256_sub_pd(t, magic);
+  __m256i quadrant = _mm256_add_epi64(_mm256_castpd_si256(t), _mm256_set1_epi64x(quadrant_offset));
+
+  __m256d r = _mm256_fnmadd_pd(k, _mm256_set1_pd(PIO2_HI), x);
+  r = _mm256_fnmadd_pd(k, _mm256_set1_pd(PIO2_LO), r);
+  __m256d z = _mm256_mul_pd(r, r);
+
+  __m256d ps = _mm256_set1_pd(S6);
+  ps = _mm256_fmadd_pd(ps, z, _mm256_set1_pd(S5));
+  ps = _mm256_fmadd_pd(ps, z, _mm256_set1_pd(S4));
+  ps = _mm256_fmadd_pd(ps, z, _mm256_set1_pd(S3));
+  ps = _mm256_fmadd_pd(ps, z, _mm256_set1_pd(S2));
+  ps = _mm256_fmadd_pd(ps, z, _mm256_set1_pd(S1));
+  __m256d s = _mm256_fmadd_pd(_mm256_mul_pd(r, z), ps, r);
+
+  __m256d pc = _mm256_set1_pd(C6);
+  pc = _mm256_fmadd_pd(pc, z, _mm256_set1_pd(C5));
+  pc = _mm256_fmadd_pd(pc, z, _mm256_set1_pd(C4));
+  pc = _mm256_fmadd_pd(pc, z, _mm256_set1_pd(C3));
+  pc = _mm256_fmadd_pd(pc, z, _mm256_set1_pd(C2));
+  pc = _mm256_fmadd_pd(pc, z, _mm256_set1_pd(C1));
+  __m256d c = _mm256_fnmadd_pd(_mm256_set1_pd(0.5), z, _mm256_set1_pd(1.0));
+  c = _mm256_fmadd_pd(_mm256_mul_pd(z, z), pc, c);
+
+  // Odd quadrants use the cosine polynomial, quadrant 2 and 3 flip the sign
+  __m256i one = _mm256_set1_epi64x(1);
+  __m256d swap = _mm256_castsi256_pd(_mm256_cmpeq_epi64(_mm256_and_si256(quadrant, one), one));
+  __m256d result = _mm256_blendv_pd(s, c, swap);
+  __m256i sign = _mm256_slli_epi64(_mm256_and_si256(quadrant, _mm256_set1_epi64x(2)), 62);
+  return _mm256_xor_pd(result, _mm256_castsi256_pd(sign));
+}
+
+AVX2 static void trig_array_avx2(double *out, const double *a, int n, int quadrant_offset) {
+  __m256d limit = _mm256_set1_pd(TRIG_LIMIT);
+  __m256d abs_mask = _mm256_castsi256_pd(_mm256_set1_epi64x(0x7FFFFFFFFFFFFFFFLL));
+  int i = 0;
+  for(; i + 4 <= n; i += 4) {
+    __m256d x = _mm256_loadu_pd(a + i);
+    if(_mm256_movemask_pd(_mm256_cmp_pd(_mm256_and_pd(x, abs_mask), limit, _CMP_NLE_UQ))) {
+      for(int j = i; j < i + 4; j++) {
+	out[j] = trig_scalar(a[j], quadrant_offset); // huge or NaN, let libm handle it
+      }
+    } else {
+      _mm256_storeu_pd(out + i, trig_avx2(x, quadrant_offset));
+    }
+  }
+  for(; i < n; i++) {
+    out[i] = trig_scalar(a[i], quadrant_offset);
+  }
+}
+
+AVX2 static void sin_avx2(double *out, const double *a, int n) {
+  trig_array_avx2(out, a, n, 0);
+}
+
+AVX2 static void cos_avx2(double *out, const double *a, int n) {
+  trig_array_avx2(out, a, n, 1);
+}
+
+AVX2 static double horizontal_sum_avx2(__m256d v) {
+  __m128d pair = _mm_add_pd(_mm256_castpd256_pd128(v), _mm256_extractf128_pd(v, 1));
+  return _mm_cvtsd_f64(_mm_add_sd(pair, _mm_unpackhi_pd(pair, pair)));
+}
+
+AVX2 static double sum_avx2(const double *a, int n) {
+  // Two accumulators to hide the latency of the additions
+  __m256d acc0 = _mm256_setzero_pd();
+  __m256d acc1 = _mm256_setzero_pd();
+  int i = 0;
+  for(; i + 8 <= n; i += 8) {
+    acc0 = _mm256_add_pd(acc0, _mm256_loadu_pd(a + i));
+    acc1 = _mm256_add_pd(acc1, _mm256_loadu_pd(a + i + 4));
+  }
+  return horizontal_sum_avx2(_mm256_add_pd(acc0, acc1)) + sum_scalar(a + i, n - i);
+}
+
+AVX2 static double dot_avx2(const double *a, const double *b, int n) {
+  __m256d acc0 = _mm256_setzero_pd();
+  __m256d acc1 = _mm256_setzero_pd();
+  int i = 0;
+  for(; i + 8 <= n; i += 8) {
+    acc0 = _mm256_fmadd_pd(_mm256_loadu_pd(a + i), _mm256_loadu_pd(b + i), acc0);
+    acc1 = _mm256_fmadd_pd(_mm256_loadu_pd(a + i + 4), _mm256_loadu_pd(b + i + 4), acc1);
+  }
+  return horizontal_sum_avx2(_mm256_add_pd(acc0, acc1)) + dot_scalar(a + i, b + i, n - i);
+}
+
+AVX2 static double min_avx2(const double *a, int n) {
+  if(n < 4) {
+    return min_scalar(a, n);
+  }
+  __m256d m = _mm256_loadu_pd(a);
+  int i = 4;
+  for(; i + 4 <= n; i += 4) {
+    m = _mm256_min_pd(m, _mm256_loadu_pd(a + i));
+  }
+  double lanes[4];
+  _mm256_storeu_pd(lanes, m);
+  double result = min_scalar(lanes, 4);
+  return i < n ? fmin(result, min_scalar(a + i, n - i)) : result;
+}
+
+AVX2 static double max_avx2(const double *a, int n) {
+  if(n < 4) {
+    return max_scalar(a, n);
+  }
+  __m256d m = _mm256_loadu_pd(a);
+  int i = 4;
+  for(; i + 4 <= n; i += 4) {
+    m = _mm256_max_pd(m, _mm256_loadu_pd(a + i));
+  }
+  double lanes[4];
+  _mm256_storeu_pd(lanes, m);
+  double result = max_scalar(lanes, 4);
+  return i < n ? fmax(result, max_scalar(a + i, n - i)) : result;
+}
+
+static const SimdKernels avx2_kernels = {
+  "avx2", add_avx2, sub_avx2, mul_avx2, div_avx2, fma_avx2, fma_scalar_avx2,
+  clamp_avx2, sin_avx2, cos_avx2, sum_avx2, dot_avx2, min_avx2, max_avx2,
+};
+
+static bool cpu_has_avx2() {
+  __builtin_cpu_init();
+  return __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma");
+}
+
+#endif
+
+const SimdKernels *simd_kernels_named(const char *name) {
+  if(strcmp(name, "scalar") == 0) {
+    return &scalar_kernels;
+  }
+#if SIMD_X86
+  if(strcmp(name, "sse2") == 0) {
+    return &sse2_kernels; // part of every x86-64 CPU
+  }
+  if(strcmp(name, "avx2") == 0 && cpu_has_avx2()) {
+    return &avx2_kernels;
+  }
+#endif
+  return NULL;
+}
+
+static const SimdKernels *best_kernels = NULL;
+static pthread_once_t best_kernels_once = PTHREAD_ONCE_INIT; // runtimes on different threads can ask at the same time
+
+static void pick_best_kernels() {
+  best_kernels = simd_kernels_named("avx2");
+  if(!best_kernels) best_kernels = simd_kernels_named("sse2");
+  if(!best_kernels) best_kernels = &scalar_kernels;
+}
+
+const SimdKernels *simd_kernels() {
+  pthread_once(&best_kernels_once, pick_best_kernels);
+  return best_kernels;
+}
@@ -0,0 +1,73 @@
+#include "StrBuilder.h"
+#include "Number.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+void str_builder_init(StrBuilder *sb, int capacity) {
+  if(capacity < 16) {
+    capacity = 16;
+  }
+  sb->data = malloc(capacity);
+  sb->data[0] = '\0';
+  sb->length = 0;
+  sb->capacity = capacity;
+}
+
+void str_builder_free(StrBuilder *sb) {
+  free(sb->data);
+  sb->data = NULL;
+  sb->length = 0;
+  sb->capacity = 0;
+}
+
+void str_builder_clear(StrBuilder *sb) {
+  sb->length = 0;
+  sb->data[0] = '\0';
+}
+
+// Makes room for 'extra' chars plus the null terminator.
+void str_builder_reserve(StrBuilder *sb, int extra) {
+  int needed = sb->length + extra + 1;
+  if(needed > sb->capacity) {
+    int capacity = sb->capacity * 2;
+    while(capacity < needed) {
+      capacity *= 2;
+    }
+    sb->data = realloc(sb->data, capacity);
+    sb->capacity = capacity;
+  }
+}
+
+void str_builder_append(StrBuilder *sb, const char *s, int length) {
+  str_builder_reserve(sb, length);
+  memcpy(sb->data + sb->length, s, length);
+  sb->length += length;
+  sb->data[sb->length] = '\0';
+}
+
+void str_builder_append_str(StrBuilder *sb, const char *s) {
+  str_builder_append(sb, s, strlen(s));
+}
+
+void str_builder_append_char(StrBuilder *sb, char c) {
+  str_builder_reserve(sb, 1);
+  sb->data[sb->length++] = c;
+  sb->data[sb->length] = '\0';
+}
+
+void str_builder_append_number(StrBuilder *sb, double x) {
+  str_builder_reserve(sb, NUMBER_FORMAT_MAX);
+  sb->length += number_format(x, sb->data + sb->length);
+}
+
+char *str_builder_take(StrBuilder *sb, int *OUT_length) {
+  char *data = sb->data;
+  if(OUT_length) {
+    *OUT_length = sb->length;
+  }
+  sb->data = NULL;
+  sb->length = 0;
+  sb->capacity = 0;
+  return data;
+}
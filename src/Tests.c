@@ -0,0 +1,1034 @@
+#include "Tests.h"
+#include <assert.h>
+#include <math.h>
+#include <stdint.h>
+#include <string.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include "GC.h"
+#include "Obj.h"
+#include "Parser.h"
+#include "Runtime.h"
+#include "Bytecode.h"
+#include "Compiler.h"
+#include "Serialize.h"
+#include "Image.h"
+#include "Embed.h"
+#include "Number.h"
+#include "Vector.h"
+#include "Map.h"
+#include "Array.h"
+#include "Simd.h"
+#include "Macro.h"
+#include "Lazy.h"
+#include "Isolate.h"
+
+void test_gc() {
+  GC *gc = gc_new();
+
+  Obj *sym1 = gc_make_symbol(gc, "sym1");
+  Obj *sym2 = gc_make_symbol(gc, "sym2");
+  Obj *sym3 = gc_make_symbol(gc, "sym3");
+  Obj *sym4 = gc_make_symbol(gc, "sym4");
+  
+  Obj *cell1 = gc_make_cons(gc, NULL, NULL);
+  Obj *cell2 = gc_make_cons(gc, NULL, NULL);
+  Obj *cell3 = gc_make_cons(gc, NULL, NULL);
+  Obj *cell4 = gc_make_cons(gc, NULL, NULL);
+
+  cell1->car = sym1;
+  cell1->cdr = cell2;
+  cell2->car = sym2;
+
+  // lone loop
+  cell3->car = cell4;
+  cell4->cdr = cell3;
+
+  gc_stack_push(gc, cell1);
+
+  GCResult r1 = gc_collect(gc);
+  assert(r1.alive == 4);
+  assert(r1.freed == 4);
+	 
+  GCResult r2 = gc_collect(gc);
+  assert(r2.alive == 4);
+  assert(r2.freed == 0);
+
+  gc_stack_pop_safely(gc);
+  
+  GCResult r3 = gc_collect(gc);
+  assert(r3.alive == 0);
+  assert(r3.freed == 4);
+
+  gc_delete(gc);
+}
+
+void test_printing() {
+  GC *gc = gc_new();
+  
+  Obj *cell1 = gc_make_cons(gc, NULL, NULL);
+  Obj *sym1 = gc_make_symbol(gc, "sym1");
+  Obj *cell2 = gc_make_cons(gc, sym1, cell1);
+  Obj *sym2 = gc_make_symbol(gc, "sym2");
+  Obj *cell3 = gc_make_cons(gc, sym2, cell2);
+  Obj *sym3 = gc_make_symbol(gc, "sym3");
+  Obj *cell4 = gc_make_cons(gc, sym3, cell3);
+  
+  print_obj(cell1); printf("\n");
+  print_obj(cell2); printf("\n");
+  print_obj(cell3); printf("\n");
+  print_obj(cell4); printf("\n");
+
+  // Add a list in the middle of the list
+  Obj *cell5 = gc_make_cons(gc, NULL, NULL);
+  Obj *cell6 = gc_make_cons(gc, gc_make_symbol(gc, "sym10"), cell5);
+  Obj *cell7 = gc_make_cons(gc, gc_make_symbol(gc, "sym20"), cell6);
+  cell3->car = cell7;
+  print_obj(cell4); printf("\n");
+
+  // A weird cell with head but no tail
+  cell1->car = sym1;
+  cell1->cdr = NULL;
+  print_obj(cell1); printf("\n");
+
+  gc_collect(gc);
+  gc_delete(gc);
+}
+
+void test_parsing() {
+  GC *gc = gc_new();  
+  Obj *forms = parse(gc, "() a b c (d e) ((f g h () ()) (() i j) (k (() l ()) m))");
+  print_obj(forms);
+  gc_delete(gc);
+}
+
+void test_runtime() {
+  Runtime *r = runtime_new(true);
+  //runtime_eval(r, "(def a (quote b)) a bleh (bleh)");
+  //runtime_eval(r, "(bleh) (print-sym (quote apa)) (print-two-syms (quote erik) (quote svedang))");
+  //runtime_eval(r, "(+ 2 3)");
+  //runtime_eval(r, "\"erik\"");
+  //runtime_eval(r, "(break) 3 4 5 (+ 2 3) (break) 10 20");
+  //runtime_inspect_env(r);
+  runtime_delete(r);
+}
+
+void test_str_allocs() {
+  printf("sizeof(char) = %ld\n", sizeof(char));
+  
+  const char *a = "aha";
+  printf("sizeof(a) = %ld\n", sizeof(a));
+
+  const char *b = "booo";
+  printf("sizeof(b) = %ld\n", sizeof(b));
+
+  const char *c = "jo men så attehh....";
+  printf("sizeof(c) = %ld\n", sizeof(c));
+
+  const char *d = malloc(256);
+  printf("sizeof(d) = %ld\n", sizeof(d));  
+}
+
+void test_store_pointer_in_int_array() {
+  Obj *o = malloc(sizeof(Obj));
+  o->name = "foo";
+  
+  int a[4];
+  a[0] = 10;
+  a[1] = 20;
+  a[2] = 30;
+  a[3] = 40;
+
+  printf("o = %p\n", o);
+
+  // The Obj* takes up two slots in the array
+  Obj **p = (Obj**)&a[1];
+  *p = o;
+
+  for (int i = 0; i < 4; i++) {
+    printf("%d: %d\n", i, a[i]);
+  }
+
+  // Treat the [1] position as an Obj* instead of an int
+  int *ap = &a[1];
+  Obj **oo = (Obj**)ap;
+  printf("oo = %p\n", *oo);
+  
+  printf("name = %s\n", (*oo)->name);
+}
+
+void test_bytecode() {
+  /* printf("sizeof(Code) = %lu\n", sizeof(Code)); */
+  /* printf("sizeof(Obj*) = %lu\n", sizeof(Obj*)); */
+  /* printf("sizeof(Code*) = %lu\n", sizeof(Code*)); */
+  /* printf("sizeof(int) = %lu\n", sizeof(int)); */
+  
+  Runtime *r = runtime_new(true);
+
+  //runtime_inspect_env(r);
+  //runtime_print_frames(r);
+
+  runtime_env_assoc(r, r->global_env,
+		    gc_make_symbol(r->gc, "x"),
+		    gc_make_number(r->gc, 12345));
+  
+  CodeWriter writer;
+  code_writer_init(&writer, 1024);
+  code_write_push_constant(&writer, gc_make_number(r->gc, 42.0));
+  code_write_define(&writer, gc_make_symbol(r->gc, "bleh")); // bleh = 42
+  code_write_push_constant(&writer, gc_make_number(r->gc, 100.0));
+  code_write_push_constant(&writer, gc_make_number(r->gc, 200.0));
+  code_write_direct_lookup_var(&writer, runtime_env_find_pair(r->global_env, gc_make_symbol(r->gc, "+")));
+  code_write_call(&writer, 2);
+  code_write_direct_lookup_var(&writer, runtime_env_find_pair(r->global_env, gc_make_symbol(r->gc, "bleh")));
+  code_write_direct_lookup_var(&writer, runtime_env_find_pair(r->global_env, gc_make_symbol(r->gc, "*")));
+  code_write_call(&writer, 2);
+  code_write_end(&writer);
+
+  //code_print(writer.codes);
+  
+  runtime_frame_push(r, 0, NULL, writer.codes, "testframe");
+
+  while(r->top_frame >= 0) {
+    runtime_step_eval(r);
+  }
+
+  gc_stack_print(r->gc, false);
+  runtime_delete(r);
+}
+
+void test_bytecode_jump() {
+  Runtime *r = runtime_new(true);
+
+  CodeWriter writer;
+  code_writer_init(&writer, 1024);
+  code_write_push_constant(&writer, gc_make_number(r->gc, 10));
+  code_write_jump(&writer, 6);
+  code_write_push_constant(&writer, gc_make_number(r->gc, 20));
+  code_write_push_constant(&writer, gc_make_number(r->gc, 30));
+  code_write_push_constant(&writer, gc_make_number(r->gc, 40));
+  code_write_push_constant(&writer, gc_make_number(r->gc, 50));
+  code_write_end(&writer);
+
+  //code_print(writer.codes);
+  
+  runtime_frame_push(r, 0, NULL, writer.codes, "testframe");
+
+  while(r->top_frame >= 0) {
+    runtime_step_eval(r);
+  }
+
+  gc_stack_print(r->gc, false);
+  runtime_delete(r);
+}
+
+
+
+void test_bytecode_if() {
+
+  Runtime *r = runtime_new(true);
+
+  int code_length = 0;
+  Code *c = compile(r, false, parse(r->gc, "(if 1 1337 404)")->car, &code_length, NULL);
+  code_print(c);
+  printf("Code length: %d\n", code_length);
+  //return;
+
+  printf("\n\n ************************************************ \n\n");
+
+  // The following code works and is what we want to produce above
+    
+  CodeWriter writer;
+  code_writer_init(&writer, 1024);
+
+  //code_write_push_constant(&writer, r->nil); // <-- false
+  code_write_push_constant(&writer, gc_make_number(r->gc, 1)); // <-- true
+
+  int length_of_false_block = 5;
+  int length_of_true_block = 3;
+  
+  code_write_if(&writer);
+  code_write_jump(&writer, length_of_false_block); // this one leads to the true branch
+  // false branch
+  code_write_push_constant(&writer, gc_make_number(r->gc, 404));
+  code_write_jump(&writer, length_of_true_block);
+  // true branch
+  code_write_push_constant(&writer, gc_make_number(r->gc, 1337));
+  // merge
+  code_write_push_constant(&writer, gc_make_string(r->gc, "BRANCHES MERGE HERE"));
+  code_write_end(&writer);
+
+  code_print(writer.codes);
+  printf("\n");
+  
+  runtime_frame_push(r, 0, NULL, writer.codes, "top-level");
+
+  while(r->top_frame >= 0) {
+    runtime_step_eval(r);
+  }
+
+  printf("\n");
+  gc_stack_print(r->gc, false);
+  runtime_delete(r);
+}
+
+
+
+void test_bytecode_with_lambda() {
+  Runtime *r = runtime_new(true);
+  
+  CodeWriter writer;
+
+  // Write code for lambda: (fn (dront) (* dront dront))
+  code_writer_init(&writer, 1024);
+  code_write_push_constant(&writer, gc_make_symbol(r->gc, "dront"));
+  code_write_push_constant(&writer, gc_make_symbol(r->gc, "dront"));
+  code_write_direct_lookup_var(&writer, runtime_env_find_pair(r->global_env, gc_make_symbol(r->gc, "*")));
+  code_write_call(&writer, 2);
+  code_write_return(&writer);
+  code_write_end(&writer);
+
+  //code_print(writer.codes);
+  Code *lambda_code = writer.codes;
+
+  Obj *forms = parse(r->gc, "(fn (dront) (* dront dront))");
+  Obj *form = forms->car;
+  Obj *args = form->cdr->car;
+  Obj *body = form->cdr->cdr->car;
+  /* printf("Args: "); print_obj(args); printf("\n"); */
+  /* printf("Body: "); print_obj(body); printf("\n"); */
+
+  // Write code for main: ((fn (dront) (* dront dront)) 5)
+  code_writer_init(&writer, 1024);
+  code_write_push_constant(&writer, gc_make_number(r->gc, 5.0));
+  code_write_push_lambda(&writer, args, body, r->nil, r->nil);
+  code_write_call(&writer, 1); // one arg
+  code_write_end(&writer);
+  //code_print(writer.codes);
+  
+  runtime_frame_push(r, 0, NULL, writer.codes, "testframe");
+
+  while(r->top_frame >= 0) {
+    runtime_step_eval(r);
+  }
+
+  gc_stack_print(r->gc, false);
+  runtime_delete(r);
+}
+
+void test_compiler() {
+  compile_and_print("(def a 10)");
+  //compile_and_print("(+ 2 3)");
+  //compile_and_print("(fn (x y) (* x x y))");
+  return;
+
+  Runtime *r = runtime_new(true);
+
+  Obj *forms = parse(r->gc, "(- 20 3)");
+  Obj *form = forms->car;
+  int len;
+  Code *code = compile(r, false, form, &len, NULL);
+  code_print(code);
+  runtime_frame_push(r, 0, NULL, code, "top-level");
+  
+  while(r->top_frame >= 0) {
+    runtime_step_eval(r);
+  }
+
+  gc_stack_print(r->gc, false);
+  runtime_delete(r);
+}
+
+void test_serialize() {
+  Runtime *r = runtime_new(true);
+
+  Obj *form = parse(r->gc, "(def twice (fn (x) (* 2 x)))")->car;
+  Code *code = compile(r, false, form, NULL, NULL);
+
+  Serializer s;
+  serializer_init(&s);
+  assert(serialize_obj(&s, parse(r->gc, "(a \"b\" 3.5 (c) ())")->car));
+  assert(serialize_code(&s, code));
+
+  Deserializer d;
+  deserializer_init(&d, s.data, s.size);
+  Obj *o = deserialize_obj(&d, r);
+  assert(eq(o, parse(r->gc, "(a \"b\" 3.5 (c) ())")->car));
+  Code *loaded_code = deserialize_code(&d, r);
+  assert(loaded_code);
+  assert(d.pos == d.end);
+  code_print(loaded_code);
+
+  serializer_free(&s);
+  free(code);
+  free(loaded_code);
+  runtime_delete(r);
+}
+
+void test_image() {
+  Runtime *r = runtime_new(true);
+  runtime_eval(r, "(def square (fn (x) (* x x))) (def xs '(1 2 3))");
+  assert(image_save(r, "/tmp/pilsner_test.img"));
+  runtime_delete(r);
+
+  Runtime *restored = image_load("/tmp/pilsner_test.img");
+  assert(restored);
+  runtime_eval(restored, "(square 12) xs (+ 1 2)");
+  gc_collect(restored->gc);
+  runtime_eval(restored, "(square (first xs))");
+  runtime_delete(restored);
+}
+
+void test_numbers() {
+  char buffer[NUMBER_FORMAT_MAX];
+  const char *texts[] = { "0", "42", "-7", "0.1", "3.25", "-0.001234", "1e30", "1.5e-7", "123456789012", "5e-324" };
+  for(int i = 0; i < sizeof(texts) / sizeof(texts[0]); i++) {
+    double x;
+    const char *end = texts[i] + strlen(texts[i]);
+    assert(number_parse(texts[i], end, &x) == end);
+    number_format(x, buffer);
+    assert(strcmp(buffer, texts[i]) == 0);
+  }
+
+  // Random bit patterns must survive a round trip through text
+  for(int i = 0; i < 100000; i++) {
+    uint64_t bits = ((uint64_t)rand() << 40) ^ ((uint64_t)rand() << 20) ^ (uint64_t)rand();
+    double x, y;
+    memcpy(&x, &bits, sizeof(double));
+    if(isnan(x) || isinf(x)) {
+      continue;
+    }
+    int length = number_format(x, buffer);
+    assert(number_parse(buffer, buffer + length, &y) == buffer + length);
+    assert(x == y);
+  }
+}
+
+void test_vector() {
+  GC *gc = gc_new();
+  Obj *v = gc_make_vector(gc, NULL, NULL, 0, VECTOR_BITS);
+  for(int i = 0; i < 5000; i++) {
+    v = vector_conj(gc, v, gc_make_number(gc, i));
+  }
+  assert(v->count == 5000);
+  for(int i = 0; i < 5000; i++) {
+    assert(vector_nth(v, i)->number == i);
+  }
+
+  // The old vector must not change when a new one is made from it
+  Obj *w = vector_assoc(gc, v, 1234, gc_make_number(gc, -1));
+  assert(vector_nth(w, 1234)->number == -1);
+  assert(vector_nth(v, 1234)->number == 1234);
+  assert(vector_nth(v, 5000) == NULL);
+
+  Obj *forms = parse(gc, "[1 [2 3] \"four\"]");
+  print_obj(forms);
+  printf("\n");
+  assert(forms->car->type == VECTOR && forms->car->count == 3);
+  gc_delete(gc);
+}
+
+void test_map() {
+  GC *gc = gc_new();
+  Obj *m = gc_make_map(gc, NULL, 0);
+  for(int i = 0; i < 5000; i++) {
+    m = map_assoc(gc, m, gc_make_number(gc, i), gc_make_number(gc, i * 2));
+  }
+  assert(m->count == 5000);
+  for(int i = 0; i < 5000; i++) {
+    Obj *key = gc_make_number(gc, i);
+    assert(map_get(m, key)->number == i * 2);
+  }
+
+  Obj *smaller = m;
+  for(int i = 0; i < 5000; i += 2) {
+    smaller = map_dissoc(gc, smaller, gc_make_number(gc, i));
+  }
+  assert(smaller->count == 2500);
+  assert(map_get(smaller, gc_make_number(gc, 10)) == NULL);
+  assert(map_get(smaller, gc_make_number(gc, 11))->number == 22);
+  assert(map_get(m, gc_make_number(gc, 10))->number == 20);
+
+  // Structurally equal keys find the same entry
+  Obj *key = parse(gc, "(a [1 2] \"b\")")->car;
+  m = map_assoc(gc, m, key, gc_make_symbol(gc, "found"));
+  assert(eq(map_get(m, parse(gc, "(a [1 2] \"b\")")->car), gc_make_symbol(gc, "found")));
+  assert(obj_hash(parse(gc, "{1 2 3 4}")->car) == obj_hash(parse(gc, "{3 4 1 2}")->car));
+  gc_delete(gc);
+}
+
+void test_array() {
+  GC *gc = gc_new();
+
+  // The host's buffer is used as it is, changes are visible on both sides
+  float vertices[6] = { 0.0f, 1.0f, 2.0f, 3.0f, 4.0f, 5.0f };
+  Obj *array = gc_make_array_from_buffer(gc, ARRAY_F32, vertices, 6);
+  Obj *slice = array_slice(gc, array, 2, 5);
+  assert(slice->count == 3 && array_get(slice, 0) == 2.0);
+  array_set(slice, 1, 30.0);
+  assert(vertices[3] == 30.0f);
+  assert(array_slice(gc, array, 4, 7) == NULL);
+
+  // A slice keeps the array that owns the data alive
+  Obj *owned = gc_make_array(gc, ARRAY_F64, 100);
+  gc_stack_push(gc, array_slice(gc, array_slice(gc, owned, 10, 90), 5, 10));
+  GCResult result = gc_collect(gc);
+  assert(result.alive == 3); // nil, the slice and its owner
+  gc_delete(gc);
+}
+
+void test_simd() {
+  const int n = 1003; // not a multiple of the vector widths, so that the tails are used too
+  double a[n], b[n], c[n], expected[n], out[n];
+  for(int i = 0; i < n; i++) {
+    a[i] = (i - 500) * 0.37;
+    b[i] = 1.0 + i % 7;
+    c[i] = -i * 0.5;
+  }
+  const char *names[] = { "scalar", "sse2", "avx2" };
+  for(int k = 0; k < 3; k++) {
+    const SimdKernels *kernels = simd_kernels_named(names[k]);
+    if(!kernels) {
+      continue;
+    }
+    kernels->fma(out, a, b, c, n);
+    for(int i = 0; i < n; i++) assert(fabs(out[i] - (a[i] * b[i] + c[i])) < 1e-9);
+    kernels->div(out, a, b, n);
+    for(int i = 0; i < n; i++) assert(out[i] == a[i] / b[i]);
+    kernels->clamp(out, a, -10.0, 10.0, n);
+    for(int i = 0; i < n; i++) assert(out[i] == fmin(fmax(a[i], -10.0), 10.0));
+    kernels->sin(out, a, n);
+    for(int i = 0; i < n; i++) assert(fabs(out[i] - sin(a[i])) < 1e-14);
+    kernels->cos(out, a, n);
+    for(int i = 0; i < n; i++) assert(fabs(out[i] - cos(a[i])) < 1e-14);
+    assert(fabs(kernels->dot(a, b, n) - simd_kernels_named("scalar")->dot(a, b, n)) < 1e-6);
+    assert(kernels->min(a, n) == a[0] && kernels->max(a, n) == a[n - 1]);
+  }
+  expected[0] = 1e300; // huge values fall back to libm
+  simd_kernels()->sin(out, expected, 1);
+  assert(out[0] == sin(1e300));
+}
+
+void test_macros() {
+  Runtime *r = runtime_new(true);
+  runtime_eval(r, "(defmacro swap (a b) (list b a))");
+  Obj *form = parse(r->gc, "(swap 5 not)")->car;
+  gc_stack_push(r->gc, form);
+  Code *code = compile(r, false, form, NULL, NULL);
+  assert(code);
+  free(code);
+
+  // The expansion is cached for the form and survives a collection, unlike the expansions of dropped forms
+  Obj *expansion = expansion_cache_get(&r->expansions, form);
+  assert(expansion && eq(expansion->cdr, parse(r->gc, "(not 5)")->car));
+  for(int i = 0; i < 1000; i++) {
+    free(compile(r, false, parse(r->gc, "(swap 1 not)")->car, NULL, NULL));
+  }
+  assert(r->expansions.count == 1001);
+  gc_collect(r->gc);
+  assert(r->expansions.count == 1);
+  assert(expansion_cache_get(&r->expansions, form) == expansion);
+  gc_stack_pop_safely(r->gc);
+
+  // A macro gets its args in the slots of a frame, so it can't have more of them
+  char source[1024] = "(defmacro many (";
+  for(int i = 0; i <= MAX_SLOTS; i++) {
+    sprintf(source + strlen(source), "a%d ", i);
+  }
+  strcat(source, ") nil)");
+  runtime_eval(r, source);
+  assert(!runtime_env_find_pair(r->macros, gc_make_symbol(r->gc, "many")));
+  runtime_delete(r);
+}
+
+void test_long_lists() {
+  Runtime *r = runtime_new(true);
+  runtime_eval(r, "(def xs (map (fn (x) (* x 2)) (range 1 1000000)))");
+  gc_collect(r->gc); // marking must not recurse once per cons
+  runtime_eval(r, "(def total (reduce + 0 xs))");
+  assert(runtime_env_find_pair(r->global_env, gc_make_symbol(r->gc, "total"))->cdr->number == 1000001000000.0);
+  runtime_delete(r);
+}
+
+void test_lazy_seqs() {
+  Runtime *r = runtime_new(true);
+  runtime_eval(r, "(def xs (map (fn (x) (* x 2)) (range 1 100)))");
+  Obj *xs = runtime_env_find_pair(r->global_env, gc_make_symbol(r->gc, "xs"))->cdr;
+  assert(xs->type == LAZY_SEQ && xs->lazy_kind == LAZY_MAP);
+
+  // The first access realizes one chunk, the rest is still lazy
+  runtime_eval(r, "(def x (first (rest xs)))");
+  assert(runtime_env_find_pair(r->global_env, gc_make_symbol(r->gc, "x"))->cdr->number == 4);
+  assert(xs->lazy_kind == LAZY_REALIZED);
+  Obj *list = xs->lazy_seq;
+  for(int i = 0; i < LAZY_CHUNK_SIZE; i++) {
+    assert(list->type == CONS);
+    list = list->cdr;
+  }
+  assert(list->type == LAZY_SEQ && list->lazy_kind == LAZY_MAP);
+
+  // The captured function and source survive a collection
+  gc_collect(r->gc);
+  runtime_eval(r, "(def total (reduce + 0 xs))");
+  assert(runtime_env_find_pair(r->global_env, gc_make_symbol(r->gc, "total"))->cdr->number == 10100.0);
+  runtime_delete(r);
+}
+
+void test_fatal_error_recovery() {
+  Runtime *r = runtime_new(true);
+  runtime_eval(r, "(def deep (fn (n) (if (= n 0) 0 (+ 1 (deep (- n 1))))))");
+  int stack_size = r->gc->stackSize;
+  runtime_eval(r, "(def result (deep 100000))"); // overflows the frames
+  assert(r->gc->error.message != NULL);
+  assert(r->gc->stackSize == stack_size && r->top_frame == -1);
+  runtime_eval(r, "(def result (deep 100))");
+  assert(runtime_env_find_pair(r->global_env, gc_make_symbol(r->gc, "result"))->cdr->number == 100);
+
+  // Calling something that isn't a function leaves nil instead of the args on the stack, also after inlining
+  runtime_eval(r, "(def sq 5)");
+  runtime_eval(r, "(def u (fn (y) (+ (sq y) 1)))");
+  runtime_eval(r, "(u 3)");
+  assert(r->gc->stackSize == stack_size);
+  runtime_eval(r, "(def sq (fn (x) (* x x)))");
+  runtime_eval(r, "(def use-sq (fn (y) (+ (sq y) 1)))");
+  runtime_eval(r, "(use-sq 3)");
+  runtime_eval(r, "(def sq 5)");
+  runtime_eval(r, "(use-sq 3)");
+  assert(r->gc->stackSize == stack_size);
+  runtime_delete(r);
+}
+
+void *run_isolated_runtime(void *data) {
+  double *result = data;
+  Runtime *r = runtime_new(true);
+  runtime_eval(r, "(def fib (fn (n) (if (= n 0) 0 (if (= n 1) 1 (+ (fib (- n 1)) (fib (- n 2)))))))");
+  runtime_eval(r, "(def deep (fn (n) (if (= n 0) 0 (+ 1 (deep (- n 1))))))");
+  runtime_eval(r, "(deep 100000)");
+  runtime_eval(r, "(def result (+ (fib 18) (reduce + 0 (map (fn (x) (* x x)) (range 1 1000)))))");
+  *result = runtime_env_find_pair(r->global_env, gc_make_symbol(r->gc, "result"))->cdr->number;
+  gc_collect(r->gc);
+  runtime_delete(r);
+  return NULL;
+}
+
+// Runtimes share nothing, so each thread can have its own
+void test_parallel_runtimes() {
+  const int THREAD_COUNT = 8;
+  pthread_t threads[THREAD_COUNT];
+  double results[THREAD_COUNT];
+  for(int i = 0; i < THREAD_COUNT; i++) {
+    pthread_create(&threads[i], NULL, run_isolated_runtime, &results[i]);
+  }
+  for(int i = 0; i < THREAD_COUNT; i++) {
+    pthread_join(threads[i], NULL);
+    assert(results[i] == 2584 + 333833500);
+  }
+}
+
+void test_parallel_gc() {
+  Runtime *r = runtime_new(true);
+  runtime_eval(r, "(def xs (map (fn (x) (list x [x x] {x x})) (range 1 20000)))");
+  runtime_eval(r, "(def n (count xs))");
+  runtime_eval(r, "(def garbage (map (fn (x) (list x x)) (range 1 20000)))");
+  runtime_eval(r, "(count garbage)");
+  runtime_eval(r, "(def garbage nil)");
+  GCResult serial = gc_collect(r->gc);
+  runtime_eval(r, "(def garbage (map (fn (x) (list x x)) (range 1 20000)))");
+  runtime_eval(r, "(count garbage)");
+  runtime_eval(r, "(def garbage nil)");
+  gc_set_thread_count(r->gc, 4);
+  GCResult parallel = gc_collect(r->gc);
+  assert(parallel.alive == serial.alive);
+  assert(parallel.freed > 40000);
+  runtime_eval(r, "(def total (reduce + 0 (map (fn (x) (nth (nth x 1) 0)) xs)))");
+  assert(runtime_env_find_pair(r->global_env, gc_make_symbol(r->gc, "total"))->cdr->number == 200010000.0);
+  runtime_delete(r);
+}
+
+void test_lazy_sweep() {
+  GC *gc = gc_new();
+  Obj *kept = gc->nil;
+  for(int i = 0; i < 10; i++) {
+    kept = gc_make_cons(gc, gc_make_number(gc, i), kept);
+  }
+  gc_stack_push(gc, kept);
+  for(int i = 0; i < 3 * GC_PAGE_SIZE; i++) {
+    gc_make_cons(gc, NULL, NULL);
+  }
+
+  // Nothing is freed by the collection itself
+  int before = gc->obj_count;
+  gc_collect_lazily(gc);
+  assert(gc->obj_count == before);
+
+  // The first allocation sweeps a page and reuses one of its dead objects
+  Obj *number = gc_make_number(gc, 42.0);
+  assert(gc->sweep_cursor == 1);
+  assert(gc->obj_count < before);
+  gc_stack_push(gc, number);
+
+  GCResult result = gc_finish_sweep(gc);
+  assert(result.alive == 21); // nil and the kept list, the new number isn't part of this collection
+  assert(result.freed == 3 * GC_PAGE_SIZE);
+  double sum = 0;
+  for(Obj *list = kept; list->car; list = list->cdr) {
+    sum += list->car->number;
+  }
+  assert(sum == 45.0 && number->number == 42.0);
+
+  GCResult again = gc_collect(gc);
+  assert(again.alive == 22 && again.freed == 0);
+  gc_delete(gc);
+}
+
+// Each isolate sends back its own sum, computed on its own heap
+void test_isolates() {
+  Runtime *r = runtime_new(true);
+  runtime_eval(r, "(def me (self))");
+  runtime_eval(r, "(def work (fn (n) (send me (reduce + 0 (range 1 n)))))");
+  runtime_eval(r, "(def ids (list (spawn work 10) (spawn work 100) (spawn work 1000) (spawn work 10000)))");
+  runtime_eval(r, "(def total (+ (receive 10) (receive 10) (receive 10) (receive 10)))");
+  assert(runtime_env_find_pair(r->global_env, gc_make_symbol(r->gc, "total"))->cdr->number == 55 + 5050 + 500500 + 50005000);
+  runtime_eval(r, "(def closure (let (x 1) (fn () x)))");
+  runtime_eval(r, "(def failed (spawn closure))");
+  assert(runtime_env_find_pair(r->global_env, gc_make_symbol(r->gc, "failed"))->cdr == r->nil);
+
+  // Only the definitions that the function uses are sent, here through a macro that expands to a call of 'double'
+  runtime_eval(r, "(def double (fn (x) (* 2 x)))");
+  runtime_eval(r, "(defmacro twice-of (x) (list 'double x))");
+  runtime_eval(r, "(def unused 5)");
+  runtime_eval(r, "(spawn (fn () (do (send me (twice-of 21)) (send me (eval (read \"unused\"))))))");
+  runtime_eval(r, "(def sent (list (receive 10) (receive 0.2)))");
+  runtime_eval(r, "(def check (and (= (first sent) 42) (nil? (first (rest sent)))))");
+  assert(runtime_env_find_pair(r->global_env, gc_make_symbol(r->gc, "check"))->cdr == r->true_val);
+
+  // More isolates than threads, the ones that don't get a thread right away run when one is free
+  for(int i = 0; i < ISOLATE_MAX_THREADS * 2; i++) {
+    runtime_eval(r, "(spawn work 10)");
+  }
+  runtime_eval(r, "(def total 0)");
+  for(int i = 0; i < ISOLATE_MAX_THREADS * 2; i++) {
+    runtime_eval(r, "(def total (+ total (receive 10)))");
+  }
+  assert(runtime_env_find_pair(r->global_env, gc_make_symbol(r->gc, "total"))->cdr->number == 55 * ISOLATE_MAX_THREADS * 2);
+  assert(isolate_thread_count() <= ISOLATE_MAX_THREADS);
+
+  // A chain of more isolates than can run at once, each one waits for the number from the one before it.
+  // The first ones to be spawned wait for the ones that are queued after them.
+  runtime_eval(r, "(def next me)");
+  for(int i = 0; i < ISOLATE_MAX_THREADS * 2; i++) {
+    runtime_eval(r, "(def next (spawn (fn (to) (send to (+ 1 (receive)))) next))");
+  }
+  runtime_eval(r, "(send next 0)");
+  runtime_eval(r, "(def chain (receive 10))");
+  assert(runtime_env_find_pair(r->global_env, gc_make_symbol(r->gc, "chain"))->cdr->number == ISOLATE_MAX_THREADS * 2);
+  int id = r->isolate->id;
+  runtime_delete(r);
+
+  // Messages to a deleted runtime are dropped
+  Runtime *other = runtime_new(true);
+  char source[64];
+  snprintf(source, sizeof(source), "(def sent (send %d 1))", id);
+  runtime_eval(other, source);
+  assert(runtime_env_find_pair(other->global_env, gc_make_symbol(other->gc, "sent"))->cdr == other->nil);
+  runtime_delete(other);
+}
+
+void *run_code_heap_runtime(void *data) {
+  CodeHeap *heap = data;
+  Runtime *r = code_heap_runtime_new(heap);
+  runtime_eval(r, "(def result (sum-squares 10))");
+  // Redefinitions overlay the frozen globals, the code in the heap sees them too (but only in this runtime)
+  runtime_eval(r, "(def square (fn (x) (+ x x)))");
+  runtime_eval(r, "(defmacro twice (x) (list '* 3 x))");
+  runtime_eval(r, "(def cube (fn (x) (* x (square x))))");
+  runtime_eval(r, "(def after (list (sum-squares 10) (square 10) (twice 4) (cube 2) (square-plus-one 3)))");
+  runtime_eval(r, "(def check (= after '(110 20 12 8 7)))");
+  bool ok = runtime_env_find_pair(r->global_env, gc_make_symbol(r->gc, "result"))->cdr->number == 385 &&
+    runtime_env_find_pair(r->global_env, gc_make_symbol(r->gc, "check"))->cdr == r->true_val;
+  gc_collect(r->gc);
+  ok = ok && r->gc->obj_count < 100; // just the runtime's own bindings, nothing from the heap is copied
+  runtime_delete(r);
+  return ok ? heap : NULL;
+}
+
+void test_code_heap() {
+  Runtime *proto = runtime_new(true);
+  runtime_eval(proto, "(def square (fn (x) (* x x)))");
+  runtime_eval(proto, "(def sum-squares (fn (n) (reduce + 0 (map square (range 1 n)))))");
+  runtime_eval(proto, "(def square-plus-one (fn (x) (+ (square x) 1)))"); // inlines 'square'
+  runtime_eval(proto, "(defmacro twice (x) (list '* 2 x))");
+  runtime_eval(proto, "(def buffer (make-f64array 3 0))");
+  assert(code_heap_new(proto) == NULL); // arrays can be changed, so they can't be frozen
+  runtime_eval(proto, "(def buffer nil)");
+  CodeHeap *heap = code_heap_new(proto);
+  assert(heap);
+  runtime_delete(proto); // the heap has its own copy of everything
+
+  const int THREAD_COUNT = 8;
+  pthread_t threads[THREAD_COUNT];
+  for(int i = 0; i < THREAD_COUNT; i++) {
+    pthread_create(&threads[i], NULL, run_code_heap_runtime, heap);
+  }
+  for(int i = 0; i < THREAD_COUNT; i++) {
+    void *ok;
+    pthread_join(threads[i], &ok);
+    assert(ok);
+  }
+
+  // A spawned isolate is made from the same heap
+  Runtime *r = code_heap_runtime_new(heap);
+  runtime_eval(r, "(def me (self))");
+  runtime_eval(r, "(spawn (fn () (send me (twice (sum-squares 3)))))");
+  runtime_eval(r, "(def answer (receive 10))");
+  assert(runtime_env_find_pair(r->global_env, gc_make_symbol(r->gc, "answer"))->cdr->number == 28);
+  runtime_delete(r);
+  code_heap_release(heap);
+}
+
+// Calls a script function the way a game calls its update function every frame
+void test_embed() {
+  Runtime *r = runtime_new(true);
+  runtime_eval(r, "(def update (fn (state dt) {'x (+ (get state 'x) (* dt (get state 'speed))) 'speed (get state 'speed)}))");
+  runtime_eval(r, "(def describe (fn (name xs) (list name (count xs) (reduce + 0 xs))))");
+
+  Handle update = embed_retain(r, embed_lookup(r, "update"));
+  Obj *init[] = { embed_symbol(r, "x"), embed_number(r, 0), embed_symbol(r, "speed"), embed_number(r, 2) };
+  Handle state = embed_retain(r, embed_map(r, init, 4));
+  int obj_count = r->gc->obj_count;
+  for(int frame = 0; frame < 100; frame++) {
+    Obj *args[] = { embed_handle_get(r, state), embed_number(r, 0.5) };
+    embed_handle_set(r, state, embed_call(r, embed_handle_get(r, update), args, 2));
+    gc_collect(r->gc);
+  }
+  double x = 0;
+  assert(embed_to_number(embed_get(embed_handle_get(r, state), embed_symbol(r, "x")), &x) && x == 100);
+  assert(r->gc->obj_count < obj_count + 10); // nothing was parsed or compiled
+  embed_release(r, state);
+  assert(embed_retain(r, r->nil) == state); // the slot is reused
+
+  Obj *xs[] = { embed_number(r, 1), embed_number(r, 2), embed_number(r, 3) };
+  Obj *args[] = { embed_string(r, "abc"), embed_vector(r, xs, 3) };
+  Obj *result = embed_call_global(r, "describe", args, 2);
+  assert(embed_count(r, result) == 3);
+  assert(strcmp(embed_to_string(embed_nth(r, result, 0)), "abc") == 0);
+  assert(embed_nth(r, result, 2)->number == 6);
+  assert(embed_nth(r, result, 3) == NULL);
+  assert(embed_is_true(r, embed_call_global(r, "=", xs, 1)) && !embed_is_true(r, embed_lookup(r, "false")));
+
+  // Failing calls return NULL and leave the runtime usable
+  assert(embed_call_global(r, "undefined", NULL, 0) == NULL);
+  assert(embed_call(r, embed_number(r, 1), NULL, 0) == NULL);
+  runtime_eval(r, "(def forever (fn (n) (+ 1 (forever n))))");
+  assert(embed_call_global(r, "forever", xs, 1) == NULL);
+  assert(r->top_frame == -1);
+  embed_define(r, "scale", embed_number(r, 10));
+  runtime_eval(r, "(def scaled (fn (x) (* x scale)))");
+  assert(embed_call_global(r, "scaled", xs, 1)->number == 10);
+  runtime_delete(r);
+}
+
+void write_file(const char *path, const char *text) {
+  FILE *f = fopen(path, "w");
+  fputs(text, f);
+  fclose(f);
+}
+
+Obj *global(Runtime *r, const char *name) {
+  return runtime_env_find_pair(r->global_env, gc_make_symbol(r->gc, name))->cdr;
+}
+
+// Only the edited forms are evaluated, the score survives and callers see the new definitions
+void test_reload() {
+  const char *path = "/tmp/pilsner_reload_test.lisp";
+  remove("/tmp/pilsner_reload_test.plc");
+  write_file(path,
+	     "(def score 0)\n"
+	     "(def points (fn () 10))\n"
+	     "(def add-points (fn () (def score (+ score (points)))))\n"
+	     "(def old-helper (fn () 1))\n");
+  Runtime *r = runtime_new(true);
+  assert(runtime_load_file(r, path, true));
+  Runtime *cached = runtime_new(true);
+  assert(runtime_load_file(cached, path, true)); // from the code cache that the first load wrote
+  runtime_eval(r, "(add-points)");
+  runtime_eval(r, "(add-points)");
+  runtime_eval(cached, "(add-points)");
+  assert(global(r, "score")->number == 20);
+
+  write_file(path,
+	     "(def score 0)\n"
+	     "(def points (fn () 100)) ; worth more now\n"
+	     "(def add-points   (fn ()   (def score (+ score (points)))))\n"
+	     "(def bonus (fn () (do (add-points) (add-points))))\n");
+  Obj *names = runtime_reload_file(r, path);
+  assert(count(names) == 2 && strcmp(FIRST(names)->name, "points") == 0 && strcmp(SECOND(names)->name, "bonus") == 0);
+  assert(global(r, "score")->number == 20);
+  runtime_eval(r, "(bonus)");
+  assert(global(r, "score")->number == 220);
+  assert(global(r, "old-helper")->type == LAMBDA);
+  assert(count(runtime_reload_file(r, path)) == 0);
+
+  assert(count(runtime_reload_file(cached, path)) == 2);
+  runtime_eval(cached, "(bonus)");
+  assert(global(cached, "score")->number == 210);
+
+  assert(runtime_reload_file(r, "/tmp/pilsner_no_such_file.lisp") == NULL);
+
+  // A changed form that loads other files adds to the table of loaded files while the reload still uses it
+  char loads[1024] = "(do";
+  char other_path[64];
+  for(int i = 0; i < 10; i++) {
+    snprintf(other_path, sizeof(other_path), "/tmp/pilsner_reload_test_%d.lisp", i);
+    write_file(other_path, "(def loaded-other (+ loaded-other 1))\n");
+    sprintf(loads + strlen(loads), " (load \"%s\")", other_path);
+  }
+  strcat(loads, ")\n");
+  char source[2048];
+  snprintf(source, sizeof(source), "(def loaded-other 0)\n%s(def points (fn () 1000))\n(def bonus 0)\n", loads);
+  write_file(path, source);
+  names = runtime_reload_file(r, path);
+  assert(count(names) == 3 && strcmp(FIRST(names)->name, "loaded-other") == 0);
+  assert(global(r, "loaded-other")->number == 10);
+  assert(count(runtime_reload_file(r, path)) == 0);
+  for(int i = 0; i < 10; i++) {
+    snprintf(other_path, sizeof(other_path), "/tmp/pilsner_reload_test_%d.lisp", i);
+    remove(other_path);
+    snprintf(other_path, sizeof(other_path), "/tmp/pilsner_reload_test_%d.plc", i);
+    remove(other_path);
+  }
+
+  // Only def and defmacro define names
+  assert(!form_defined_name(parse(r->gc, "(default-size x)")->car));
+  assert(strcmp(form_defined_name(parse(r->gc, "(defmacro m () nil)")->car), "m") == 0);
+  runtime_delete(r);
+  runtime_delete(cached);
+  remove(path);
+  remove("/tmp/pilsner_reload_test.plc");
+}
+
+// The cache is only used for the exact version of the source that it was compiled from
+void test_code_cache() {
+  const char *path = "/tmp/pilsner_cache_test.lisp";
+  const char *cache_path = "/tmp/pilsner_cache_test.plc";
+  remove(cache_path);
+  write_file(path, "(def v 1)\n");
+  Runtime *r = runtime_new(true);
+  assert(runtime_load_file(r, path, true));
+  write_file(path, "(def v 2)\n"); // same size, and most likely within the same second
+  assert(runtime_load_file(r, path, true));
+  assert(global(r, "v")->number == 2);
+  runtime_delete(r);
+
+  // A broken cache is detected before any of it runs, so the forms only run once (from the source)
+  write_file(path, "(def runs (+ runs 1))\n(def w [1 2 3])\n");
+  r = runtime_new(true);
+  runtime_eval(r, "(def runs 0)");
+  assert(runtime_load_file(r, path, true));
+  struct stat cache_stat;
+  assert(stat(cache_path, &cache_stat) == 0);
+  assert(truncate(cache_path, cache_stat.st_size - 4) == 0);
+  assert(runtime_load_file(r, path, true));
+  assert(global(r, "runs")->number == 2);
+  runtime_delete(r);
+
+  // A fatal error in a cached form only stops that form
+  write_file(path, "(def f (fn (n) (if (= n 0) 0 (+ 1 (f (- n 1))))))\n(def depth (f depth))\n(def after 1)\n");
+  r = runtime_new(true);
+  runtime_eval(r, "(def depth 10)");
+  assert(runtime_load_file(r, path, true));
+  runtime_delete(r);
+  r = runtime_new(true);
+  runtime_eval(r, "(def depth 100000)");
+  assert(runtime_load_file(r, path, true));
+  assert(global(r, "after")->number == 1);
+  runtime_delete(r);
+
+  // The cached code of a form has the macro expanded, it's compiled again when the macro changes in another file
+  const char *macro_path = "/tmp/pilsner_cache_test_macro.lisp";
+  const char *macro_cache_path = "/tmp/pilsner_cache_test_macro.plc";
+  write_file(macro_path, "(defmacro twice (x) (list '+ x x))\n");
+  write_file(path, "(def twice-three (twice 3))\n");
+  r = runtime_new(true);
+  assert(runtime_load_file(r, macro_path, true));
+  assert(runtime_load_file(r, path, true));
+  assert(global(r, "twice-three")->number == 6);
+  runtime_delete(r);
+  write_file(macro_path, "(defmacro twice (x) (list '* x x))\n");
+  for(int i = 0; i < 2; i++) {
+    r = runtime_new(true);
+    assert(runtime_load_file(r, macro_path, true));
+    assert(runtime_load_file(r, path, true));
+    assert(global(r, "twice-three")->number == 9);
+    runtime_delete(r);
+  }
+  assert(stat(cache_path, &cache_stat) == 0); // written again by the second load
+  remove(macro_path);
+  remove(macro_cache_path);
+  remove(path);
+  remove(cache_path);
+}
+
+void test_inlining() {
+  Runtime *r = runtime_new(true);
+  runtime_eval(r, "(def add-one (fn (x) (+ x 1)))");
+  runtime_eval(r, "(def add-two (fn (x) (add-one (add-one x))))");
+  Obj *add_two = runtime_env_find_pair(r->global_env, gc_make_symbol(r->gc, "add-two"))->cdr;
+  Obj *old_code = add_two->cdr->cdr;
+  assert(r->inline_deps.count == 1);
+
+  // Redefining the inlined function recompiles the code that depends on it
+  runtime_eval(r, "(def add-one 5)");
+  assert(add_two->cdr->cdr != old_code);
+  assert(r->inline_deps.count == 0);
+  runtime_eval(r, "(def add-one (fn (x) (+ x 10)))");
+  runtime_eval(r, "(def result (add-two 1))");
+  assert(runtime_env_find_pair(r->global_env, gc_make_symbol(r->gc, "result"))->cdr->number == 21);
+
+  // Lambdas that are garbage are forgotten
+  runtime_eval(r, "(def add-two (fn (x) (add-one (add-one x))))");
+  assert(r->inline_deps.count == 1);
+  runtime_eval(r, "(def add-two nil)");
+  gc_collect(r->gc);
+  assert(r->inline_deps.count == 0);
+  runtime_delete(r);
+}
+
+void test_sizes() {
+  printf("Obj size: %lu\n", sizeof(Obj));
+}
+
+void tests() {
+  test_gc();
+  //test_printing();
+  //test_parsing();
+  //test_runtime();
+  //test_local_environments();
+  //test_str_allocs();
+  //test_bytecode();
+  //test_bytecode_jump();
+  //test_bytecode_if();
+  //test_bytecode_with_lambda();
+  //test_compiler();
+  test_serialize();
+  test_image();
+  test_numbers();
+  test_vector();
+  test_map();
+  test_array();
+  test_simd();
+  test_macros();
+  test_inlining();
+  test_long_lists();
+  test_lazy_seqs();
+  test_fatal_error_recovery();
+  test_parallel_runtimes();
+  test_parallel_gc();
+  test_lazy_sweep();
+  test_isolates();
+  test_code_heap();
+  test_embed();
+  test_reload();
+  test_code_cache();
+}
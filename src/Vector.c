@@ -0,0 +1,130 @@
+#include "Vector.h"
+#include <string.h>
+
+static int tail_offset(Obj *vector) {
+  if(vector->count < VECTOR_WIDTH) {
+    return 0;
+  }
+  return ((vector->count - 1) >> VECTOR_BITS) << VECTOR_BITS;
+}
+
+// Returns the lowest level node that contains 'index'.
+static Obj *leaf_for(Obj *vector, int index) {
+  if(index >= tail_offset(vector)) {
+    return vector->tail;
+  }
+  Obj *node = vector->root;
+  for(int level = vector->shift; level > 0; level -= VECTOR_BITS) {
+    node = node->items[(index >> level) & VECTOR_MASK];
+  }
+  return node;
+}
+
+Obj *vector_nth(Obj *vector, int index) {
+  if(index < 0 || index >= vector->count) {
+    return NULL;
+  }
+  return leaf_for(vector, index)->items[index & VECTOR_MASK];
+}
+
+// Copies 'node' into a new node with room for 'count' slots, node can be NULL.
+static Obj *copy_node(GC *gc, Obj *node, int count) {
+  Obj *copy = gc_make_vector_node(gc, count);
+  if(node) {
+    memcpy(copy->items, node->items, sizeof(Obj*) * (node->count < count ? node->count : count));
+  }
+  return copy;
+}
+
+static Obj *new_path(GC *gc, int level, Obj *node) {
+  if(level == 0) {
+    return node;
+  }
+  Obj *path = gc_make_vector_node(gc, 1);
+  path->items[0] = new_path(gc, level - VECTOR_BITS, node);
+  return path;
+}
+
+static Obj *push_tail(GC *gc, Obj *vector, int level, Obj *parent, Obj *tail_node) {
+  int parent_count = parent ? parent->count : 0;
+  int sub_index = ((vector->count - 1) >> level) & VECTOR_MASK;
+  Obj *result = copy_node(gc, parent, sub_index + 1 > parent_count ? sub_index + 1 : parent_count);
+  Obj *node_to_insert;
+  if(level == VECTOR_BITS) {
+    node_to_insert = tail_node;
+  }
+  else if(sub_index < parent_count) {
+    node_to_insert = push_tail(gc, vector, level - VECTOR_BITS, parent->items[sub_index], tail_node);
+  }
+  else {
+    node_to_insert = new_path(gc, level - VECTOR_BITS, tail_node);
+  }
+  result->items[sub_index] = node_to_insert;
+  return result;
+}
+
+Obj *vector_conj(GC *gc, Obj *vector, Obj *item) {
+  int tail_count = vector->count - tail_offset(vector);
+
+  if(tail_count < VECTOR_WIDTH) {
+    // Room left in the tail, only the tail is copied
+    Obj *tail = copy_node(gc, vector->tail, tail_count + 1);
+    tail->items[tail_count] = item;
+    return gc_make_vector(gc, vector->root, tail, vector->count + 1, vector->shift);
+  }
+
+  // The full tail is moved into the trie as a leaf
+  Obj *root;
+  int shift = vector->shift;
+  if((vector->count >> VECTOR_BITS) > (1 << vector->shift)) {
+    // The root is full, add a level on top
+    root = gc_make_vector_node(gc, 2);
+    root->items[0] = vector->root;
+    root->items[1] = new_path(gc, vector->shift, vector->tail);
+    shift += VECTOR_BITS;
+  }
+  else {
+    root = push_tail(gc, vector, vector->shift, vector->root, vector->tail);
+  }
+
+  Obj *tail = gc_make_vector_node(gc, 1);
+  tail->items[0] = item;
+  return gc_make_vector(gc, root, tail, vector->count + 1, shift);
+}
+
+static Obj *assoc_in_node(GC *gc, int level, Obj *node, int index, Obj *item) {
+  Obj *result = copy_node(gc, node, node->count);
+  if(level == 0) {
+    result->items[index & VECTOR_MASK] = item;
+  } else {
+    int sub_index = (index >> level) & VECTOR_MASK;
+    result->items[sub_index] = assoc_in_node(gc, level - VECTOR_BITS, node->items[sub_index], index, item);
+  }
+  return result;
+}
+
+Obj *vector_assoc(GC *gc, Obj *vector, int index, Obj *item) {
+  if(index == vector->count) {
+    return vector_conj(gc, vector, item);
+  }
+  else if(index < 0 || index > vector->count) {
+    return NULL;
+  }
+  else if(index >= tail_offset(vector)) {
+    Obj *tail = copy_node(gc, vector->tail, vector->tail->count);
+    tail->items[index & VECTOR_MASK] = item;
+    return gc_make_vector(gc, vector->root, tail, vector->count, vector->shift);
+  }
+  else {
+    Obj *root = assoc_in_node(gc, vector->shift, vector->root, index, item);
+    return gc_make_vector(gc, root, vector->tail, vector->count, vector->shift);
+  }
+}
+
+Obj *vector_from_array(GC *gc, Obj *items[], int item_count) {
+  Obj *vector = gc_make_vector(gc, NULL, NULL, 0, VECTOR_BITS);
+  for(int i = 0; i < item_count; i++) {
+    vector = vector_conj(gc, vector, items[i]);
+  }
+  return vector;
+}
@@ -14,7 +14,6 @@
 #include "Tests.h"
 
 int main(int argc, char *argv[]) {
-  srand(time(0));
   //tests();
   repl();
 }